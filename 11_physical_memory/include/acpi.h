@@ -0,0 +1,255 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de las tablas ACPI que usa el kernel
+ * (RSDP, RSDT, SRAT, SLIT y MADT).
+ * @see http://www.acpi.info Especificacion ACPI
+ */
+
+#ifndef ACPI_H_
+#define ACPI_H_
+
+/** @brief Firma del RSDP (Root System Description Pointer) */
+#define ACPI_RSDP_SIGNATURE "RSD PTR "
+
+/** @brief Direccion en la BDA en la cual se almacena el segmento del EBDA */
+#define EBDA_SEGMENT_LOCATION 0x40E
+
+/** @brief Inicio del area de la BIOS en la cual se busca el RSDP */
+#define BIOS_ROM_START 0xE0000
+
+/** @brief Fin del area de la BIOS en la cual se busca el RSDP */
+#define BIOS_ROM_END 0x100000
+
+/** @brief Tipo de estructura de la SRAT: afinidad de procesador (APIC) */
+#define SRAT_PROCESSOR_AFFINITY 0
+
+/** @brief Tipo de estructura de la SRAT: afinidad de memoria */
+#define SRAT_MEMORY_AFFINITY 1
+
+/** @brief Bit 'Enabled' de las estructuras de afinidad de la SRAT */
+#define SRAT_ENABLED 0x1
+
+/** @brief Estructura del RSDP (ACPI 1.0) */
+typedef struct acpi_rsdp {
+	/** @brief Firma "RSD PTR " */
+	char signature[8];
+	/** @brief Suma de chequeo de los primeros 20 bytes */
+	unsigned char checksum;
+	/** @brief Identificador del fabricante */
+	char oem_id[6];
+	/** @brief Revision de la estructura (0 = ACPI 1.0) */
+	unsigned char revision;
+	/** @brief Direccion fisica de la RSDT */
+	unsigned int rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+/** @brief Encabezado comun de todas las tablas ACPI (SDT) */
+typedef struct acpi_header {
+	/** @brief Firma de la tabla ("RSDT", "SRAT", "APIC", ...) */
+	char signature[4];
+	/** @brief Tamano de la tabla en bytes, incluyendo el encabezado */
+	unsigned int length;
+	/** @brief Revision de la tabla */
+	unsigned char revision;
+	/** @brief Suma de chequeo de toda la tabla */
+	unsigned char checksum;
+	/** @brief Identificador del fabricante */
+	char oem_id[6];
+	/** @brief Identificador de la tabla del fabricante */
+	char oem_table_id[8];
+	/** @brief Revision de la tabla del fabricante */
+	unsigned int oem_revision;
+	/** @brief Identificador del creador de la tabla */
+	unsigned int creator_id;
+	/** @brief Revision del creador de la tabla */
+	unsigned int creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/** @brief Encabezado de la SRAT (System Resource Affinity Table). Las
+ * estructuras de afinidad se encuentran a continuacion. */
+typedef struct acpi_srat {
+	/** @brief Encabezado comun */
+	acpi_header_t header;
+	/** @brief Reservado (debe ser 1) */
+	unsigned int reserved1;
+	/** @brief Reservado */
+	unsigned int reserved2[2];
+} __attribute__((packed)) acpi_srat_t;
+
+/** @brief Estructura de afinidad de procesador (tipo 0) de la SRAT */
+typedef struct srat_processor_affinity {
+	/** @brief Tipo de estructura (0) */
+	unsigned char type;
+	/** @brief Tamano de la estructura (16) */
+	unsigned char length;
+	/** @brief Bits 0..7 del dominio de proximidad */
+	unsigned char domain_low;
+	/** @brief Identificador del APIC local del procesador */
+	unsigned char apic_id;
+	/** @brief Flags: bit 0 = Enabled */
+	unsigned int flags;
+	/** @brief Identificador del SAPIC local */
+	unsigned char sapic_eid;
+	/** @brief Bits 8..31 del dominio de proximidad */
+	unsigned char domain_high[3];
+	/** @brief Dominio de reloj */
+	unsigned int clock_domain;
+} __attribute__((packed)) srat_processor_affinity_t;
+
+/** @brief Estructura de afinidad de memoria (tipo 1) de la SRAT */
+typedef struct srat_memory_affinity {
+	/** @brief Tipo de estructura (1) */
+	unsigned char type;
+	/** @brief Tamano de la estructura (40) */
+	unsigned char length;
+	/** @brief Dominio de proximidad */
+	unsigned int domain;
+	/** @brief Reservado */
+	unsigned short reserved1;
+	/** @brief Bits 0..31 de la direccion base del rango */
+	unsigned int base_low;
+	/** @brief Bits 32..63 de la direccion base del rango */
+	unsigned int base_high;
+	/** @brief Bits 0..31 del tamano del rango */
+	unsigned int length_low;
+	/** @brief Bits 32..63 del tamano del rango */
+	unsigned int length_high;
+	/** @brief Reservado */
+	unsigned int reserved2;
+	/** @brief Flags: bit 0 = Enabled, bit 1 = Hot Pluggable */
+	unsigned int flags;
+	/** @brief Reservado */
+	unsigned int reserved3[2];
+} __attribute__((packed)) srat_memory_affinity_t;
+
+/** @brief SLIT (System Locality Information Table). Contiene una matriz de
+ * localities x localities distancias relativas entre dominios. */
+typedef struct acpi_slit {
+	/** @brief Encabezado comun */
+	acpi_header_t header;
+	/** @brief Numero de dominios (localities) */
+	unsigned int localities_low;
+	/** @brief Bits 32..63 del numero de dominios */
+	unsigned int localities_high;
+	/** @brief Matriz de distancias (localities x localities) */
+	unsigned char distance[];
+} __attribute__((packed)) acpi_slit_t;
+
+/** @brief Tipo de estructura de la MADT: APIC local de un procesador */
+#define MADT_LOCAL_APIC 0
+
+/** @brief Tipo de estructura de la MADT: I/O APIC */
+#define MADT_IO_APIC 1
+
+/** @brief Tipo de estructura de la MADT: redefinicion de una IRQ ISA */
+#define MADT_INTERRUPT_OVERRIDE 2
+
+/** @brief Bit 'Enabled' de la estructura de APIC local de la MADT */
+#define MADT_ENABLED 0x1
+
+/** @brief Flags de la MADT: el sistema tiene los PIC 8259 */
+#define MADT_PCAT_COMPAT 0x1
+
+/** @brief Flags MPS de una redefinicion: mascara de la polaridad */
+#define MADT_POLARITY_MASK 0x3
+
+/** @brief Flags MPS de una redefinicion: activa en alto */
+#define MADT_POLARITY_HIGH 0x1
+
+/** @brief Flags MPS de una redefinicion: activa en bajo */
+#define MADT_POLARITY_LOW 0x3
+
+/** @brief Flags MPS de una redefinicion: mascara del modo de disparo */
+#define MADT_TRIGGER_MASK 0xC
+
+/** @brief Flags MPS de una redefinicion: disparo por flanco */
+#define MADT_TRIGGER_EDGE 0x4
+
+/** @brief Flags MPS de una redefinicion: disparo por nivel */
+#define MADT_TRIGGER_LEVEL 0xC
+
+/** @brief Encabezado de la MADT (Multiple APIC Description Table, firma
+ * "APIC"). Las estructuras de los controladores de interrupcion se
+ * encuentran a continuacion. */
+typedef struct acpi_madt {
+	/** @brief Encabezado comun */
+	acpi_header_t header;
+	/** @brief Direccion fisica del APIC local de cada procesador */
+	unsigned int local_apic_address;
+	/** @brief Flags: bit 0 = existen los PIC 8259 */
+	unsigned int flags;
+} __attribute__((packed)) acpi_madt_t;
+
+/** @brief Encabezado comun de las estructuras de la MADT */
+typedef struct madt_entry {
+	/** @brief Tipo de estructura */
+	unsigned char type;
+	/** @brief Tamano de la estructura */
+	unsigned char length;
+} __attribute__((packed)) madt_entry_t;
+
+/** @brief Estructura de APIC local (tipo 0) de la MADT */
+typedef struct madt_local_apic {
+	/** @brief Tipo de estructura (0) */
+	unsigned char type;
+	/** @brief Tamano de la estructura (8) */
+	unsigned char length;
+	/** @brief Identificador ACPI del procesador */
+	unsigned char processor_id;
+	/** @brief Identificador del APIC local del procesador */
+	unsigned char apic_id;
+	/** @brief Flags: bit 0 = Enabled */
+	unsigned int flags;
+} __attribute__((packed)) madt_local_apic_t;
+
+/** @brief Estructura de I/O APIC (tipo 1) de la MADT */
+typedef struct madt_io_apic {
+	/** @brief Tipo de estructura (1) */
+	unsigned char type;
+	/** @brief Tamano de la estructura (12) */
+	unsigned char length;
+	/** @brief Identificador del I/O APIC */
+	unsigned char io_apic_id;
+	/** @brief Reservado */
+	unsigned char reserved;
+	/** @brief Direccion fisica de los registros del I/O APIC */
+	unsigned int address;
+	/** @brief Primera interrupcion global (GSI) que atiende el I/O APIC */
+	unsigned int gsi_base;
+} __attribute__((packed)) madt_io_apic_t;
+
+/** @brief Estructura de redefinicion de una IRQ ISA (tipo 2) de la MADT. Por
+ * defecto, la IRQ ISA n corresponde a la GSI n, activa en alto y por
+ * flanco. */
+typedef struct madt_interrupt_override {
+	/** @brief Tipo de estructura (2) */
+	unsigned char type;
+	/** @brief Tamano de la estructura (10) */
+	unsigned char length;
+	/** @brief Bus (0 = ISA) */
+	unsigned char bus;
+	/** @brief IRQ ISA */
+	unsigned char source;
+	/** @brief Interrupcion global (GSI) a la cual se conecta la IRQ */
+	unsigned int gsi;
+	/** @brief Flags MPS: polaridad (bits 0..1) y disparo (bits 2..3) */
+	unsigned short flags;
+} __attribute__((packed)) madt_interrupt_override_t;
+
+/**
+ * @brief Busca el RSDP y la RSDT de ACPI.
+ * @return 0 si se encontro la RSDT, -1 en caso contrario.
+ */
+int setup_acpi(void);
+
+/**
+ * @brief Busca una tabla ACPI dentro de la RSDT.
+ * @param signature Firma de 4 caracteres de la tabla ("SRAT", "APIC", ...)
+ * @return Apuntador al encabezado de la tabla, 0 si no existe.
+ */
+acpi_header_t * acpi_find_table(char * signature);
+
+#endif /* ACPI_H_ */
@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de la entrega de IRQ por medio del I/O
+ * APIC y el APIC local.
+ * @details
+ * Si la MADT de ACPI describe al menos un I/O APIC, setup_apic() enmascara
+ * los PIC 8259 y programa la tabla de redireccion de cada I/O APIC para
+ * entregar las IRQ al APIC local del BSP. Los vectores y los manejadores
+ * no cambian (IRQ n = vector IDT_IRQ_OFFSET + n, ver irq.h), pero el EOI se
+ * envia con una escritura en memoria al APIC local en lugar de los puertos
+ * de los PIC, y se pueden atender mas de 16 lineas. El EOI se envia despues
+ * de ejecutar el manejador, ya que una IRQ por nivel se volveria a entregar
+ * mientras el dispositivo mantiene la linea activa.
+ *
+ * Las IRQ 0..15 son las IRQ ISA, conectadas a la GSI (Global System
+ * Interrupt) que indique la MADT (por defecto la GSI con el mismo numero).
+ * Las IRQ 16.. corresponden a la GSI del mismo numero (activas en bajo y
+ * por nivel, como las de PCI). Una entrada de la tabla de redireccion solo
+ * se habilita mientras la IRQ tiene un manejador.
+ *
+ * Si no existe la MADT o un I/O APIC, las IRQ se siguen entregando por
+ * medio de los PIC.
+ */
+
+#ifndef APIC_H_
+#define APIC_H_
+
+#include <smp.h>
+
+/** @brief Numero maximo de I/O APIC */
+#define MAX_IO_APICS 4
+
+/** @brief Numero de IRQ ISA */
+#define ISA_IRQS 16
+
+/** @brief Registro del I/O APIC: seleccion del registro interno */
+#define IOAPIC_REGSEL 0x00
+
+/** @brief Registro del I/O APIC: ventana al registro seleccionado */
+#define IOAPIC_WINDOW 0x10
+
+/** @brief Registro interno del I/O APIC: version. Los bits 16..23 contienen
+ * el numero de entradas de la tabla de redireccion menos 1. */
+#define IOAPIC_VERSION 0x01
+
+/** @brief Registro interno del I/O APIC: primera entrada de la tabla de
+ * redireccion. Cada entrada ocupa dos registros de 32 bits. */
+#define IOAPIC_REDIRECTION 0x10
+
+/** @brief Entrada de redireccion: polaridad activa en bajo */
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+
+/** @brief Entrada de redireccion: disparo por nivel */
+#define IOAPIC_LEVEL (1 << 15)
+
+/** @brief Entrada de redireccion: enmascarada */
+#define IOAPIC_MASKED (1 << 16)
+
+/** @brief Valor de irq_gsi para una IRQ que no esta conectada */
+#define IOAPIC_NO_GSI 0xFFFFFFFF
+
+/** @brief Puerto de seleccion del IMCR (Interrupt Mode Configuration
+ * Register, especificacion MP) */
+#define IMCR_SELECT 0x22
+
+/** @brief Puerto de datos del IMCR */
+#define IMCR_DATA 0x23
+
+/** @brief Estructura de un I/O APIC */
+typedef struct io_apic {
+	/** @brief Direccion fisica de los registros */
+	unsigned int address;
+	/** @brief Primera GSI que atiende */
+	unsigned int gsi_base;
+	/** @brief Numero de entradas de la tabla de redireccion */
+	unsigned int pins;
+} io_apic_t;
+
+/** @brief Vale 1 si las IRQ se entregan por medio del I/O APIC */
+extern int apic_enabled;
+
+/** @brief I/O APIC encontrados en la MADT */
+extern io_apic_t io_apics[MAX_IO_APICS];
+
+/** @brief Numero de I/O APIC */
+extern int io_apic_count;
+
+/**
+ * @brief Envia el EOI al APIC local del procesador actual.
+ */
+static __inline__ void lapic_eoi(void) {
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * @brief Habilita el APIC local del procesador actual, con el vector
+ * LAPIC_SPURIOUS_VECTOR para las interrupciones espurias.
+ */
+void lapic_enable(void);
+
+/**
+ * @brief Busca los I/O APIC en la MADT y redirige las IRQ hacia el APIC
+ * local del BSP. Requiere setup_acpi() y setup_irq().
+ * @return 0 si las IRQ se entregan por el I/O APIC, -1 si se siguen
+ * entregando por los PIC.
+ */
+int setup_apic(void);
+
+/**
+ * @brief Habilita la entrada de redireccion de una IRQ.
+ * @param irq Numero de IRQ
+ */
+void ioapic_unmask_irq(int irq);
+
+/**
+ * @brief Enmascara la entrada de redireccion de una IRQ.
+ * @param irq Numero de IRQ
+ */
+void ioapic_mask_irq(int irq);
+
+#endif /* APIC_H_ */
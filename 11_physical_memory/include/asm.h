@@ -76,4 +76,304 @@ static __inline__ void outw(unsigned short port, unsigned short data){
 	inline_assembly("outw %1,%0" : : "dN" (port), "a" (data));
 }
 
+/** @brief CPUID.01H:EDX bit 4: Time Stamp Counter (rdtsc) */
+#define CPUID_EDX_TSC (1 << 4)
+
+/** @brief CPUID.01H:EDX bit 6: Physical Address Extension (PAE) */
+#define CPUID_EDX_PAE (1 << 6)
+
+/** @brief CPUID.01H:EDX bit 3: Page Size Extension (paginas de 4 MB) */
+#define CPUID_EDX_PSE (1 << 3)
+
+/** @brief CPUID.01H:EDX bit 9: APIC local */
+#define CPUID_EDX_APIC (1 << 9)
+
+/** @brief CPUID.01H:EDX bit 16: Page Attribute Table (PAT) */
+#define CPUID_EDX_PAT (1 << 16)
+
+/** @brief CPUID.01H:EDX bit 24: FXSAVE / FXRSTOR */
+#define CPUID_EDX_FXSR (1 << 24)
+
+/** @brief CPUID.01H:EDX bit 25: SSE */
+#define CPUID_EDX_SSE (1 << 25)
+
+/** @brief CPUID.01H:EDX bit 26: SSE2 */
+#define CPUID_EDX_SSE2 (1 << 26)
+
+/**
+ * @brief Ejecuta la instruccin CPUID.
+ * @param leaf Valor de EAX (funcin de CPUID a consultar)
+ * @param eax Apuntador en el cual se almacena el valor retornado en EAX
+ * @param ebx Apuntador en el cual se almacena el valor retornado en EBX
+ * @param ecx Apuntador en el cual se almacena el valor retornado en ECX
+ * @param edx Apuntador en el cual se almacena el valor retornado en EDX
+ */
+static __inline__ void cpuid(unsigned int leaf, unsigned int * eax,
+		unsigned int * ebx, unsigned int * ecx, unsigned int * edx) {
+	inline_assembly("cpuid"
+			: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+			: "a" (leaf), "c" (0));
+}
+
+/**
+ * @brief Suma atmicamente un valor a una variable (lock xadd).
+ * @param ptr Apuntador a la variable
+ * @param value Valor a sumar
+ * @return Valor de la variable antes de la suma
+ */
+static __inline__ int atomic_add(volatile int * ptr, int value) {
+	inline_assembly("lock; xaddl %0, %1"
+			: "+r" (value), "+m" (*ptr) : : "memory", "cc");
+	return value;
+}
+
+/**
+ * @brief Compara y reemplaza atmicamente una variable (lock cmpxchg).
+ * @param ptr Apuntador a la variable
+ * @param old Valor esperado
+ * @param value Nuevo valor, que se almacena solo si *ptr == old
+ * @return Valor de la variable antes de la operacin. Si es igual a old, el
+ * reemplazo se realiz.
+ */
+static __inline__ unsigned int atomic_cmpxchg(volatile unsigned int * ptr,
+		unsigned int old, unsigned int value) {
+	unsigned int prev;
+	inline_assembly("lock; cmpxchgl %2, %1"
+			: "=a" (prev), "+m" (*ptr) : "r" (value), "0" (old)
+			: "memory", "cc");
+	return prev;
+}
+
+/**
+ * @brief Establece atmicamente un bit en 1 (lock bts).
+ * @param ptr Apuntador a la palabra de 32 bits
+ * @param bit Bit a establecer (0..31)
+ * @return Valor anterior del bit (0 o 1)
+ */
+static __inline__ int atomic_test_and_set_bit(volatile unsigned int * ptr,
+		unsigned int bit) {
+	unsigned char old;
+	inline_assembly("lock; btsl %2, %1; setc %0"
+			: "=q" (old), "+m" (*ptr) : "Ir" (bit) : "memory", "cc");
+	return old;
+}
+
+/**
+ * @brief Establece atmicamente un bit en 0 (lock btr).
+ * @param ptr Apuntador a la palabra de 32 bits
+ * @param bit Bit a limpiar (0..31)
+ * @return Valor anterior del bit (0 o 1)
+ */
+static __inline__ int atomic_test_and_clear_bit(volatile unsigned int * ptr,
+		unsigned int bit) {
+	unsigned char old;
+	inline_assembly("lock; btrl %2, %1; setc %0"
+			: "=q" (old), "+m" (*ptr) : "Ir" (bit) : "memory", "cc");
+	return old;
+}
+
+/**
+ * @brief Resta atmicamente n a un contador, solo si el contador es mayor o
+ * igual que n.
+ * @param ptr Apuntador al contador
+ * @param n Valor a restar
+ * @return 1 si se rest el valor, 0 si el contador era menor que n.
+ */
+static __inline__ int atomic_take(volatile int * ptr, int n) {
+	int old;
+
+	do {
+		old = *ptr;
+		if (old < n) {
+			return 0;
+		}
+	} while (atomic_cmpxchg((volatile unsigned int *)ptr, old, old - n)
+			!= (unsigned int)old);
+	return 1;
+}
+
+/** @brief Bit IF (Interrupt Enable) de EFLAGS */
+#define EFLAGS_IF 0x00000200
+
+/**
+ * @brief Almacena el registro EFLAGS y deshabilita las interrupciones.
+ * @return Valor de EFLAGS antes de deshabilitar las interrupciones, para
+ * restaurarlo con irq_restore().
+ */
+static __inline__ unsigned int irq_save(void) {
+	unsigned int flags;
+	inline_assembly("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+	return flags;
+}
+
+/**
+ * @brief Restaura el registro EFLAGS almacenado por irq_save(). Si las
+ * interrupciones estaban habilitadas, se vuelven a habilitar.
+ * @param flags Valor de EFLAGS retornado por irq_save()
+ */
+static __inline__ void irq_restore(unsigned int flags) {
+	inline_assembly("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+/**
+ * @brief Lee el contador de ciclos del procesador (Time Stamp Counter).
+ * @return Valor de 64 bits del TSC
+ */
+static __inline__ unsigned long long rdtsc(void) {
+	unsigned int low, high;
+	inline_assembly("rdtsc" : "=a" (low), "=d" (high));
+	return ((unsigned long long)high << 32) | low;
+}
+
+/**
+ * @brief Divide un numero de 64 bits entre un divisor de 32 bits, sin usar
+ * las rutinas de division de 64 bits de libgcc (que el kernel no enlaza).
+ * @param n Apuntador al numero. Recibe el cociente.
+ * @param divisor Divisor
+ * @return Residuo de la division
+ @verbatim
+  Se divide primero la parte alta y luego (residuo:parte baja) con divl,
+  cuyo cociente siempre cabe en 32 bits dado que residuo < divisor.
+ @endverbatim*/
+static __inline__ unsigned int divide64(unsigned long long * n,
+		unsigned int divisor) {
+	unsigned int high;
+	unsigned int low;
+	unsigned int remainder;
+
+	high = (unsigned int)(*n >> 32);
+	low = (unsigned int)*n;
+
+	remainder = high % divisor;
+	high = high / divisor;
+	inline_assembly("divl %4" : "=a" (low), "=d" (remainder)
+			: "a" (low), "d" (remainder), "rm" (divisor));
+
+	*n = ((unsigned long long)high << 32) | low;
+	return remainder;
+}
+
+/**
+ * @brief Indica al procesador que se encuentra en un ciclo de espera activa
+ * (instruccin pause). Reduce el consumo y la penalizacin al salir del
+ * ciclo.
+ */
+static __inline__ void cpu_relax(void) {
+	inline_assembly("pause" : : : "memory");
+}
+
+/**
+ * @brief Lee el registro de control CR0.
+ * @return Valor de CR0
+ */
+static __inline__ unsigned int read_cr0(void) {
+	unsigned int value;
+	inline_assembly("movl %%cr0, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR0.
+ * @param value Nuevo valor de CR0
+ */
+static __inline__ void write_cr0(unsigned int value) {
+	inline_assembly("movl %0, %%cr0" : : "r" (value) : "memory");
+}
+
+/**
+ * @brief Lee el registro de control CR2 (direccion lineal que causo el
+ * ultimo fallo de pagina).
+ * @return Valor de CR2
+ */
+static __inline__ unsigned int read_cr2(void) {
+	unsigned int value;
+	inline_assembly("movl %%cr2, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Lee el registro de control CR3 (directorio de paginas).
+ * @return Valor de CR3
+ */
+static __inline__ unsigned int read_cr3(void) {
+	unsigned int value;
+	inline_assembly("movl %%cr3, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR3. Invalida las entradas de la
+ * TLB que no son globales.
+ * @param value Direccion fisica del directorio de paginas
+ */
+static __inline__ void write_cr3(unsigned int value) {
+	inline_assembly("movl %0, %%cr3" : : "r" (value) : "memory");
+}
+
+/** @brief Bit OSFXSR de CR4: el sistema operativo soporta FXSAVE/FXRSTOR y
+ * habilita las instrucciones SSE */
+#define CR4_OSFXSR 0x00000200
+
+/** @brief Bit OSXMMEXCPT de CR4: las excepciones de punto flotante SIMD se
+ * reportan con la excepcion 19 (\#XM) */
+#define CR4_OSXMMEXCPT 0x00000400
+
+/**
+ * @brief Lee el registro de control CR4.
+ * @return Valor de CR4
+ */
+static __inline__ unsigned int read_cr4(void) {
+	unsigned int value;
+	inline_assembly("movl %%cr4, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR4.
+ * @param value Nuevo valor de CR4
+ */
+static __inline__ void write_cr4(unsigned int value) {
+	inline_assembly("movl %0, %%cr4" : : "r" (value) : "memory");
+}
+
+/**
+ * @brief Invalida la entrada de la TLB de una pagina.
+ * @param addr Direccion lineal dentro de la pagina
+ */
+static __inline__ void invlpg(unsigned int addr) {
+	inline_assembly("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+/**
+ * @brief Lee un registro especifico del modelo (MSR).
+ * @param msr Numero del registro
+ * @param low Apuntador en el cual se almacenan los 32 bits menos
+ * significativos
+ * @param high Apuntador en el cual se almacenan los 32 bits mas
+ * significativos
+ */
+static __inline__ void rdmsr(unsigned int msr, unsigned int * low,
+		unsigned int * high) {
+	inline_assembly("rdmsr" : "=a" (*low), "=d" (*high) : "c" (msr));
+}
+
+/**
+ * @brief Escribe un registro especifico del modelo (MSR).
+ * @param msr Numero del registro
+ * @param low 32 bits menos significativos
+ * @param high 32 bits mas significativos
+ */
+static __inline__ void wrmsr(unsigned int msr, unsigned int low,
+		unsigned int high) {
+	inline_assembly("wrmsr" : : "c" (msr), "a" (low), "d" (high) : "memory");
+}
+
+/**
+ * @brief Escribe en memoria y luego invalida todas las lineas de las caches
+ * del procesador.
+ */
+static __inline__ void wbinvd(void) {
+	inline_assembly("wbinvd" : : : "memory");
+}
+
 #endif /* ASM_H_ */
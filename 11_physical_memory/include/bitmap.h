@@ -0,0 +1,306 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones del asignador de memoria basado en un
+ * mapa de bits.
+ * @details
+ * Un asignador gestiona un rango de memoria dividido en unidades de un
+ * tamano configurable (potencia de 2). Cada unidad se representa con un bit
+ * del mapa de bits del asignador (1 = unidad libre). La unidad i corresponde
+ * a la direccion base + i * unit_size.
+ *
+ * El kernel usa una instancia por defecto (memory_allocator, ver physmem.h)
+ * que cubre toda la memoria por debajo de LOW_MEMORY_LIMIT. Se pueden crear
+ * asignadores adicionales sobre regiones reservadas (por ejemplo, un pool de
+ * buffers para un dispositivo), cuyo mapa de bits es pequeno y por lo tanto
+ * se recorre rapidamente.
+ *
+ * Las unidades se toman y se liberan con lock btr / lock bts, por lo cual las
+ * rutinas de este archivo se pueden invocar desde varios procesadores y
+ * desde los manejadores de IRQ.
+ */
+
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include <asm.h>
+
+/** @brief Numero de bytes que tiene una entrada en el mapa de bits */
+#define BYTES_PER_ENTRY sizeof(unsigned int)
+
+/** @brief Numero de bits que tiene una entrada en el mapa de bits */
+#define BITS_PER_ENTRY (8 * BYTES_PER_ENTRY)
+
+/** @brief Valor retornado por bitmap_claim() si no encontro unidades */
+#define BITMAP_NO_UNIT 0xFFFFFFFF
+
+/** @brief Numero de entradas a partir del cual bitmap_find_entry() y
+ * bitmap_count() recorren el mapa de bits con registros XMM (128 bits por
+ * instruccion) */
+#define BITMAP_SSE_THRESHOLD 16
+
+/** @brief Estructura de datos de un asignador basado en mapa de bits */
+typedef struct bitmap_allocator {
+	/** @brief Mapa de bits del asignador (1 = unidad libre) */
+	unsigned int * bitmap;
+	/** @brief Direccion de la unidad 0 del mapa de bits */
+	unsigned int base;
+	/** @brief Tamano de una unidad en bytes */
+	unsigned int unit_size;
+	/** @brief Logaritmo en base 2 de unit_size */
+	unsigned int unit_shift;
+	/** @brief Primera unidad del rango que gestiona el asignador */
+	unsigned int first_unit;
+	/** @brief Numero de unidades del rango que gestiona el asignador */
+	unsigned int total_units;
+	/** @brief Numero de unidades libres. Las asignaciones lo descuentan con
+	 * atomic_take() antes de buscar la unidad en el mapa de bits. */
+	volatile int free_units;
+	/** @brief Unidad a partir de la cual inicia la proxima busqueda */
+	volatile unsigned int next_free_unit;
+} bitmap_allocator_t;
+
+/** @brief Permite verificar si la unidad se encuentra disponible.
+ * @param a Asignador
+ * @param unit unidad a verificar
+ * @return Diferente de cero si la unidad esta libre
+ *
+ * @verbatim
+   Ejemplo
+   unit = 1000000
+   entry= 1000000/ 32 =31250
+   offset= 1000000 % 32 =0
+   retorna bitmap[31250] & 0x1 << 0
+   si retorna un 1 significa que la unidad se encuentra libre
+   si retorna 0 significa que la unidad se encuentra ocupada.
+
+                        ....   1    0
+                  ---------------------
+31250 --------->  |   |   |   |   | x |  <---------- x = bit a verificar
+                  ---------------------
+                  |   |   |   |   |   |
+                  ---------------------
+                            ....
+
+
+  @endverbatim
+ */
+static __inline__ int bitmap_test_unit(bitmap_allocator_t * a,
+		unsigned int unit) {
+	 return (a->bitmap[unit / BITS_PER_ENTRY] & 0x1 << (unit % BITS_PER_ENTRY));
+}
+
+/** @brief Permite verificar si una unidad pertenece al rango que gestiona el
+ * asignador.
+ * @param a Asignador
+ * @param unit unidad a verificar
+ * @return 1 si first_unit <= unit < first_unit + total_units, 0 si no
+ */
+static __inline__ int bitmap_unit_in_range(bitmap_allocator_t * a,
+		unsigned int unit) {
+	 return (unit >= a->first_unit && unit - a->first_unit < a->total_units);
+}
+
+/** @brief  Permite marcar la unidad como ocupada.
+ * @param a Asignador
+ * @param unit unidad a marcar
+*@verbatim
+   Ejemplo:
+   unit= 1000000
+   entry = 1000000/32 = 31250
+   offset = 1000000 % 32 = 0
+   bitmap[31250] &= ~(0x1 << 0)
+   esto quiere decir que la unidad 1000000 que se va a marcar como ocupada (0)
+   se encuentra ubicada dentro del mapa de bits en la region 31250 en el bit 0
+   en esa region tal como se muestra en la siguiente figura
+
+               ....
+    -------------------------
+    | 1 | 1 | 1 | 1 | 1 | 1 |
+    -------------------------
+    | 1 | 1 | 1 | 1 | 1 | 0 | <----- bit 0 de la posicion 31250
+    -------------------------            del mapa de bits
+    | 1 | 1 | 1 | 1 | 1 | 1 |
+    -------------------------
+               .....
+    @endverbatim
+  * El bit se limpia con lock btr, por lo cual dos procesadores (o un
+  * manejador de IRQ) nunca toman la misma unidad.
+  * @return 1 si la unidad estaba libre y fue tomada, 0 si ya estaba ocupada.
+   */
+static __inline__ int bitmap_clear_unit(bitmap_allocator_t * a,
+		unsigned int unit) {
+	 return atomic_test_and_clear_bit(&a->bitmap[unit / BITS_PER_ENTRY],
+			 unit % BITS_PER_ENTRY);
+}
+
+/** @brief Permite marcar la unidad como libre.
+ * @param a Asignador
+ * @param unit unidad a marcar
+ @verbatim
+   Ejemplo:
+   unit= 335000
+   entry = 335000/32 = 10468
+   offset = 335000 % 32 = 24
+   bitmap[10468] |= (0x1 << 24)
+   esto quiere decir que la unidad 335000 que se va a marcar como libre (1)
+   se encuentra ubicada dentro del mapa de bits en la region 10468 en el bit 24
+   en esa region tal como se muestra en la siguiente figura.
+
+       bit 24 de la posicion 10468 del mapa de bits
+              |
+              |
+              V  ....
+    ---------------------------
+    | 0 | 0 | 1|...| 0 | 0 | 0 |
+    ---------------------------
+    | 1 | 1 | 1|...| 1 | 1 | 1 |
+    ---------------------------
+    | 0 | 0 | 0|...| 0 | 0 | 0 |
+    ---------------------------
+    | 1 | 1 | 1|...| 1 | 1 | 1 |
+    ---------------------------
+               .....
+    @endverbatim
+  * El bit se establece con lock bts.
+  * @return 1 si la unidad ya estaba libre, 0 si estaba ocupada.
+  */
+static __inline__ int bitmap_set_unit(bitmap_allocator_t * a,
+		unsigned int unit) {
+	 return atomic_test_and_set_bit(&a->bitmap[unit / BITS_PER_ENTRY],
+			 unit % BITS_PER_ENTRY);
+}
+
+/**
+ * @brief Convierte una unidad del asignador en su direccion de inicio.
+ * @param a Asignador
+ * @param unit Unidad
+ */
+#define bitmap_unit_address(a, unit) \
+	((char *)((a)->base + ((unit) << (a)->unit_shift)))
+
+/**
+ * @brief Convierte una direccion en la unidad del asignador que la contiene.
+ * @param a Asignador
+ * @param addr Direccion
+ */
+#define bitmap_address_unit(a, addr) \
+	(((unsigned int)(addr) - (a)->base) >> (a)->unit_shift)
+
+/**
+ * @brief Calcula el tamano en bytes del mapa de bits que requiere un
+ * asignador.
+ * @param length Tamano de la region que gestiona el asignador
+ * @param unit_size Tamano de la unidad
+ */
+#define bitmap_size(length, unit_size) \
+	((((length) / (unit_size) + BITS_PER_ENTRY - 1) / BITS_PER_ENTRY) \
+			* BYTES_PER_ENTRY)
+
+/**
+ * @brief Inicializa un asignador sobre una region de memoria. Todas las
+ * unidades de la region quedan libres.
+ * @param a Asignador
+ * @param start Direccion de inicio de la region, alineada a unit_size
+ * @param length Tamano de la region en bytes
+ * @param unit_size Tamano de la unidad (potencia de 2)
+ * @param bitmap Mapa de bits de bitmap_size(length, unit_size) bytes. Si es
+ * 0, el mapa de bits se toma de la memoria del kernel con
+ * allocate_unit_region().
+ * @return 0 si el asignador se inicializo, -1 en caso contrario.
+ */
+int bitmap_allocator_init(bitmap_allocator_t * a, unsigned int start,
+		unsigned int length, unsigned int unit_size, unsigned int * bitmap);
+
+/**
+ * @brief Asigna una unidad del asignador.
+ * @param a Asignador
+ * @return Direccion de inicio de la unidad, 0 si no existen unidades libres.
+ */
+char * bitmap_alloc(bitmap_allocator_t * a);
+
+/**
+ * @brief Asigna una region de unidades contiguas del asignador.
+ * @param a Asignador
+ * @param length Tamano de la region en bytes
+ * @return Direccion de inicio de la region, 0 si no existe una region libre
+ * del tamano solicitado.
+ */
+char * bitmap_alloc_region(bitmap_allocator_t * a, unsigned int length);
+
+/**
+ * @brief Libera una unidad del asignador.
+ * @param a Asignador
+ * @param addr Direccion dentro de la unidad a liberar
+ */
+void bitmap_free(bitmap_allocator_t * a, char * addr);
+
+/**
+ * @brief Libera una region del asignador.
+ * @param a Asignador
+ * @param addr Direccion de inicio de la region
+ * @param length Tamano de la region en bytes
+ */
+void bitmap_free_region(bitmap_allocator_t * a, char * addr,
+		unsigned int length);
+
+/**
+ * @brief Busca y toma count unidades contiguas del mapa de bits, a partir de
+ * un cursor.
+ * @param a Asignador
+ * @param cursor Unidad en la cual inicia la busqueda. Se actualiza con la
+ * unidad siguiente a la region tomada.
+ * @param count Numero de unidades
+ * @return Primera unidad tomada, BITMAP_NO_UNIT si no se encontraron.
+ @verbatim
+  No modifica free_units: el llamador ya debe haber descontado las unidades.
+ @endverbatim*/
+unsigned int bitmap_claim(bitmap_allocator_t * a,
+		volatile unsigned int * cursor, unsigned int count);
+
+/**
+ * @brief Marca una unidad como libre e incrementa free_units.
+ * @param a Asignador
+ * @param unit Unidad a liberar
+ * @return 1 si la unidad se libero, 0 si ya se encontraba libre.
+ */
+int bitmap_release(bitmap_allocator_t * a, unsigned int unit);
+
+/**
+ * @brief Busca la primera entrada diferente de 0 (con al menos una unidad
+ * libre) de un mapa de bits.
+ * @param bitmap Mapa de bits
+ * @param entry Primera entrada a revisar
+ * @param end Entrada siguiente a la ultima a revisar
+ * @return Indice de la entrada, end si todas las entradas son 0.
+ */
+unsigned int bitmap_find_entry(const unsigned int * bitmap,
+		unsigned int entry, unsigned int end);
+
+/**
+ * @brief Cuenta los bits en 1 de un mapa de bits.
+ * @param bitmap Mapa de bits
+ * @param entries Numero de entradas
+ * @return Numero de bits en 1
+ */
+unsigned int bitmap_count(const unsigned int * bitmap, unsigned int entries);
+
+/**
+ * @brief Cuenta las unidades libres de un asignador recorriendo su mapa de
+ * bits (para estadisticas: free_units es el valor que usan las
+ * asignaciones).
+ * @param a Asignador
+ * @return Numero de unidades libres
+ */
+unsigned int bitmap_count_free(bitmap_allocator_t * a);
+
+/**
+ * @brief Mide el tiempo de bitmap_find_entry() y bitmap_count(), con y sin
+ * registros XMM, sobre un mapa de bits temporal.
+ * @param entries Numero de entradas del mapa de bits
+ */
+void bitmap_benchmark(unsigned int entries);
+
+#endif /* BITMAP_H_ */
@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de la fuente de tiempo del kernel.
+ * @details
+ * El canal 0 del PIT (8253/8254) se programa con una frecuencia conocida, y
+ * se usa al arranque para medir la frecuencia del TSC. A partir de ese
+ * momento el tiempo se obtiene solo del TSC, que se lee con una instruccion
+ * (rdtsc) en lugar de varias operaciones de E/S.
+ *
+ * La conversion de ciclos a nanosegundos se realiza con una multiplicacion
+ * y un desplazamiento: ns = (ciclos * clock_mult) >> CLOCK_SHIFT, donde
+ * clock_mult = (10^6 << CLOCK_SHIFT) / frecuencia en kHz.
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <asm.h>
+
+/** @brief Frecuencia de entrada del PIT en Hz */
+#define PIT_FREQUENCY 1193182
+
+/** @brief Puerto de datos del canal 0 del PIT (conectado a la IRQ0) */
+#define PIT_CHANNEL0 0x40
+
+/** @brief Puerto de comandos del PIT */
+#define PIT_COMMAND 0x43
+
+/** @brief Comando: canal 0, byte bajo y luego byte alto, modo 2 (rate
+ * generator), binario */
+#define PIT_CHANNEL0_RATE 0x34
+
+/** @brief Comando: canal 0, byte bajo y luego byte alto, modo 0
+ * (interrupt on terminal count): una sola IRQ0 al llegar a 0 */
+#define PIT_CHANNEL0_ONESHOT 0x30
+
+/** @brief Comando: capturar (latch) el contador del canal 0 */
+#define PIT_CHANNEL0_LATCH 0x00
+
+/** @brief Frecuencia de la IRQ0 en Hz */
+#define PIT_HZ 1000
+
+/** @brief Valor de recarga del canal 0 */
+#define PIT_RELOAD ((PIT_FREQUENCY + PIT_HZ / 2) / PIT_HZ)
+
+/** @brief Duracion de la calibracion del TSC, en pulsos del PIT (10 ms) */
+#define CLOCK_CALIBRATION_TICKS (PIT_FREQUENCY / 100)
+
+/** @brief Desplazamiento de la conversion de ciclos a nanosegundos */
+#define CLOCK_SHIFT 22
+
+/** @brief Frecuencia del TSC en kHz (0 si no se ha calibrado) */
+extern unsigned int tsc_khz;
+
+/** @brief Factor de la conversion de ciclos a nanosegundos */
+extern unsigned int clock_mult;
+
+/** @brief Valor del TSC al calibrarlo (instante 0 de clock_ns()) */
+extern unsigned long long clock_start;
+
+/**
+ * @brief Programa el canal 0 del PIT y calibra el TSC.
+ * @return 0 si el TSC se calibro, -1 en caso contrario.
+ */
+int setup_clock(void);
+
+/**
+ * @brief Permite obtener el numero de ciclos del TSC desde la calibracion.
+ * @return Ciclos transcurridos
+ */
+static __inline__ unsigned long long cycles(void) {
+	return rdtsc() - clock_start;
+}
+
+/**
+ * @brief Convierte un numero de ciclos del TSC a nanosegundos.
+ * @param c Ciclos
+ * @return Nanosegundos
+ */
+static __inline__ unsigned long long cycles_to_ns(unsigned long long c) {
+	return (((unsigned long long)(unsigned int)(c >> 32) * clock_mult)
+			<< (32 - CLOCK_SHIFT)) +
+			(((unsigned long long)(unsigned int)c * clock_mult) >> CLOCK_SHIFT);
+}
+
+/**
+ * @brief Permite obtener el tiempo transcurrido desde la calibracion.
+ * @return Nanosegundos transcurridos
+ */
+static __inline__ unsigned long long clock_ns(void) {
+	return cycles_to_ns(cycles());
+}
+
+/**
+ * @brief Espera activamente el numero de microsegundos especificado.
+ * @param us Microsegundos
+ */
+void udelay(unsigned int us);
+
+#endif /* CLOCK_H_ */
@@ -27,4 +27,20 @@ typedef interrupt_handler exception_handler;
  */
 void setup_exceptions(void);
 
+/**
+ * @brief Esta rutina permite definir un nuevo manejador de excepcion
+ * para una de las excepciones de los procesadores x86.
+ * @param index Numero de la excepcion
+ * @param handler Funcion de manejo de la excepcion
+ * @return index si el manejador se instalo, -1 si la excepcion ya tenia un
+ * manejador.
+ */
+int install_exception_handler(unsigned char index, exception_handler handler);
+
+/**
+ * @brief Esta rutina permite quitar un manejador de excepcion
+ * @param index Numero de la excepcion
+ */
+void uninstall_exception_handler(unsigned char index);
+
 #endif /* EXCEPTION_H_ */
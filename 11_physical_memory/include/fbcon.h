@@ -0,0 +1,100 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de la consola sobre el framebuffer lineal
+ * (VBE).
+ * @details
+ * El encabezado multiboot (start.S) solicita un modo grafico lineal. Si el
+ * cargador lo establece, flush_screen() (stdio.c) deja de copiar la copia
+ * de la pantalla (screen_cells) a la memoria de video de modo texto, y en
+ * su lugar invoca fb_render() con el rango de columnas modificadas de cada
+ * linea. fb_render() recorre las filas de pixeles de la linea, y en cada
+ * fila escribe los glifos del rango en forma secuencial, que es el patron
+ * que aprovecha la memoria write-combining (ver PAGE_WRITE_COMBINING en
+ * paging.h).
+ *
+ * flush_screen() se invoca una sola vez al final de puts() y de printf(),
+ * por lo cual varias lineas (y varios desplazamientos de pantalla) se
+ * dibujan juntas. Cada desplazamiento obliga a dibujar toda la pantalla,
+ * por lo cual console_write() solo dibuja un desplazamiento pendiente si
+ * han pasado FB_REDRAW_INTERVAL_NS desde el ultimo: los desplazamientos de
+ * ese intervalo se dibujan juntos. El ciclo de espera del kernel y
+ * log_dump() invocan flush_screen() para dibujar el ultimo.
+ */
+
+#ifndef FBCON_H_
+#define FBCON_H_
+
+/** @brief Ancho en pixeles de un caracter */
+#define FB_FONT_WIDTH 8
+
+/** @brief Alto en pixeles de un caracter. Cada fila del tipo de letra de
+ * 8x8 se dibuja dos veces. */
+#define FB_FONT_HEIGHT 16
+
+/** @brief Tiempo minimo en ns entre dos redibujos completos de la pantalla
+ * por desplazamiento (10 pulsos del PIT) */
+#define FB_REDRAW_INTERVAL_NS 10000000ULL
+
+/** @brief Primer caracter del tipo de letra */
+#define FONT_FIRST_CHAR 0x20
+
+/** @brief Ultimo caracter del tipo de letra */
+#define FONT_LAST_CHAR 0x7E
+
+/** @brief Estructura de datos que describe el framebuffer lineal */
+typedef struct framebuffer {
+	/** @brief Direccion fisica del framebuffer */
+	unsigned int address;
+	/** @brief Tamano en bytes (pitch * height) */
+	unsigned int size;
+	/** @brief Bytes por linea de pixeles */
+	unsigned int pitch;
+	/** @brief Ancho en pixeles */
+	unsigned int width;
+	/** @brief Alto en pixeles */
+	unsigned int height;
+	/** @brief Bytes por pixel (2, 3 o 4) */
+	unsigned int bytes_per_pixel;
+	/** @brief Numero de columnas de texto */
+	int columns;
+	/** @brief Numero de lineas de texto */
+	int lines;
+} framebuffer_t;
+
+/** @brief Framebuffer de la consola */
+extern framebuffer_t framebuffer;
+
+/** @brief 1 si la consola escribe en el framebuffer */
+extern int fb_console_active;
+
+/** @brief Tipo de letra de 8x8 para los caracteres FONT_FIRST_CHAR a
+ * FONT_LAST_CHAR. El bit 0 de cada byte es el pixel de la izquierda. */
+extern const unsigned char font8x8[][8];
+
+/**
+ * @brief Busca la informacion del modo grafico en la estructura multiboot
+ * y, si el modo es soportado, pasa la consola al framebuffer. Luego se debe
+ * invocar cls().
+ * @return 0 si la consola usa el framebuffer, -1 si sigue en modo texto.
+ */
+int setup_fb_console(void);
+
+/**
+ * @brief Mueve el cursor de la consola grafica.
+ * @param line Linea
+ * @param column Columna
+ */
+void fb_set_cursor(int line, int column);
+
+/**
+ * @brief Dibuja un rango de celdas de screen_cells en el framebuffer.
+ * @param line Linea
+ * @param first Primera columna
+ * @param last Ultima columna
+ */
+void fb_render(int line, int first, int last);
+
+#endif /* FBCON_H_ */
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones para habilitar SSE y usar los registros
+ * XMM desde el kernel.
+ * @details
+ * Las rutinas de servicio de interrupcion (isr.S) no guardan el estado de
+ * la FPU ni de los registros XMM, dado que la mayoria de manejadores no los
+ * usan. Una rutina que usa los registros XMM debe encerrar ese codigo entre
+ * fpu_begin() y fpu_end():
+ * @verbatim
+  if (fpu_begin()) {
+     ... codigo que usa xmm0 - xmm7 ...
+     fpu_end();
+  }else {
+     ... implementacion sin registros XMM ...
+  }
+ @endverbatim
+ * Si fpu_begin() interrumpio a otra rutina que estaba usando los registros
+ * XMM, guarda su estado con FXSAVE en un area del bloque de datos del
+ * procesador (ver percpu.h), y fpu_end() lo restaura con FXRSTOR. De esta
+ * forma el costo de guardar el estado solo lo pagan las interrupciones que
+ * usan los registros XMM, y solo cuando interrumpen a otro usuario.
+ */
+
+#ifndef FPU_H_
+#define FPU_H_
+
+/** @brief Bit MP (Monitor Coprocessor) de CR0 */
+#define CR0_MP 0x00000002
+
+/** @brief Bit EM (Emulation) de CR0: si se encuentra en 1, las
+ * instrucciones de la FPU y SSE generan la excepcion \#UD / \#NM */
+#define CR0_EM 0x00000004
+
+/** @brief Bit TS (Task Switched) de CR0 */
+#define CR0_TS 0x00000008
+
+/** @brief Valor de MXCSR luego de un reset: todas las excepciones SIMD
+ * enmascaradas */
+#define MXCSR_DEFAULT 0x1F80
+
+/** @brief Atributo de las rutinas que usan los registros XMM en ensamblador
+ * en linea. Sin el, el compilador (que genera codigo sin SSE) no acepta los
+ * registros XMM en la lista de registros modificados. Estas rutinas solo se
+ * deben invocar entre fpu_begin() y fpu_end(). */
+#define __xmm __attribute__((target("sse2")))
+
+/** @brief Vale 1 si setup_fpu() habilito SSE. Todos los procesadores
+ * deben soportarlo, dado que son del mismo modelo. */
+extern int fpu_enabled;
+
+/**
+ * @brief Habilita la FPU y SSE en el procesador actual. Se debe invocar en
+ * cada procesador, antes de usar fpu_begin().
+ * @return 0 si SSE quedo habilitado, -1 si el procesador no lo soporta.
+ */
+int setup_fpu(void);
+
+/**
+ * @brief Inicia una seccion de codigo que usa los registros XMM.
+ * @return 1 si la seccion puede usar los registros XMM, 0 si no (SSE no se
+ * encuentra habilitado, o se agotaron las areas de FXSAVE del procesador).
+ * Solo si retorna 1 se debe invocar fpu_end().
+ */
+int fpu_begin(void);
+
+/**
+ * @brief Termina una seccion iniciada por fpu_begin().
+ */
+void fpu_end(void);
+
+#endif /* FPU_H_ */
@@ -20,6 +20,20 @@
  * ser 1. */
 #define IF_ENABLE 0x202
 
+/** @brief Desplazamiento del campo number dentro de interrupt_state */
+#define INTERRUPT_STATE_NUMBER 48
+
+/** @brief Vector que usa interrupt_benchmark() para medir la ruta de
+ * entrada de isr.S */
+#define INTERRUPT_BENCHMARK_VECTOR 0x80
+
+/** @brief Vector que usa interrupt_benchmark() para medir la ruta de
+ * referencia isr_reference */
+#define INTERRUPT_REFERENCE_VECTOR 0x81
+
+/* Dado que este archivo puede ser incluido desde codigo en Assembler, incluir
+ * solo las constantes definidas anteriormente. */
+#ifndef ASM
 
 /** @brief Definicin de la estructura de datos para un descriptor de
  * interrupcin */
@@ -156,4 +170,36 @@ static __inline__ idt_descriptor idt_descriptor_32(unsigned int selector,
  * */
 void setup_idt(void);
 
+/**
+ * @brief Instala un manejador para un vector de la IDT.
+ * @param index Vector de interrupcion
+ * @param handler Rutina de manejo de la interrupcion
+ */
+void install_interrupt_handler(unsigned char index, interrupt_handler handler);
+
+/**
+ * @brief Desinstala el manejador de un vector de la IDT.
+ * @param index Vector de interrupcion
+ */
+void uninstall_interrupt_handler(unsigned char index);
+
+/**
+ * @brief Rutina que recibe el control de isr.S cuando un vector no tiene
+ * manejador instalado, y de la ruta de referencia isr_reference.
+ * @param state Estado del procesador
+ */
+void interrupt_dispatcher(interrupt_state * state);
+
+/**
+ * @brief Mide los ciclos desde la instruccion int hasta el manejador, y desde
+ * el manejador hasta el retorno de iret, en la ruta de entrada de isr.S y en
+ * la ruta de referencia isr_reference (que guarda y recarga todos los
+ * registros de segmento y pasa por interrupt_dispatcher()).
+ * @param iterations Numero de interrupciones de cada ruta. Se reporta el
+ * minimo.
+ */
+void interrupt_benchmark(unsigned int iterations);
+
+#endif
+
 #endif /* IDT_H_ */
@@ -0,0 +1,30 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de la seccion .init del kernel.
+ * @details
+ * Las rutinas y los datos que solo se usan durante el arranque del kernel
+ * se ubican en la seccion .init (ver link.ld). Una vez el kernel termina su
+ * inicializacion, free_boot_memory() (physmem.h) devuelve las unidades de
+ * esta seccion al mapa de bits de memoria, por lo cual no se puede invocar
+ * ninguna rutina marcada con __init despues de ese punto.
+ */
+
+#ifndef INIT_H_
+#define INIT_H_
+
+/** @brief Ubica una rutina en la seccion .init */
+#define __init __attribute__((section(".init.text")))
+
+/** @brief Ubica una variable en la seccion .init */
+#define __initdata __attribute__((section(".init.data")))
+
+/** @brief Inicio de la seccion .init, definido en link.ld */
+extern char init_start[];
+
+/** @brief Fin de la seccion .init (alineado a 4 KB), definido en link.ld */
+extern char init_end[];
+
+#endif /* INIT_H_ */
@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones del initrd: los modulos cargados por GRUB
+ * se exponen como archivos de solo lectura.
+ * @details
+ * Cada modulo especificado en menu.lst con la instruccion 'module' se
+ * convierte en un archivo cuyo nombre es el nombre (sin directorios) de la
+ * primera palabra de su linea de comandos. Por ejemplo:
+ * @verbatim
+   module /boot/config.txt      -> archivo "config.txt"
+   module /boot/initrd.img      -> archivo por cada entrada del archivo
+ @endverbatim
+ *
+ * Si un modulo inicia con el numero magico INITRD_MAGIC, se interpreta como
+ * un archivo empaquetado con el siguiente formato (todos los campos de 32
+ * bits en little endian):
+ * @verbatim
+   +---------------------------+  0
+   | initrd_header_t           |  magic = INITRD_MAGIC, count = N
+   +---------------------------+  8
+   | initrd_entry_t [0]        |  nombre, desplazamiento, tamano
+   | ...                       |
+   | initrd_entry_t [N - 1]    |
+   +---------------------------+
+   | datos de los archivos     |  desplazamientos relativos al inicio
+   +---------------------------+  del modulo
+ @endverbatim
+ *
+ * Los archivos no se copian: su apuntador de datos apunta a la memoria en
+ * la cual GRUB cargo el modulo, que permanece marcada como ocupada en el
+ * mapa de bits (ver free_boot_modules()).
+ */
+
+#ifndef INITRD_H_
+#define INITRD_H_
+
+/** @brief Numero magico de un archivo empaquetado ("INRD") */
+#define INITRD_MAGIC 0x44524E49
+
+/** @brief Tamano maximo del nombre de un archivo, incluyendo el nulo */
+#define INITRD_NAME_LENGTH 56
+
+/** @brief Numero maximo de archivos del initrd */
+#define MAX_INITRD_FILES 64
+
+/** @brief Encabezado de un archivo empaquetado */
+typedef struct initrd_header {
+	/** @brief Numero magico (INITRD_MAGIC) */
+	unsigned int magic;
+	/** @brief Numero de entradas que siguen al encabezado */
+	unsigned int count;
+} __attribute__((packed)) initrd_header_t;
+
+/** @brief Entrada de un archivo empaquetado (64 bytes) */
+typedef struct initrd_entry {
+	/** @brief Nombre del archivo, terminado en nulo */
+	char name[INITRD_NAME_LENGTH];
+	/** @brief Desplazamiento de los datos desde el inicio del modulo */
+	unsigned int offset;
+	/** @brief Tamano del archivo en bytes */
+	unsigned int size;
+} __attribute__((packed)) initrd_entry_t;
+
+/** @brief Estructura de datos de un archivo del initrd */
+typedef struct initrd_file {
+	/** @brief Nombre del archivo. Se copia de GRUB o del archivo
+	 * empaquetado, dado que las cadenas de GRUB se liberan con
+	 * free_boot_memory(). */
+	char name[INITRD_NAME_LENGTH];
+	/** @brief Datos del archivo, dentro de la memoria del modulo */
+	const char * data;
+	/** @brief Tamano del archivo en bytes */
+	unsigned int size;
+} initrd_file_t;
+
+/** @brief Archivos del initrd */
+extern initrd_file_t initrd_files[];
+
+/** @brief Numero de archivos en initrd_files */
+extern int initrd_file_count;
+
+/**
+ * @brief Construye la tabla de archivos a partir de los modulos cargados por
+ * GRUB.
+ * @return Numero de archivos encontrados.
+ @verbatim
+  Se debe invocar luego de setup_memory() y antes de free_boot_memory(),
+  mientras la estructura de informacion multiboot sigue disponible.
+ @endverbatim*/
+int setup_initrd(void);
+
+/**
+ * @brief Busca un archivo del initrd por su nombre.
+ * @param name Nombre del archivo
+ * @return Apuntador al archivo, 0 si no existe.
+ */
+initrd_file_t * initrd_find(char * name);
+
+#endif /* INITRD_H_ */
@@ -11,6 +11,8 @@
 #ifndef IRQ_H_
 #define IRQ_H_
 
+#include <percpu.h>
+
 /** @brief OCW2 (End of Interrupt): Codigo para escribir en el puerto de comandos
  * del PIC para indicar que se ha recibido la interrupcin.
  */
@@ -28,16 +30,19 @@
 /** @brief Direccin del puerto de datos del PIC esclavo */
 #define SLAVE_PIC_DATA_PORT 0xA1
 
+/** @brief OCW3: Codigo para que la siguiente lectura del puerto de comandos
+ * retorne el ISR (In-Service Register) del PIC */
+#define PIC_READ_ISR 0x0B
+
+/** @brief Linea del PIC maestro a la cual se conecta el PIC esclavo */
+#define PIC_CASCADE_IRQ 2
+
 /** @brief Desplazamiento en la IDT a partir de la cual se configuran las
  * rutinas de manejo de interrupcin. En IA-32, este debe ser mayor o igual a 32
  * debido a que las primeras 32 interrupciones son usadas por las
  * excepciones. */
 #define IDT_IRQ_OFFSET 32
 
-
-/** @brief Alias para el manejador de irq. */
-typedef interrupt_handler irq_handler;
-
 /* Constantes para los numeros de interrupcion de las IRQ0 - IRQ15.*/
 
 /** @brief IRQ del Timer del Sistema. */
@@ -78,8 +83,30 @@ typedef interrupt_handler irq_handler;
 #define IRQ15_INTERRUPT IDT_IRQ_OFFSET + 15
 
 /** @brief Define el nmero mximo de rutinas de manejo de IRQ
- * que se pueden definir en el sistema.*/
-#define MAX_IRQ_ROUTINES 16
+ * que se pueden definir en el sistema. Los PIC solo entregan las IRQ 0..15;
+ * las IRQ 16.. solo se entregan por medio del I/O APIC (ver apic.h).*/
+#define MAX_IRQ_ROUTINES 64
+
+/* Dado que este archivo puede ser incluido desde codigo en Assembler, incluir
+ * solo las constantes definidas anteriormente. */
+#ifndef ASM
+
+/** @brief Alias para el manejador de irq. */
+typedef interrupt_handler irq_handler;
+
+/**
+ * @brief Permite saber si el codigo actual se ejecuta dentro de un manejador
+ * de IRQ instalado con install_irq_handler().
+ * @return 1 si se encuentra dentro de un manejador de IRQ, 0 en caso contrario
+ */
+static __inline__ int in_interrupt(void) {
+	/* El contador es propio de cada procesador (ver percpu.h) */
+	return (this_cpu_read(irq_nesting) > 0);
+}
+
+/** @brief Numero de IRQ espurias (IRQ7 / IRQ15 sin el bit del ISR) que se
+ * descartaron */
+extern volatile int spurious_irqs;
 
 /**
  * @brief Esta rutina se encarga de crear las entradas en la IDT para
@@ -103,4 +130,38 @@ void install_irq_handler(int number, irq_handler handler);
  * 	@return void*/
 void uninstall_irq_handler(int number);
 
+/**
+ * @brief Deshabilita una IRQ sin acceder al hardware. Si la IRQ ocurre
+ * mientras esta deshabilitada, irq_dispatcher() enmascara la linea y la
+ * marca como pendiente, sin invocar el manejador.
+ * @param number Numero de IRQ
+ */
+void irq_disable(int number);
+
+/**
+ * @brief Habilita una IRQ deshabilitada con irq_disable(). Si la IRQ
+ * ocurrio mientras estaba deshabilitada, se habilita la linea y se invoca el
+ * manejador con un estado construido en irq_enable(): number, los
+ * selectores de segmento, old_cs, old_eip (retorno de irq_enable()) y
+ * old_eflags son validos, los registros de proposito general valen 0.
+ * @param number Numero de IRQ
+ */
+void irq_enable(int number);
+
+/**
+ * @brief Enmascara todas las lineas de los PIC (cuando las IRQ se entregan
+ * por medio del I/O APIC).
+ */
+void pic_disable(void);
+
+/**
+ * @brief Rutina que recibe el control de los vectores de IRQ sin manejador,
+ * deshabilitadas con irq_disable() o que pueden ser espurias (IRQ 7 y 15).
+ * Los demas vectores de IRQ invocan directamente su manejador.
+ * @param state Apuntador al estado del procesador cuando ocurre la IRQ
+ */
+void irq_dispatcher(interrupt_state * state);
+
+#endif
+
 #endif /* IRQ_H_ */
@@ -0,0 +1,76 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones del registro de mensajes del kernel.
+ * @details
+ * klog() almacena el mensaje en un buffer circular de registros, con un
+ * numero de secuencia y una marca de tiempo, sin escribir en la pantalla ni
+ * en los puertos. Por esta razon se puede invocar desde los manejadores de
+ * interrupcion y desde el asignador de memoria sin bloquearlos.
+ *
+ * log_flush() copia los registros pendientes a las salidas de la consola
+ * (ver console_sinks en stdio.h), a lo sumo un numero fijo de registros por
+ * invocacion. El kernel la invoca desde su ciclo de espera. Si el kernel se
+ * detiene por una excepcion, log_dump() escribe los registros pendientes.
+ *
+ * Si los productores dan una vuelta completa al buffer antes de que los
+ * registros se copien, los registros mas antiguos se pierden y log_flush()
+ * informa cuantos.
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdarg.h>
+
+/** @brief Numero de registros del buffer circular (potencia de 2) */
+#define LOG_RECORDS 256
+
+/** @brief Tamano maximo de un mensaje, incluyendo el nulo. Los mensajes
+ * mas largos se truncan. */
+#define LOG_TEXT_SIZE 112
+
+/** @brief Numero maximo de registros que copia cada invocacion de
+ * log_flush() desde el ciclo de espera */
+#define LOG_FLUSH_BATCH 8
+
+/** @brief Registro del buffer circular (128 bytes) */
+typedef struct log_record {
+	/** @brief Numero de secuencia del mensaje mas 1. Vale 0 mientras el
+	 * productor escribe el mensaje. */
+	volatile unsigned int seq;
+	/** @brief Indice del procesador que produjo el mensaje */
+	unsigned int cpu;
+	/** @brief Ciclos del TSC desde la calibracion al producir el mensaje
+	 * (ver cycles()) */
+	unsigned long long timestamp;
+	/** @brief Mensaje */
+	char text[LOG_TEXT_SIZE];
+} log_record_t;
+
+/**
+ * @brief Almacena un mensaje con formato en el registro del kernel.
+ * log_flush() escribe cada registro en una linea: el salto de linea al
+ * final del formato es opcional.
+ * @param format Formato del mensaje (ver vsnprintf())
+ * @param ... Argumentos
+ */
+void klog(char * format, ...);
+
+/**
+ * @brief Copia a la consola los registros pendientes.
+ * @param max Numero maximo de registros a copiar
+ * @return Numero de registros copiados
+ */
+int log_flush(int max);
+
+/**
+ * @brief Copia a la consola todos los registros pendientes, aunque otro
+ * procesador este copiandolos, y dibuja la pantalla aunque console_write()
+ * haya aplazado un desplazamiento. Se usa antes de detener el sistema.
+ */
+void log_dump(void);
+
+#endif /* LOG_H_ */
@@ -29,10 +29,28 @@
 #define MULTIBOOT_HEADER_MAGIC 0x1BADB002
 /** @brief Constante que incluye las flags que se pasarn a GRUB */
 #define MULTIBOOT_HEADER_FLAGS MULTIBOOT_PAGE_ALIGN | MULTIBOOT_MEMORY_INFO | \
-							   MULTIBOOT_AOUT_KLUDGE
+							   MULTIBOOT_VIDEO_INFO | MULTIBOOT_AOUT_KLUDGE
 /** @brief Constante de suma de chequeo*/
 #define MULTIBOOT_CHECKSUM -(MULTIBOOT_HEADER_MAGIC + MULTIBOOT_HEADER_FLAGS)
 
+/** @brief Tipo de modo de video solicitado: 0 = modo grafico lineal */
+#define MULTIBOOT_VIDEO_MODE_TYPE 0
+/** @brief Ancho en pixeles del modo de video solicitado */
+#define MULTIBOOT_VIDEO_WIDTH 1024
+/** @brief Alto en pixeles del modo de video solicitado */
+#define MULTIBOOT_VIDEO_HEIGHT 768
+/** @brief Bits por pixel del modo de video solicitado */
+#define MULTIBOOT_VIDEO_DEPTH 32
+
+/** @brief Bit de flags de la estructura de informacion que indica que los
+ * campos vbe_* son validos */
+#define MULTIBOOT_INFO_VBE 11
+/** @brief Bit de flags de la estructura de informacion que indica que los
+ * campos framebuffer_* son validos */
+#define MULTIBOOT_INFO_FRAMEBUFFER 12
+/** @brief Valor de framebuffer_type para un framebuffer RGB */
+#define MULTIBOOT_FRAMEBUFFER_RGB 1
+
 /** @brief Nmero mgico que el cargador de arranque almacena en el registro
  * EAX para indicar que es compatible con la especificacin Multiboot */
 #define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
@@ -61,6 +79,14 @@ typedef struct multiboot_header_struct {
 	unsigned int bss_end;
 	/** @brief Direccin en la cual se debe pasar el control al kernel */
 	unsigned int entry_point;
+	/** @brief Tipo de modo de video preferido (0 = grafico lineal) */
+	unsigned int mode_type;
+	/** @brief Ancho preferido (pixeles) */
+	unsigned int width;
+	/** @brief Alto preferido (pixeles) */
+	unsigned int height;
+	/** @brief Bits por pixel preferidos */
+	unsigned int depth;
 } multiboot_header_t;
 
 /** @brief Tabla de smbolos usadas en el formato a.out*/
@@ -179,8 +205,8 @@ typedef struct {
 	 */
 	unsigned int vbe_mode_info;
 
-	/** @brief Presente si flags[11] = 1. */
-	unsigned int vbe_mode;
+	/** @brief Presente si flags[11] = 1. Numero del modo VBE actual */
+	unsigned short vbe_mode;
 
 	/** @brief Presente si flags[11] = 1. */
 	unsigned short vbe_interface_seg;
@@ -189,7 +215,80 @@ typedef struct {
 	/** @brief Presente si flags[11] = 1. */
 	unsigned short vbe_interface_len;
 
-}multiboot_info_t;
+	/** @brief Presente si flags[12] = 1. Direccion fisica del framebuffer
+	 * (32 bits menos significativos) */
+	unsigned int framebuffer_addr_low;
+	/** @brief Presente si flags[12] = 1. 32 bits mas significativos de la
+	 * direccion del framebuffer */
+	unsigned int framebuffer_addr_high;
+	/** @brief Presente si flags[12] = 1. Bytes por linea de pixeles */
+	unsigned int framebuffer_pitch;
+	/** @brief Presente si flags[12] = 1. Ancho en pixeles */
+	unsigned int framebuffer_width;
+	/** @brief Presente si flags[12] = 1. Alto en pixeles */
+	unsigned int framebuffer_height;
+	/** @brief Presente si flags[12] = 1. Bits por pixel */
+	unsigned char framebuffer_bpp;
+	/** @brief Presente si flags[12] = 1. 0 = paleta, 1 = RGB, 2 = texto */
+	unsigned char framebuffer_type;
+	/** @brief Presente si flags[12] = 1 y framebuffer_type = 1. Posicion y
+	 * tamano de los campos rojo, verde y azul de un pixel. */
+	unsigned char framebuffer_red_field_position;
+	/** @brief Ver framebuffer_red_field_position */
+	unsigned char framebuffer_red_mask_size;
+	/** @brief Ver framebuffer_red_field_position */
+	unsigned char framebuffer_green_field_position;
+	/** @brief Ver framebuffer_red_field_position */
+	unsigned char framebuffer_green_mask_size;
+	/** @brief Ver framebuffer_red_field_position */
+	unsigned char framebuffer_blue_field_position;
+	/** @brief Ver framebuffer_red_field_position */
+	unsigned char framebuffer_blue_mask_size;
+} __attribute__((packed)) multiboot_info_t;
+
+/** @brief Bloque de informacion de un modo VBE (funcion 0x4F01), al cual
+ * apunta vbe_mode_info. Solo se incluyen los campos usados por el kernel. */
+typedef struct vbe_mode_info {
+	/** @brief Atributos del modo. El bit 7 indica que el modo tiene un
+	 * framebuffer lineal. */
+	unsigned short mode_attributes;
+	/** @brief Campos de las ventanas (modo real), no usados */
+	unsigned char window_fields[14];
+	/** @brief Bytes por linea de pixeles */
+	unsigned short bytes_per_scan_line;
+	/** @brief Ancho en pixeles */
+	unsigned short x_resolution;
+	/** @brief Alto en pixeles */
+	unsigned short y_resolution;
+	/** @brief Ancho y alto de un caracter, no usados */
+	unsigned char char_size[2];
+	/** @brief Numero de planos */
+	unsigned char planes;
+	/** @brief Bits por pixel */
+	unsigned char bits_per_pixel;
+	/** @brief Numero de bancos */
+	unsigned char banks;
+	/** @brief Modelo de memoria (6 = color directo) */
+	unsigned char memory_model;
+	/** @brief Tamano de un banco, paginas de imagen y campo reservado */
+	unsigned char bank_fields[3];
+	/** @brief Tamano del campo rojo de un pixel */
+	unsigned char red_mask_size;
+	/** @brief Posicion del campo rojo de un pixel */
+	unsigned char red_field_position;
+	/** @brief Tamano del campo verde de un pixel */
+	unsigned char green_mask_size;
+	/** @brief Posicion del campo verde de un pixel */
+	unsigned char green_field_position;
+	/** @brief Tamano del campo azul de un pixel */
+	unsigned char blue_mask_size;
+	/** @brief Posicion del campo azul de un pixel */
+	unsigned char blue_field_position;
+	/** @brief Campos reservados y de color directo, no usados */
+	unsigned char direct_color_fields[3];
+	/** @brief Direccion fisica del framebuffer lineal */
+	unsigned int phys_base;
+} __attribute__((packed)) vbe_mode_info_t;
 
 #endif
 
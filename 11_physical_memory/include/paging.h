@@ -0,0 +1,186 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de la paginacion del kernel (paginas de
+ * 4 KB, dos niveles).
+ * @details
+ * El kernel usa las direcciones fisicas como apuntadores, por lo cual toda
+ * la memoria que gestiona memory_allocator se mapea en la misma direccion
+ * lineal (identity mapping). Si el procesador soporta PSE, este mapeo se
+ * realiza con paginas de 4 MB.
+ *
+ * Por encima de la memoria mapeada se pueden reservar rangos de direcciones
+ * lineales que no tienen marcos asignados (rangos "lazy"). El primer acceso
+ * a una pagina de un rango genera un fallo de pagina (excepcion 14); el
+ * manejador asigna una unidad con allocate_unit(), la llena de ceros y la
+ * mapea. Asi, la memoria fisica que consume un rango es la que realmente se
+ * ha tocado.
+ *
+ * Las rutinas de servicio de interrupcion no soportan anidamiento (ver
+ * isr.S), por lo cual un manejador de IRQ no debe tocar un rango lazy.
+ */
+
+#ifndef PAGING_H_
+#define PAGING_H_
+
+/** @brief Tamano de una pagina */
+#define PAGE_SIZE 4096
+
+/** @brief Tamano de una pagina grande (PSE) */
+#define LARGE_PAGE_SIZE 0x400000
+
+/** @brief Numero de entradas de un directorio o una tabla de paginas */
+#define PAGE_ENTRIES 1024
+
+/** @brief Bit Present de una entrada */
+#define PAGE_PRESENT 0x001
+
+/** @brief Bit Read/Write de una entrada (1 = escritura permitida) */
+#define PAGE_WRITE 0x002
+
+/** @brief Bit User/Supervisor de una entrada */
+#define PAGE_USER 0x004
+
+/** @brief Bit Page Write-Through de una entrada */
+#define PAGE_PWT 0x008
+
+/** @brief Bit Page Cache Disable de una entrada */
+#define PAGE_PCD 0x010
+
+/** @brief Tipo de memoria write-combining para una pagina. Las escrituras
+ * se acumulan en los buffers de write-combining del procesador y se envian
+ * en rafagas, lo cual es adecuado para un framebuffer.
+ @verbatim
+  Con PWT = 1 y PCD = 0 la entrada selecciona la entrada 1 de la PAT, que
+  setup_paging() programa como write-combining si el procesador soporta PAT
+  (en caso contrario la pagina queda write-through).
+ @endverbatim*/
+#define PAGE_WRITE_COMBINING PAGE_PWT
+
+/** @brief Bit Page Size de una entrada del directorio (pagina de 4 MB) */
+#define PAGE_LARGE 0x080
+
+/** @brief Mascara de la direccion fisica de una entrada */
+#define PAGE_FRAME_MASK 0xFFFFF000
+
+/** @brief Bit PG (Paging) de CR0 */
+#define CR0_PG 0x80000000
+
+/** @brief Bit WP (Write Protect) de CR0 */
+#define CR0_WP 0x00010000
+
+/** @brief Bit PSE (Page Size Extension) de CR4 */
+#define CR4_PSE 0x00000010
+
+/** @brief MSR de la Page Attribute Table */
+#define IA32_PAT_MSR 0x277
+
+/** @brief 32 bits menos significativos de la PAT: PA0 = write-back,
+ * PA1 = write-combining, PA2 = uncached-, PA3 = uncached */
+#define PAT_LOW 0x00070106
+
+/** @brief 32 bits mas significativos de la PAT (PA4 - PA7), iguales a los
+ * valores por defecto: write-back, write-through, uncached-, uncached */
+#define PAT_HIGH 0x00070406
+
+/** @brief Excepcion de fallo de pagina */
+#define PAGE_FAULT_EXCEPTION 14
+
+/** @brief Bit del codigo de error de un fallo de pagina: 1 = la pagina
+ * estaba presente (violacion de proteccion) */
+#define PAGE_FAULT_PRESENT 0x1
+
+/** @brief Fin de las direcciones lineales en las cuales se pueden reservar
+ * rangos lazy. Por encima se encuentran el I/O APIC y el APIC local. */
+#define LAZY_WINDOW_END 0xFEC00000
+
+/** @brief Numero maximo de rangos de direcciones lineales */
+#define MAX_VM_RANGES 32
+
+/** @brief Tipo de rango: memoria mapeada en su misma direccion fisica */
+#define VM_RANGE_IDENTITY 1
+
+/** @brief Tipo de rango: memoria asignada en el primer acceso */
+#define VM_RANGE_LAZY 2
+
+/** @brief Estructura de datos para un rango de direcciones lineales por
+ * encima de la memoria mapeada al arranque */
+typedef struct vm_range {
+	/** @brief Direccion de inicio (alineada a PAGE_SIZE) */
+	unsigned int start;
+	/** @brief Direccion final (no incluida) */
+	unsigned int end;
+	/** @brief Tipo de rango (VM_RANGE_*) */
+	int type;
+	/** @brief Bits de las entradas de las paginas del rango */
+	unsigned int flags;
+} vm_range_t;
+
+/** @brief 1 si la entrada 1 de la PAT se programo como write-combining */
+extern int pat_enabled;
+
+/** @brief Directorio de paginas del kernel */
+extern unsigned int * page_directory;
+
+/**
+ * @brief Crea el directorio de paginas del kernel, mapea la memoria en su
+ * misma direccion, instala el manejador de fallos de pagina y activa la
+ * paginacion en todos los procesadores en ejecucion.
+ * @return 0 si la paginacion se activo, -1 en caso contrario.
+ */
+int setup_paging(void);
+
+/**
+ * @brief Mapea una pagina.
+ * @param virt Direccion lineal de la pagina
+ * @param phys Direccion fisica del marco
+ * @param flags Bits de la entrada (PAGE_WRITE, PAGE_PCD, ...)
+ * @return 0 si la pagina se mapeo, -1 si ya estaba mapeada o no fue posible
+ * asignar la tabla de paginas.
+ */
+int map_page(unsigned int virt, unsigned int phys, unsigned int flags);
+
+/**
+ * @brief Quita el mapeo de una pagina.
+ * @param virt Direccion lineal de la pagina
+ * @return Direccion fisica del marco que estaba mapeado, 0 si la pagina no
+ * estaba mapeada.
+ */
+unsigned int unmap_page(unsigned int virt);
+
+/**
+ * @brief Traduce una direccion lineal a una direccion fisica.
+ * @param virt Direccion lineal
+ * @return Direccion fisica, 0 si la direccion no se encuentra mapeada.
+ */
+unsigned int virtual_to_physical(unsigned int virt);
+
+/**
+ * @brief Mapea una region (por ejemplo, registros de un dispositivo) en su
+ * misma direccion fisica.
+ * @param start Direccion fisica de inicio
+ * @param length Tamano de la region
+ * @param flags Bits de las entradas (PAGE_WRITE, PAGE_PCD, ...)
+ * @return 0 si la region se mapeo, -1 en caso contrario.
+ */
+int identity_map(unsigned int start, unsigned int length, unsigned int flags);
+
+/**
+ * @brief Reserva un rango de direcciones lineales cuyas paginas se asignan
+ * en el primer acceso.
+ * @param length Tamano del rango
+ * @return Direccion de inicio del rango, 0 si no existe espacio.
+ */
+char * reserve_lazy_range(unsigned int length);
+
+/**
+ * @brief Libera un rango reservado con reserve_lazy_range() y las unidades
+ * que se asignaron a sus paginas.
+ * @param addr Direccion de inicio del rango
+ * @return Numero de paginas que tenian un marco asignado.
+ */
+unsigned int release_lazy_range(char * addr);
+
+#endif /* PAGING_H_ */
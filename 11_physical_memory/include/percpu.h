@@ -0,0 +1,151 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones del bloque de datos de cada procesador.
+ * @details
+ * Cada procesador tiene un bloque de datos propio, descrito por un
+ * descriptor de segmento de datos en la GDT cuya base es la direccion del
+ * bloque. El selector de ese descriptor se carga en el registro GS, de forma
+ * que gs:desplazamiento accede al campo del procesador actual sin necesidad
+ * de conocer su indice.
+ *
+ * El registro GS no se modifica en las rutinas de servicio de interrupcion
+ * (isr.S), por lo cual contiene siempre el selector del procesador actual.
+ */
+
+#ifndef PERCPU_H_
+#define PERCPU_H_
+
+/** @brief Desplazamiento del campo current_esp dentro de percpu_t */
+#define PERCPU_CURRENT_ESP 8
+
+/** @brief Desplazamiento del campo current_ss dentro de percpu_t */
+#define PERCPU_CURRENT_SS 12
+
+/** @brief Desplazamiento del campo interrupt_stack_top dentro de percpu_t */
+#define PERCPU_INTERRUPT_STACK_TOP 16
+
+/** @brief Desplazamiento del campo irq_nesting dentro de percpu_t */
+#define PERCPU_IRQ_NESTING 20
+
+/** @brief Tamano de la pila de interrupcion de cada procesador. El manejador
+ * de fallos de pagina invoca al asignador de unidades desde esta pila. */
+#define PERCPU_INTERRUPT_STACK_SIZE 4096
+
+/** @brief Numero de areas de FXSAVE de cada procesador: una por cada nivel
+ * de anidamiento de fpu_begin() (ver fpu.h) */
+#define PERCPU_FPU_AREAS 2
+
+/** @brief Tamano de un area de FXSAVE */
+#define FXSAVE_AREA_SIZE 512
+
+/* Dado que este archivo puede ser incluido desde codigo en Assembler, incluir
+ * solo las constantes definidas anteriormente. */
+#ifndef ASM
+
+#include <asm.h>
+#include <physmem.h>
+
+/** @brief Estructura del bloque de datos de un procesador.
+ * @details Los campos que se acceden desde isr.S deben coincidir con las
+ * constantes PERCPU_* definidas arriba. */
+typedef struct percpu {
+	/** @brief Direccion lineal de este bloque */
+	struct percpu * self;
+	/** @brief Indice del procesador dentro de cpus (ver smp.h) */
+	int cpu;
+	/** @brief Valor de esp al entrar a isr_reference (apunta al estado del
+	 * procesador interrumpido). interrupt_entry pasa el estado como
+	 * parametro y no usa este campo. */
+	unsigned int current_esp;
+	/** @brief Valor de ss al entrar a isr_reference */
+	unsigned int current_ss;
+	/** @brief Tope de la pila de interrupcion del procesador */
+	unsigned int interrupt_stack_top;
+	/** @brief Numero de manejadores de IRQ en ejecucion en el procesador */
+	int irq_nesting;
+	/** @brief Siguiente unidad en la cual el procesador busca una unidad
+	 * libre dentro de memory_bitmap */
+	unsigned int next_free_unit;
+	/** @brief Selector del descriptor de segmento de este bloque */
+	unsigned int selector;
+	/** @brief Cache de unidades libres del procesador */
+	cpu_unit_cache_t unit_cache;
+	/** @brief Nodo NUMA del procesador (ver numa_cpu_online()) */
+	int numa_node;
+	/** @brief Pila que se usa para invocar los manejadores de interrupcion */
+	char interrupt_stack[PERCPU_INTERRUPT_STACK_SIZE];
+	/** @brief Numero de rutinas que usan los registros XMM en el
+	 * procesador (ver fpu_begin()) */
+	volatile int fpu_depth;
+	/** @brief Estado de los registros XMM de las rutinas interrumpidas */
+	char fpu_area[PERCPU_FPU_AREAS][FXSAVE_AREA_SIZE]
+			__attribute__ ((aligned(16)));
+} percpu_t;
+
+/** @brief Bloque de datos del BSP. Los bloques de los AP se asignan al
+ * arrancarlos. */
+extern percpu_t boot_percpu;
+
+/**
+ * @brief Lee un campo de 32 bits del bloque del procesador actual.
+ * @param field Nombre del campo dentro de percpu_t
+ */
+#define this_cpu_read(field) \
+	({ \
+		typeof(((percpu_t *)0)->field) __value; \
+		inline_assembly("movl %%gs:%c1, %0" : "=r" (__value) \
+				: "i" (__builtin_offsetof(percpu_t, field))); \
+		__value; \
+	})
+
+/**
+ * @brief Escribe un campo de 32 bits del bloque del procesador actual.
+ * @param field Nombre del campo dentro de percpu_t
+ * @param value Valor a escribir
+ */
+#define this_cpu_write(field, value) \
+	inline_assembly("movl %0, %%gs:%c1" : \
+			: "r" ((typeof(((percpu_t *)0)->field))(value)), \
+			"i" (__builtin_offsetof(percpu_t, field)) : "memory")
+
+/**
+ * @brief Suma un valor a un campo de 32 bits del bloque del procesador
+ * actual. Se realiza con una sola instruccion, por lo cual no puede ser
+ * interrumpida a la mitad por un manejador de IRQ.
+ * @param field Nombre del campo dentro de percpu_t
+ * @param value Valor a sumar
+ */
+#define this_cpu_add(field, value) \
+	inline_assembly("addl %0, %%gs:%c1" : \
+			: "ri" ((int)(value)), \
+			"i" (__builtin_offsetof(percpu_t, field)) : "memory", "cc")
+
+/**
+ * @brief Permite obtener el apuntador al bloque del procesador actual.
+ * @return Direccion lineal del bloque
+ */
+#define this_cpu_ptr() this_cpu_read(self)
+
+/**
+ * @brief Inicializa el bloque de datos de un procesador y crea su
+ * descriptor de segmento en la GDT.
+ * @param cpu Indice del procesador
+ * @param block Bloque de datos del procesador
+ * @return Selector del descriptor, 0 si no existe espacio en la GDT.
+ */
+unsigned short setup_percpu(int cpu, percpu_t * block);
+
+/**
+ * @brief Carga el selector del bloque de datos del procesador actual en GS.
+ * @param selector Selector retornado por setup_percpu()
+ */
+static __inline__ void load_percpu(unsigned short selector) {
+	inline_assembly("movw %0, %%gs" : : "r" (selector) : "memory");
+}
+
+#endif
+
+#endif /* PERCPU_H_ */
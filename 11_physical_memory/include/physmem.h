@@ -10,16 +10,93 @@
 #ifndef PHYSMEM_H_
 #define PHYSMEM_H_
 
+#include <bitmap.h>
+
 /** @brief Localizacion del mapa de bits de memoria. */
 #define MMAP_LOCATION 0x500
 
  /** @brief Tamao de la unidad de asignacin de memoria  */
 #define MEMORY_UNIT_SIZE 4096
 
-/** @brief Nmero de bytes que tiene una entrada en el mapa de bits */
-#define BYTES_PER_ENTRY sizeof(unsigned int)
+/** @brief Logaritmo en base 2 de MEMORY_UNIT_SIZE. Permite convertir entre
+ * direcciones de 64 bits y numeros de marco sin divisiones de 64 bits. */
+#define MEMORY_UNIT_SHIFT 12
+
+/** @brief Numero maximo de regiones de memoria por encima de 4 GB que se
+ * pueden gestionar. Cada region tiene su propio mapa de bits. */
+#define MAX_HIGH_REGIONS 16
+
+/** @brief Limite de la memoria que se gestiona con memory_bitmap. Por encima
+ * de este limite la memoria se gestiona por regiones (ver allocate_frame) */
+#define LOW_MEMORY_LIMIT 0xFFFE0000
+
+/** @brief Numero de marco fisico de 64 bits. Con PAE las direcciones fisicas
+ * pueden ocupar hasta 36 bits o mas, por lo cual no caben en un char *.
+ * El marco 0 nunca se asigna, por lo cual 0 indica error. */
+typedef unsigned long long frame_t;
+
+/** @brief Convierte una direccion fisica de 64 bits en un numero de marco */
+#define address_to_frame(addr) ((frame_t)(addr) >> MEMORY_UNIT_SHIFT)
+
+/** @brief Convierte un numero de marco en su direccion fisica de 64 bits */
+#define frame_to_address(frame) ((frame_t)(frame) << MEMORY_UNIT_SHIFT)
 
-#define BITS_PER_ENTRY (8 * BYTES_PER_ENTRY)
+/** @brief Estructura de datos para una region de memoria fisica por encima
+ * del limite de memory_bitmap.
+ * @details Cada region tiene un mapa de bits propio que solo cubre los
+ * marcos de la region, de forma que los huecos del espacio fisico no ocupan
+ * espacio en ningun mapa de bits. */
+typedef struct memory_region {
+	/** @brief Primer marco de la region */
+	frame_t base_frame;
+	/** @brief Numero de marcos de la region */
+	unsigned int frames;
+	/** @brief Numero de marcos libres de la region */
+	int free_frames;
+	/** @brief Entrada del mapa de bits en la cual inicia la proxima busqueda */
+	unsigned int next_entry;
+	/** @brief Mapa de bits de la region (1 = marco libre) */
+	unsigned int * bitmap;
+} memory_region_t;
+
+/** @brief Numero maximo de nodos NUMA (dominios de proximidad) */
+#define MAX_NUMA_NODES 8
+
+/** @brief Numero maximo de rangos de memoria descritos por la SRAT */
+#define MAX_NUMA_RANGES 16
+
+/** @brief Rango de unidades de memory_bitmap que pertenece a un nodo NUMA */
+typedef struct numa_range {
+	/** @brief Primera unidad del rango */
+	unsigned int start_unit;
+	/** @brief Unidad siguiente a la ultima del rango */
+	unsigned int end_unit;
+	/** @brief Indice del nodo al cual pertenece el rango */
+	int node;
+	/** @brief Siguiente unidad del rango en la cual se busca una unidad
+	 * libre */
+	volatile unsigned int next_free_unit;
+} numa_range_t;
+
+/** @brief Estructura de datos para un nodo NUMA.
+ * @details Cada nodo tiene sus propios contadores, y cada uno de sus rangos
+ * (ver numa_range_t) su propio cursor de busqueda, de forma que las
+ * asignaciones de un nodo solo recorren las unidades de ese nodo dentro de
+ * memory_bitmap. */
+typedef struct numa_node {
+	/** @brief Dominio de proximidad ACPI del nodo */
+	unsigned int domain;
+	/** @brief Menor unidad de los rangos del nodo */
+	unsigned int start_unit;
+	/** @brief Unidad siguiente a la mayor unidad de los rangos del nodo */
+	unsigned int end_unit;
+	/** @brief Numero de unidades libres del nodo */
+	int free_units;
+	/** @brief Numero total de unidades del nodo */
+	int total_units;
+	/** @brief Nodos en orden de distancia (el primero es el mismo nodo) */
+	int fallback[MAX_NUMA_NODES];
+} numa_node_t;
 
 /** @brief Nmero de unidades en la memoria disponible */
 #define MEMORY_UNITS (memory_length / MEMORY_UNIT_SIZE)
@@ -58,6 +135,103 @@ static __inline__ unsigned int round_up_to_memory_unit(addr) {
 
 }
 
+/** @brief Numero de clases de tamano de la cache de regiones liberadas */
+#define REGION_CACHE_CLASSES 3
+
+/** @brief Numero maximo de regiones que almacena cada clase de la cache */
+#define REGION_CACHE_DEPTH 8
+
+/** @brief Fraccion maxima de la memoria libre que puede retener la cache de
+ * regiones. Si las unidades en cache superan 1 / REGION_CACHE_MAX_SHARE de la
+ * memoria libre, la cache se devuelve al mapa de bits para que las regiones
+ * puedan volver a unirse con las unidades vecinas. */
+#define REGION_CACHE_MAX_SHARE 4
+
+/** @brief Numero de unidades que se mantienen en el pool de emergencia para
+ * los manejadores de IRQ */
+#define EMERGENCY_POOL_UNITS 8
+
+/** @brief Numero maximo de rutinas de recuperacion de memoria que se pueden
+ * registrar */
+#define MAX_RECLAIM_CALLBACKS 8
+
+/** @brief Tipo de las rutinas de recuperacion de memoria.
+ * @details Las caches construidas sobre el asignador (caches de objetos,
+ * de bloques, etc.) registran una rutina de este tipo. Cuando la memoria
+ * libre cae por debajo de las marcas de agua, la rutina se invoca con el
+ * numero de unidades que se desea recuperar, y debe retornar el numero de
+ * unidades que devolvio con free_unit() o free_region(). */
+typedef unsigned int (*reclaim_callback)(unsigned int units);
+
+/** @brief Estructura de datos para una clase de la cache de regiones
+ * liberadas recientemente.
+ * @details Las regiones almacenadas en la cache permanecen marcadas como
+ * ocupadas dentro del mapa de bits, por lo cual pueden ser entregadas de
+ * nuevo por allocate_unit_region() sin recorrer el mapa de bits. */
+typedef struct region_cache {
+	/** @brief Tamano en unidades de las regiones de esta clase */
+	unsigned int units;
+	/** @brief Numero de regiones almacenadas */
+	int count;
+	/** @brief Unidad inicial de cada region almacenada (0 = posicion
+	 * vacia). Las posiciones se toman y se llenan con lock cmpxchg. */
+	unsigned int start_unit[REGION_CACHE_DEPTH];
+} region_cache_t;
+
+/** @brief Numero de unidades que almacena la cache de cada procesador */
+#define CPU_UNIT_CACHE_SIZE 32
+
+/** @brief Numero de unidades que se toman del mapa de bits al recargar la
+ * cache de un procesador, o que se devuelven cuando la cache esta llena */
+#define CPU_UNIT_CACHE_BATCH 16
+
+/** @brief Estructura de datos para la cache de unidades libres de un
+ * procesador.
+ * @details Cada procesador toma y devuelve unidades de su propia cache, sin
+ * operaciones atomicas. Solo las recargas y los vaciados (en lotes de
+ * CPU_UNIT_CACHE_BATCH unidades) modifican el mapa de bits global. La
+ * estructura se alinea a 64 bytes para que dos procesadores no compartan una
+ * linea de cache. */
+typedef struct cpu_unit_cache {
+	/** @brief Numero de unidades almacenadas */
+	int count;
+	/** @brief Unidades almacenadas (pila LIFO) */
+	unsigned int unit[CPU_UNIT_CACHE_SIZE];
+} __attribute__((aligned(64))) cpu_unit_cache_t;
+
+/** @brief Numero maximo de rangos de memoria usados durante el arranque
+ * (modulos y estructuras de GRUB) que se pueden registrar */
+#define MAX_BOOT_RANGES 32
+
+/** @brief Tipo de rango de arranque: modulo cargado por GRUB */
+#define BOOT_RANGE_MODULE 1
+
+/** @brief Tipo de rango de arranque: estructuras de informacion multiboot
+ * (informacion, mapa de memoria, lista de modulos y cadenas) */
+#define BOOT_RANGE_MULTIBOOT 2
+
+/** @brief Estructura de datos para un rango de memoria usado durante el
+ * arranque.
+ * @details Las unidades de estos rangos se marcan como ocupadas en
+ * setup_memory(), y se devuelven al mapa de bits con free_boot_modules() y
+ * free_boot_memory(). */
+typedef struct boot_range {
+	/** @brief Direccion de inicio, redondeada a MEMORY_UNIT_SIZE */
+	unsigned int start;
+	/** @brief Direccion final (no incluida), redondeada a MEMORY_UNIT_SIZE */
+	unsigned int end;
+	/** @brief Tipo de rango (BOOT_RANGE_*), 0 si ya fue liberado */
+	int type;
+} boot_range_t;
+
+/** @brief Asignador por defecto del kernel, construido sobre memory_bitmap.
+ * Las rutinas de este archivo se implementan sobre esta instancia. */
+extern bitmap_allocator_t memory_allocator;
+
+/** @brief Vale 1 cuando la paginacion usa PAE y allocate_frame() puede
+ * entregar marcos por encima de 4 GB */
+extern int high_frames_enabled;
+
 /**
  * @brief Esta rutina inicializa el mapa de bits de memoria,
  * a partir de la informacion obtenida del GRUB.
@@ -90,4 +264,142 @@ void free_unit(char *addr);
  */
 void free_region(char *start_addr, unsigned int length);
 
+/**
+ * @brief Devuelve al mapa de bits todas las regiones almacenadas en la
+ * cache de regiones liberadas.
+ */
+void flush_region_cache(void);
+
+/**
+ * @brief Devuelve al mapa de bits las unidades de la cache del procesador
+ * actual.
+ * @return Numero de unidades devueltas
+ */
+unsigned int drain_cpu_unit_cache(void);
+
+/**
+ * @brief Asigna un marco de memoria fisica. Los marcos por encima de 4 GB
+ * solo se entregan (con preferencia) si high_frames_enabled vale 1.
+ * @return Numero del marco asignado, 0 si no existe memoria disponible.
+ */
+frame_t allocate_frame(void);
+
+/**
+ * @brief Libera un marco asignado con allocate_frame().
+ * @param frame Numero del marco a liberar
+ */
+void free_frame(frame_t frame);
+
+/**
+ * @brief Construye los nodos NUMA a partir de la tabla SRAT de ACPI. Se
+ * debe invocar despues de setup_memory() y setup_acpi().
+ */
+void setup_numa(void);
+
+/**
+ * @brief Almacena en el bloque de datos del procesador actual el nodo NUMA
+ * al cual pertenece. Se invoca cuando el procesador entra en ejecucion.
+ */
+void numa_cpu_online(void);
+
+/**
+ * @brief Permite obtener el nodo NUMA del procesador actual.
+ * @return Indice del nodo, 0 si no existe informacion NUMA.
+ */
+int current_numa_node(void);
+
+/**
+ * @brief Busca una unidad libre dentro de un nodo NUMA.
+ * @param node Indice del nodo
+ * @return Direccion de inicio de la unidad, 0 si el nodo no tiene memoria
+ * disponible.
+ */
+char * allocate_unit_node(int node);
+
+/**
+ * @brief Reserva unidades de memoria para garantizar que asignaciones
+ * posteriores con allocate_reserved_unit() no van a fallar.
+ * @param n Numero de unidades a reservar
+ * @return 0 si la reserva se realizo, -1 si no existe memoria suficiente.
+ */
+int reserve_units(unsigned int n);
+
+/**
+ * @brief Libera unidades reservadas con reserve_units() que no se van a usar.
+ * @param n Numero de unidades a liberar de la reserva
+ */
+void unreserve_units(unsigned int n);
+
+/**
+ * @brief Asigna una unidad tomandola de una reserva hecha con
+ * reserve_units().
+ * @return Direccion de inicio de la unidad en memoria.
+ */
+char * allocate_reserved_unit(void);
+
+/**
+ * @brief Toma una unidad del pool de emergencia, sin tocar el mapa de bits.
+ * allocate_unit() usa esta rutina cuando se invoca desde un manejador de IRQ.
+ * @return Direccion de inicio de la unidad, 0 si el pool esta vacio.
+ */
+char * allocate_emergency_unit(void);
+
+/**
+ * @brief Devuelve una unidad al pool de emergencia.
+ * @param addr Direccion de memoria dentro de la unidad a devolver
+ */
+void free_emergency_unit(char * addr);
+
+/**
+ * @brief Configura las marcas de agua de memoria libre.
+ * @param min Marca minima, en unidades
+ * @param low Marca baja, en unidades
+ * @param high Marca alta, en unidades
+ * @return 0 si las marcas son validas (min <= low <= high), -1 en caso
+ * contrario.
+ */
+int set_memory_watermarks(unsigned int min, unsigned int low,
+		unsigned int high);
+
+/**
+ * @brief Registra una rutina de recuperacion de memoria.
+ * @param callback Rutina que se invoca cuando la memoria libre cae por
+ * debajo de las marcas de agua
+ * @return Posicion de la rutina en la tabla, -1 si no se pudo registrar.
+ */
+int register_reclaim_callback(reclaim_callback callback);
+
+/**
+ * @brief Quita una rutina de recuperacion de memoria.
+ * @param callback Rutina registrada con register_reclaim_callback()
+ */
+void unregister_reclaim_callback(reclaim_callback callback);
+
+/**
+ * @brief Intenta recuperar memoria de la cache de regiones y de las rutinas
+ * de recuperacion registradas.
+ * @param units Numero de unidades que se desea recuperar
+ * @return Numero de unidades recuperadas
+ */
+unsigned int reclaim_memory(unsigned int units);
+
+/**
+ * @brief Devuelve al mapa de bits la memoria de los modulos cargados por
+ * GRUB.
+ * @return Numero de unidades liberadas
+ */
+unsigned int free_boot_modules(void);
+
+/**
+ * @brief Devuelve al mapa de bits la memoria de la seccion .init y de las
+ * estructuras de informacion multiboot.
+ * @return Numero de unidades liberadas
+ @verbatim
+  Se debe invocar una sola vez, al terminar la inicializacion del kernel y
+  antes de que los demas procesadores asignen memoria. Luego de invocarla
+  no se puede ejecutar ninguna rutina marcada con __init, ni leer la
+  estructura de informacion multiboot.
+ @endverbatim*/
+unsigned int free_boot_memory(void);
+
 #endif /* PHYSMEM_H_ */
@@ -0,0 +1,129 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones del puerto serial COM1 (UART 16550) y del
+ * puerto de depuracion 0xE9, usados como salidas de printf().
+ * @details
+ * La transmision por el puerto serial se realiza desde un buffer circular:
+ * serial_write() almacena los caracteres en el buffer y el manejador de la
+ * IRQ4 los copia a la FIFO de transmision del UART (16 bytes) cada vez que
+ * esta se vacia. De esta forma printf() no espera a que cada caracter salga
+ * por el puerto.
+ *
+ * El puerto 0xE9 (debugcon de QEMU y Bochs) copia en la consola del host
+ * cada byte que se escribe en el, sin ninguna espera, por lo cual la cadena
+ * completa se escribe con una sola instruccion rep outsb.
+ */
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+/** @brief Puerto base de COM1 */
+#define COM1_PORT 0x3F8
+
+/** @brief IRQ de COM1 */
+#define COM1_IRQ 4
+
+/** @brief Registro de datos (lectura: RBR, escritura: THR). Con DLAB = 1,
+ * byte menos significativo del divisor */
+#define UART_DATA 0
+
+/** @brief Registro de habilitacion de interrupciones (IER). Con DLAB = 1,
+ * byte mas significativo del divisor */
+#define UART_IER 1
+
+/** @brief Registro de identificacion de interrupciones (IIR, lectura) y de
+ * control de la FIFO (FCR, escritura) */
+#define UART_IIR 2
+
+/** @brief Registro de control de la FIFO (FCR, escritura) */
+#define UART_FCR 2
+
+/** @brief Registro de control de linea (LCR) */
+#define UART_LCR 3
+
+/** @brief Registro de control del modem (MCR) */
+#define UART_MCR 4
+
+/** @brief Registro de estado de la linea (LSR) */
+#define UART_LSR 5
+
+/** @brief IER: interrupcion cuando el registro de transmision esta vacio */
+#define UART_IER_THRI 0x02
+
+/** @brief IIR: no existe interrupcion pendiente */
+#define UART_IIR_NO_INT 0x01
+
+/** @brief IIR: la FIFO se encuentra habilitada (16550A) */
+#define UART_IIR_FIFO 0xC0
+
+/** @brief FCR: habilitar y limpiar las FIFO, interrupcion de recepcion con
+ * 14 bytes */
+#define UART_FCR_ENABLE 0xC7
+
+/** @brief LCR: acceso al divisor (Divisor Latch Access Bit) */
+#define UART_LCR_DLAB 0x80
+
+/** @brief LCR: 8 bits de datos, sin paridad, 1 bit de parada */
+#define UART_LCR_8N1 0x03
+
+/** @brief MCR: DTR, RTS y OUT2 (OUT2 conecta la IRQ del UART al PIC) */
+#define UART_MCR_NORMAL 0x0B
+
+/** @brief MCR: modo de prueba (loopback) */
+#define UART_MCR_LOOPBACK 0x1E
+
+/** @brief LSR: el registro de transmision (y la FIFO) esta vacio */
+#define UART_LSR_THRE 0x20
+
+/** @brief Frecuencia base del UART dividida por 16 */
+#define UART_CLOCK 115200
+
+/** @brief Velocidad del puerto serial */
+#define SERIAL_BAUD 115200
+
+/** @brief Tamano de la FIFO de transmision del 16550 */
+#define UART_FIFO_SIZE 16
+
+/** @brief Tamano del buffer circular de transmision (potencia de 2) */
+#define SERIAL_BUFFER_SIZE 4096
+
+/** @brief Puerto de depuracion de QEMU / Bochs */
+#define DEBUGCON_PORT 0xE9
+
+/**
+ * @brief Inicializa COM1 e instala el manejador de la IRQ4.
+ * @return 0 si el UART existe, -1 en caso contrario.
+ */
+int setup_serial(void);
+
+/**
+ * @brief Verifica si el puerto 0xE9 se encuentra disponible.
+ * @return 0 si existe, -1 en caso contrario.
+ */
+int setup_debugcon(void);
+
+/**
+ * @brief Envia una cadena por el puerto serial. Cada LF se envia como CR LF.
+ * @param s Cadena
+ * @param length Numero de caracteres
+ */
+void serial_write(char * s, unsigned int length);
+
+/**
+ * @brief Espera a que se transmitan todos los caracteres del buffer, sin
+ * usar la IRQ4. Se puede invocar con las interrupciones deshabilitadas
+ * (por ejemplo, antes de detener el sistema).
+ */
+void serial_flush(void);
+
+/**
+ * @brief Escribe una cadena en el puerto 0xE9.
+ * @param s Cadena
+ * @param length Numero de caracteres
+ */
+void debugcon_write(char * s, unsigned int length);
+
+#endif /* SERIAL_H_ */
@@ -0,0 +1,255 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones para el arranque de los procesadores de
+ * aplicacion (AP) en un sistema multiprocesador (SMP).
+ * @see http://www.intel.com/design/pentium/datashts/24201606.pdf Intel
+ * MultiProcessor Specification
+ */
+
+#ifndef SMP_H_
+#define SMP_H_
+
+/** @brief Numero maximo de procesadores que gestiona el kernel */
+#define MAX_CPUS 16
+
+/** @brief Direccion fisica por defecto del APIC local */
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+
+/** @brief Registro del APIC local: identificador (bits 24..31) */
+#define LAPIC_ID 0x20
+
+/** @brief Registro del APIC local: Task Priority Register */
+#define LAPIC_TPR 0x80
+
+/** @brief Registro del APIC local: End Of Interrupt */
+#define LAPIC_EOI 0xB0
+
+/** @brief Registro del APIC local: Spurious Interrupt Vector */
+#define LAPIC_SVR 0xF0
+
+/** @brief Bit del registro SVR que habilita el APIC local */
+#define LAPIC_SVR_ENABLE 0x100
+
+/** @brief Vector de las interrupciones espurias del APIC local (bits 0..7
+ * del registro SVR) */
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/** @brief Registro del APIC local: Interrupt Command Register (bits 0..31) */
+#define LAPIC_ICR_LOW 0x300
+
+/** @brief Registro del APIC local: Interrupt Command Register (bits 32..63) */
+#define LAPIC_ICR_HIGH 0x310
+
+/** @brief Registro del APIC local: entrada del temporizador en la Local
+ * Vector Table */
+#define LAPIC_LVT_TIMER 0x320
+
+/** @brief Registro del APIC local: entrada LINT0 de la Local Vector Table
+ * (conectada a la salida de los PIC 8259) */
+#define LAPIC_LVT_LINT0 0x350
+
+/** @brief Registro del APIC local: cuenta inicial del temporizador */
+#define LAPIC_TIMER_INITIAL 0x380
+
+/** @brief Registro del APIC local: cuenta actual del temporizador */
+#define LAPIC_TIMER_CURRENT 0x390
+
+/** @brief Registro del APIC local: divisor del temporizador */
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+/** @brief Divisor del temporizador: frecuencia del bus / 16 */
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+/** @brief Bit Mask de una entrada de la Local Vector Table */
+#define LAPIC_LVT_MASKED 0x00010000
+
+/** @brief ICR: IPI INIT, nivel assert */
+#define ICR_INIT 0x00004500
+
+/** @brief ICR: IPI STARTUP. El vector es la pagina del codigo de arranque */
+#define ICR_STARTUP 0x00004600
+
+/** @brief ICR: bit Delivery Status (1 = el IPI no se ha enviado) */
+#define ICR_PENDING 0x00001000
+
+/** @brief ICR: IPI con modo de entrega fijo, nivel assert. El vector se
+ * almacena en los bits 0..7 */
+#define ICR_FIXED 0x00004000
+
+/** @brief Vector del IPI con el cual smp_call() despierta a los AP */
+#define SMP_CALL_VECTOR 0xF1
+
+/** @brief Direccion en la cual se copia el codigo de arranque de los AP.
+ * Debe estar alineada a 4 KB, por debajo de 1 MB y fuera del mapa de bits
+ * de memoria (0x500 - 0x20500) y de la pila inicial (0x9FC00). */
+#define TRAMPOLINE_LOCATION 0x70000
+
+/** @brief Tamano de la pila de cada procesador de aplicacion */
+#define AP_STACK_SIZE 0x4000
+
+/** @brief Firma de la estructura MP Floating Pointer */
+#define MP_FLOATING_SIGNATURE "_MP_"
+
+/** @brief Firma de la tabla de configuracion MP */
+#define MP_CONFIG_SIGNATURE "PCMP"
+
+/** @brief Tipo de entrada de la tabla de configuracion MP: procesador */
+#define MP_ENTRY_PROCESSOR 0
+
+/** @brief Bit 'Enabled' de una entrada de procesador de la tabla MP */
+#define MP_PROCESSOR_ENABLED 0x1
+
+/* Dado que este archivo puede ser incluido desde codigo en Assembler, incluir
+ * solo las constantes definidas anteriormente. */
+#ifndef ASM
+
+/** @brief Estructura MP Floating Pointer de la especificacion MP */
+typedef struct mp_floating {
+	/** @brief Firma "_MP_" */
+	char signature[4];
+	/** @brief Direccion fisica de la tabla de configuracion */
+	unsigned int config_address;
+	/** @brief Tamano de la estructura en unidades de 16 bytes */
+	unsigned char length;
+	/** @brief Version de la especificacion */
+	unsigned char revision;
+	/** @brief Suma de chequeo */
+	unsigned char checksum;
+	/** @brief Configuracion por defecto (0 = existe tabla de configuracion) */
+	unsigned char features[5];
+} __attribute__((packed)) mp_floating_t;
+
+/** @brief Encabezado de la tabla de configuracion MP */
+typedef struct mp_config {
+	/** @brief Firma "PCMP" */
+	char signature[4];
+	/** @brief Tamano de la tabla base */
+	unsigned short length;
+	/** @brief Version de la especificacion */
+	unsigned char revision;
+	/** @brief Suma de chequeo */
+	unsigned char checksum;
+	/** @brief Identificador del fabricante */
+	char oem_id[8];
+	/** @brief Identificador del producto */
+	char product_id[12];
+	/** @brief Apuntador a la tabla OEM */
+	unsigned int oem_table;
+	/** @brief Tamano de la tabla OEM */
+	unsigned short oem_table_size;
+	/** @brief Numero de entradas de la tabla */
+	unsigned short entry_count;
+	/** @brief Direccion fisica del APIC local */
+	unsigned int local_apic_address;
+	/** @brief Tamano de la tabla extendida */
+	unsigned short extended_length;
+	/** @brief Suma de chequeo de la tabla extendida */
+	unsigned char extended_checksum;
+	/** @brief Reservado */
+	unsigned char reserved;
+} __attribute__((packed)) mp_config_t;
+
+/** @brief Entrada de procesador (tipo 0) de la tabla de configuracion MP */
+typedef struct mp_processor {
+	/** @brief Tipo de entrada (0) */
+	unsigned char type;
+	/** @brief Identificador del APIC local */
+	unsigned char apic_id;
+	/** @brief Version del APIC local */
+	unsigned char apic_version;
+	/** @brief Flags: bit 0 = Enabled, bit 1 = BSP */
+	unsigned char flags;
+	/** @brief Firma del procesador (CPUID.01H:EAX) */
+	unsigned int signature;
+	/** @brief Caracteristicas del procesador (CPUID.01H:EDX) */
+	unsigned int features;
+	/** @brief Reservado */
+	unsigned int reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+/** @brief Estructura de datos para un procesador del sistema */
+typedef struct cpu {
+	/** @brief Identificador del APIC local del procesador */
+	unsigned char apic_id;
+	/** @brief 1 si el procesador se encuentra en ejecucion */
+	volatile int online;
+	/** @brief Inicio de la pila del procesador (0 para el BSP) */
+	char * stack;
+	/** @brief Bloque de datos del procesador (ver percpu.h) */
+	struct percpu * data;
+} cpu_t;
+
+/** @brief Rutina que se ejecuta en cada procesador con smp_call() */
+typedef void (*smp_function)(int cpu, void * arg);
+
+/** @brief Procesadores encontrados en la MADT o en la tabla MP. El
+ * procesador 0 es el BSP. */
+extern cpu_t cpus[];
+
+/** @brief Numero de procesadores encontrados */
+extern int cpu_count;
+
+/** @brief Numero de procesadores en ejecucion */
+extern volatile int online_cpus;
+
+/** @brief Direccion fisica de los registros del APIC local */
+extern unsigned int lapic_base;
+
+/**
+ * @brief Lee un registro del APIC local.
+ * @param reg Desplazamiento del registro
+ * @return Valor del registro
+ */
+static __inline__ unsigned int lapic_read(unsigned int reg) {
+	return *(volatile unsigned int *)(lapic_base + reg);
+}
+
+/**
+ * @brief Escribe un registro del APIC local.
+ * @param reg Desplazamiento del registro
+ * @param value Valor a escribir
+ */
+static __inline__ void lapic_write(unsigned int reg, unsigned int value) {
+	*(volatile unsigned int *)(lapic_base + reg) = value;
+}
+
+/**
+ * @brief Busca los procesadores del sistema y arranca los procesadores de
+ * aplicacion.
+ * @return Numero de procesadores en ejecucion.
+ */
+int setup_smp(void);
+
+/**
+ * @brief Permite obtener el indice del procesador actual.
+ * @return Indice del procesador dentro de cpus, 0 si solo existe el BSP.
+ */
+int current_cpu(void);
+
+/**
+ * @brief Ejecuta una rutina en todos los procesadores en ejecucion, y espera
+ * a que todos terminen.
+ * @param function Rutina a ejecutar
+ * @param arg Argumento de la rutina
+ * @param cpus_to_use Numero de procesadores que ejecutan la rutina (el BSP y
+ * los primeros cpus_to_use - 1 AP)
+ @verbatim
+  Solo se debe invocar desde el BSP. Los AP se despiertan con un IPI
+  SMP_CALL_VECTOR.
+ @endverbatim*/
+void smp_call(smp_function function, void * arg, int cpus_to_use);
+
+/**
+ * @brief Mide el rendimiento de allocate_unit() y free_unit() con uno y con
+ * todos los procesadores.
+ * @param iterations Numero de ciclos de asignacion y liberacion que realiza
+ * cada procesador
+ */
+void smp_allocation_benchmark(unsigned int iterations);
+
+#endif
+
+#endif /* SMP_H_ */
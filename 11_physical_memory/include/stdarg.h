@@ -0,0 +1,32 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones para recorrer la lista de argumentos
+ * variables de una funcion.
+ * @details
+ * El kernel se compila con -nostdinc, por lo cual no puede usar el stdarg.h
+ * del compilador. Estas macros usan las funciones internas de gcc, que
+ * conocen la convencion de llamado.
+ */
+
+#ifndef STDARG_H_
+#define STDARG_H_
+
+/** @brief Lista de argumentos variables */
+typedef __builtin_va_list va_list;
+
+/** @brief Inicia el recorrido de los argumentos que siguen a last */
+#define va_start(ap, last) __builtin_va_start(ap, last)
+
+/** @brief Obtiene el siguiente argumento, del tipo especificado */
+#define va_arg(ap, type) __builtin_va_arg(ap, type)
+
+/** @brief Termina el recorrido de los argumentos */
+#define va_end(ap) __builtin_va_end(ap)
+
+/** @brief Copia el estado del recorrido de los argumentos */
+#define va_copy(dst, src) __builtin_va_copy(dst, src)
+
+#endif /* STDARG_H_ */
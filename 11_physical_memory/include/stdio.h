@@ -11,6 +11,7 @@
 #define STDIO_H_
 
 #include <asm.h> /* Para operaciones sobre puertos de E/S */
+#include <stdarg.h>
 
 /*@brief Constante que define la direccin lineal del inicio de la memoria de
  * video*/
@@ -37,6 +38,38 @@
  */
 extern unsigned short * videoptr;
 
+/** @brief Tamano de la memoria de video de modo texto (0xB8000 - 0xBFFFF) */
+#define VIDEO_MEMORY_SIZE 0x8000
+
+/** @brief Numero de celdas en la memoria de video de modo texto */
+#define VIDEO_CELLS (VIDEO_MEMORY_SIZE / 2)
+
+/** @brief Inicio de la memoria de video de modo texto */
+extern unsigned short * video_memory;
+
+/** @brief Numero maximo de lineas de la pantalla (consola grafica de 1024
+ * pixeles de alto) */
+#define MAX_SCREEN_LINES 64
+
+/** @brief Numero maximo de columnas de la pantalla (consola grafica de
+ * 1280 pixeles de ancho) */
+#define MAX_SCREEN_COLUMNS 160
+
+/** @brief Copia en memoria RAM de las celdas de la pantalla. Las rutinas de
+ * stdio.c escriben en esta copia; flush_screen() la lleva a la memoria de
+ * video. */
+extern unsigned short screen_cells[];
+
+/** @brief Primera columna modificada de cada linea de screen_cells */
+extern short dirty_first[];
+
+/** @brief Ultima columna modificada de cada linea de screen_cells */
+extern short dirty_last[];
+
+/** @brief Celda de video_memory que se muestra en la esquina superior
+ * izquierda de la pantalla (direccion de inicio del CRT) */
+extern unsigned int screen_origin;
+
 /** @brief Byte que almacena los atributos de texto */
 extern char text_attributes;
 
@@ -46,9 +79,26 @@ extern char text_attributes;
 /** @brief Nmero de columnas de la pantalla */
 #define SCREEN_COLUMNS 80
 
+/** @brief Tamano del buffer en el cual printf() construye la cadena. Las
+ * cadenas mas largas se truncan. */
+#define PRINTF_BUFFER_SIZE 512
+
 /** @brief Espacios en un tabulador */
 #define TABSIZE 8
 
+/** @brief Salida de la consola: pantalla (modo texto o framebuffer) */
+#define CONSOLE_SCREEN 0x1
+
+/** @brief Salida de la consola: puerto serial COM1 (ver serial.h) */
+#define CONSOLE_SERIAL 0x2
+
+/** @brief Salida de la consola: puerto de depuracion 0xE9 (ver serial.h) */
+#define CONSOLE_DEBUGCON 0x4
+
+/** @brief Salidas en las cuales putchar(), puts() y printf() escriben
+ * (combinacion de CONSOLE_*) */
+extern unsigned int console_sinks;
+
 /** @brief Variable que controla el nmero de lineas de la pantalla */
 extern int screen_lines;
 
@@ -120,14 +170,75 @@ void putchar(char c);
  */
 void puts(char * s );
 
+/**
+ * @brief Escribe una cadena en cada una de las salidas de console_sinks.
+ * @param s Cadena
+ * @param length Numero de caracteres de la cadena
+ */
+void console_write(char * s, unsigned int length);
+
+/**
+ * @brief Funcion para limpiar la pantalla
+ */
+void cls(void);
+
+/**
+ * @brief Marca una celda de la pantalla como modificada.
+ * @param line Linea de la celda
+ * @param column Columna de la celda
+ */
+static __inline__ void mark_dirty(int line, int column) {
+	if (column < dirty_first[line]) {
+		dirty_first[line] = column;
+	}
+	if (column > dirty_last[line]) {
+		dirty_last[line] = column;
+	}
+}
+
+/**
+ * @brief Marca todas las celdas de la pantalla como modificadas.
+ */
+void invalidate_screen(void);
+
+/**
+ * @brief Copia a la memoria de video (o dibuja en el framebuffer) las
+ * celdas modificadas y actualiza el cursor.
+ */
+void flush_screen(void);
+
 
 /**
  * @brief  Esa funcion implementa en forma basica el comportamiento de
  * 'printf' en C.
- * @param format Formato de la cadena de salida
+ * @param format Formato de la cadena de salida (ver vsnprintf())
  * @param ...  Lista de referencias a memoria de las variables a imprimir
  *
 */
 void printf(char * ,...);
 
+/**
+ * @brief Construye una cadena con formato en un buffer.
+ * @param buf Buffer de salida
+ * @param size Tamano del buffer. La cadena siempre termina en nulo (si
+ * size > 0), y se trunca si no cabe.
+ * @param format Formato de la cadena (ver vsnprintf())
+ * @param ... Argumentos
+ * @return Numero de caracteres que tendria la cadena completa, sin el nulo.
+ */
+int snprintf(char * buf, unsigned int size, char * format, ...);
+
+/**
+ * @brief Construye una cadena con formato en un buffer, a partir de una
+ * lista de argumentos variables.
+ * @param buf Buffer de salida
+ * @param size Tamano del buffer
+ * @param format Formato de la cadena:
+ * %[flags][ancho][.precision][longitud]conversion, con flags - 0 + espacio
+ * #, longitud h, hh, l o ll (64 bits) y conversiones d i u x X o b p c s %.
+ * @param args Argumentos
+ * @return Numero de caracteres que tendria la cadena completa, sin el nulo.
+ */
+int vsnprintf(char * buf, unsigned int size, char * format, va_list args);
+
 #endif /* STDIO_H_ */
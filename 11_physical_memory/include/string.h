@@ -0,0 +1,101 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de las rutinas para copiar, llenar y
+ * comparar bloques de memoria.
+ * @details
+ * Cada rutina escoge su implementacion segun el tamano del bloque y las
+ * capacidades del procesador, detectadas con CPUID en setup_string():
+ * - Bloques pequenos y medianos: rep movsd / rep stosd, con un prologo que
+ *   alinea el destino a 4 bytes.
+ * - Bloques de STRING_SSE_THRESHOLD bytes o mas: registros XMM (16 bytes
+ *   por instruccion), si el procesador soporta SSE2 y el sistema operativo
+ *   lo habilito (CR4.OSFXSR). La copia se encierra entre fpu_begin() y
+ *   fpu_end(), por lo cual tambien se puede usar desde los manejadores de
+ *   interrupcion.
+ * - Bloques de STRING_NONTEMPORAL_THRESHOLD bytes o mas: escrituras
+ *   non-temporal (movnti / movntdq), que no pasan por la cache y por lo
+ *   tanto no desalojan los datos que se estan usando.
+ */
+
+#ifndef STRING_H_
+#define STRING_H_
+
+/** @brief Tamano a partir del cual se usan los registros XMM */
+#define STRING_SSE_THRESHOLD 512
+
+/** @brief Tamano a partir del cual las escrituras no pasan por la cache
+ * (mayor que la cache L2 de un procesador tipico) */
+#define STRING_NONTEMPORAL_THRESHOLD 0x40000
+
+/** @brief Capacidad: el procesador soporta SSE2 (movnti) */
+#define STRING_SSE2 0x1
+
+/** @brief Capacidad: los registros XMM se pueden usar (SSE2 y CR4.OSFXSR) */
+#define STRING_XMM 0x2
+
+/** @brief Capacidades detectadas por setup_string() */
+extern unsigned int string_features;
+
+/**
+ * @brief Detecta las capacidades del procesador que usan las rutinas de
+ * este archivo. Se puede invocar de nuevo si cambia CR4.
+ */
+void setup_string(void);
+
+/**
+ * @brief Copia un bloque de memoria. Los bloques no se deben traslapar.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ * @return dst
+ */
+void * memcpy(void * dst, const void * src, unsigned int n);
+
+/**
+ * @brief Copia un bloque de memoria. Los bloques se pueden traslapar.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ * @return dst
+ */
+void * memmove(void * dst, const void * src, unsigned int n);
+
+/**
+ * @brief Llena un bloque de memoria con un valor.
+ * @param dst Destino
+ * @param c Valor (se usan los 8 bits menos significativos)
+ * @param n Numero de bytes
+ * @return dst
+ */
+void * memset(void * dst, int c, unsigned int n);
+
+/**
+ * @brief Llena un bloque de memoria con un valor de 16 bits (por ejemplo,
+ * celdas de la pantalla).
+ * @param dst Destino
+ * @param value Valor
+ * @param count Numero de valores de 16 bits
+ * @return dst
+ */
+void * memsetw(void * dst, unsigned short value, unsigned int count);
+
+/**
+ * @brief Compara dos bloques de memoria.
+ * @param a Primer bloque
+ * @param b Segundo bloque
+ * @param n Numero de bytes
+ * @return 0 si los bloques son iguales, un valor negativo o positivo segun
+ * el primer byte diferente.
+ */
+int memcmp(const void * a, const void * b, unsigned int n);
+
+/**
+ * @brief Mide el ancho de banda de cada implementacion de memcpy y memset
+ * (ciclos por KB) con bloques de varios tamanos.
+ */
+void string_benchmark(void);
+
+#endif /* STRING_H_ */
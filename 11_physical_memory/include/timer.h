@@ -0,0 +1,141 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene las definiciones de los temporizadores del kernel.
+ * @details
+ * Los temporizadores pendientes se almacenan en una rueda jerarquica
+ * (hierarchical timing wheel) de TIMER_LEVELS niveles de TIMER_SLOTS
+ * casillas. El tiempo se mide en pulsos de 2^TIMER_TICK_SHIFT ns (cerca de
+ * 1 ms), a partir de clock_ns() (ver clock.h):
+ *
+ * @verbatim
+  Nivel 0: una casilla por pulso          (hasta 64 pulsos, ~67 ms)
+  Nivel 1: una casilla por 64 pulsos      (hasta 64^2 pulsos, ~4.3 s)
+  Nivel 2: una casilla por 64^2 pulsos    (hasta 64^3 pulsos, ~4.6 min)
+  Nivel 3: una casilla por 64^3 pulsos    (hasta 64^4 pulsos, ~4.9 h)
+ @endverbatim
+ *
+ * Cada casilla es una lista doblemente enlazada, por lo cual agregar y
+ * cancelar un temporizador toma tiempo constante, sin importar cuantos
+ * temporizadores existan. Cuando la rueda del nivel 0 completa una vuelta,
+ * los temporizadores de la casilla actual del nivel 1 se redistribuyen en
+ * el nivel 0 (cascade), y asi sucesivamente.
+ *
+ * El hardware no interrumpe en cada pulso: solo se programa (en modo one
+ * shot) para el vencimiento mas cercano. Se usa el temporizador del APIC
+ * local si existe, y el canal 0 del PIT en caso contrario. Si no existen
+ * temporizadores pendientes, el hardware no genera interrupciones.
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <asm.h>
+
+/** @brief Logaritmo en base 2 de la duracion de un pulso en ns */
+#define TIMER_TICK_SHIFT 20
+
+/** @brief Logaritmo en base 2 del numero de casillas de cada nivel */
+#define TIMER_SLOT_BITS 6
+
+/** @brief Numero de casillas de cada nivel */
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+/** @brief Mascara para obtener la casilla de un pulso */
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+/** @brief Numero de niveles de la rueda. Los temporizadores que vencen
+ * despues de TIMER_SLOTS^TIMER_LEVELS pulsos se almacenan en la ultima
+ * casilla del ultimo nivel. */
+#define TIMER_LEVELS 4
+
+/** @brief Vector de la IDT del temporizador del APIC local. Se encuentra
+ * por encima de los vectores de las IRQ (ver MAX_IRQ_ROUTINES). */
+#define TIMER_LAPIC_VECTOR 0xF0
+
+/** @brief Pulso que indica que no existen temporizadores pendientes */
+#define TIMER_NONE 0xFFFFFFFFFFFFFFFFULL
+
+/** @brief Tiempo minimo en ns para el cual se programa el hardware */
+#define TIMER_MIN_DELTA 10000
+
+/** @brief Dispositivo: canal 0 del PIT, modo 0 */
+#define TIMER_DEVICE_PIT 1
+
+/** @brief Dispositivo: temporizador del APIC local, modo one shot */
+#define TIMER_DEVICE_LAPIC 2
+
+struct timer;
+
+/** @brief Rutina que se invoca cuando vence un temporizador. Se ejecuta
+ * dentro del manejador de interrupcion (ver in_interrupt()), y puede volver
+ * a agregar el temporizador. */
+typedef void (*timer_function)(struct timer * t, void * arg);
+
+/** @brief Temporizador. Se puede almacenar dentro de otra estructura. */
+typedef struct timer {
+	/** @brief Siguiente temporizador de la casilla */
+	struct timer * next;
+	/** @brief Apuntador al campo que apunta a este temporizador (cabeza de
+	 * la casilla o next del anterior). 0 si no esta pendiente. */
+	struct timer ** pprev;
+	/** @brief Pulso en el cual vence el temporizador */
+	unsigned long long expires;
+	/** @brief Rutina a invocar */
+	timer_function function;
+	/** @brief Parametro de la rutina */
+	void * arg;
+} timer_t;
+
+/** @brief Dispositivo que genera las interrupciones (TIMER_DEVICE_*) */
+extern int timer_device;
+
+/**
+ * @brief Permite saber si un temporizador se encuentra pendiente.
+ * @param t Temporizador
+ * @return 1 si esta pendiente, 0 si no
+ */
+static __inline__ int timer_pending(timer_t * t) {
+	return (t->pprev != 0);
+}
+
+/**
+ * @brief Selecciona el hardware de los temporizadores y lo calibra. Detiene
+ * la interrupcion periodica del PIT que programa setup_clock().
+ * @return 0 si existe un dispositivo, -1 en caso contrario.
+ */
+int setup_timers(void);
+
+/**
+ * @brief Inicializa un temporizador.
+ * @param t Temporizador
+ * @param function Rutina a invocar cuando venza
+ * @param arg Parametro de la rutina
+ */
+void timer_init(timer_t * t, timer_function function, void * arg);
+
+/**
+ * @brief Agrega un temporizador a la rueda. Si ya estaba pendiente, se
+ * cambia su vencimiento.
+ * @param t Temporizador
+ * @param us Microsegundos a partir del instante actual
+ */
+void timer_start(timer_t * t, unsigned int us);
+
+/**
+ * @brief Cancela un temporizador.
+ * @param t Temporizador
+ * @return 1 si el temporizador estaba pendiente, 0 si no
+ */
+int timer_cancel(timer_t * t);
+
+/**
+ * @brief Mide el costo de agregar y cancelar temporizadores con count
+ * temporizadores pendientes.
+ * @param count Numero de temporizadores
+ */
+void timer_benchmark(unsigned int count);
+
+#endif /* TIMER_H_ */
@@ -0,0 +1,133 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de las rutinas para localizar las tablas
+ * ACPI que describen el hardware (RSDP, RSDT y las tablas que esta
+ * referencia).
+ */
+
+#include <acpi.h>
+#include <stdio.h>
+#include <init.h>
+
+/** @brief Apuntador a la RSDT (Root System Description Table), 0 si no se
+ * encontro ACPI */
+acpi_header_t * acpi_rsdt = 0;
+
+/**
+ * @brief Calcula la suma de chequeo de un area de memoria.
+ * @param ptr Inicio del area
+ * @param length Tamano del area en bytes
+ * @return Suma de todos los bytes del area. Para una tabla valida es 0.
+ */
+static unsigned char acpi_checksum(unsigned char * ptr, unsigned int length) {
+	unsigned char sum;
+
+	sum = 0;
+	while (length-- > 0) {
+		sum += *ptr++;
+	}
+	return sum;
+}
+
+/**
+ * @brief Compara n caracteres de dos cadenas.
+ * @return 1 si son iguales, 0 en caso contrario.
+ */
+static int same_signature(char * a, char * b, int n) {
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (a[i] != b[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief Busca el RSDP en un area de memoria. El RSDP se encuentra en un
+ * limite de 16 bytes.
+ * @param start Direccion de inicio del area
+ * @param end Direccion final del area
+ * @return Apuntador al RSDP, 0 si no se encontro.
+ */
+static acpi_rsdp_t * __init find_rsdp(unsigned int start, unsigned int end) {
+	acpi_rsdp_t * rsdp;
+
+	for (; start < end; start += 16) {
+		rsdp = (acpi_rsdp_t *)start;
+		if (same_signature(rsdp->signature, ACPI_RSDP_SIGNATURE, 8) &&
+				acpi_checksum((unsigned char *)rsdp, sizeof(acpi_rsdp_t)) == 0) {
+			return rsdp;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Busca el RSDP y la RSDT de ACPI.
+ * @return 0 si se encontro la RSDT, -1 en caso contrario.
+ * @details
+ * El RSDP se busca en el primer KB del EBDA (cuyo segmento se almacena en la
+ * direccion 0x40E de la BDA) y en el area de la BIOS 0xE0000 - 0xFFFFF.
+ */
+int __init setup_acpi(void) {
+	acpi_rsdp_t * rsdp;
+	unsigned int ebda;
+
+	ebda = (unsigned int)(*(unsigned short *)EBDA_SEGMENT_LOCATION) << 4;
+
+	rsdp = 0;
+	if (ebda != 0) {
+		rsdp = find_rsdp(ebda, ebda + 1024);
+	}
+	if (rsdp == 0) {
+		rsdp = find_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+	}
+	if (rsdp == 0) {
+		return -1;
+	}
+
+	acpi_rsdt = (acpi_header_t *)rsdp->rsdt_address;
+	if (!same_signature(acpi_rsdt->signature, "RSDT", 4) ||
+			acpi_checksum((unsigned char *)acpi_rsdt, acpi_rsdt->length) != 0) {
+		printf("Invalid ACPI RSDT at %x\n", acpi_rsdt);
+		acpi_rsdt = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Busca una tabla ACPI dentro de la RSDT.
+ * @param signature Firma de 4 caracteres de la tabla ("SRAT", "APIC", ...)
+ * @return Apuntador al encabezado de la tabla, 0 si no existe.
+ */
+acpi_header_t * acpi_find_table(char * signature) {
+	unsigned int * entries;
+	unsigned int count;
+	unsigned int i;
+	acpi_header_t * table;
+
+	if (acpi_rsdt == 0) {
+		return 0;
+	}
+
+	/* La RSDT contiene, despues del encabezado, un arreglo de direcciones
+	 * fisicas de 32 bits de las demas tablas */
+	entries = (unsigned int *)((char *)acpi_rsdt + sizeof(acpi_header_t));
+	count = (acpi_rsdt->length - sizeof(acpi_header_t)) / sizeof(unsigned int);
+
+	for (i=0; i<count; i++) {
+		table = (acpi_header_t *)entries[i];
+		if (same_signature(table->signature, signature, 4) &&
+				acpi_checksum((unsigned char *)table, table->length) == 0) {
+			return table;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,259 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de la entrega de IRQ por medio del I/O
+ * APIC y el APIC local.
+ */
+
+#include <apic.h>
+#include <acpi.h>
+#include <idt.h>
+#include <irq.h>
+#include <stdio.h>
+#include <init.h>
+
+/** @brief Vale 1 si las IRQ se entregan por medio del I/O APIC */
+int apic_enabled = 0;
+
+/** @brief I/O APIC encontrados en la MADT */
+io_apic_t io_apics[MAX_IO_APICS];
+
+/** @brief Numero de I/O APIC */
+int io_apic_count = 0;
+
+/** @brief GSI a la cual se conecta cada IRQ */
+static unsigned int irq_gsi[MAX_IRQ_ROUTINES];
+
+/** @brief Bits de polaridad y disparo de la entrada de redireccion de cada
+ * IRQ */
+static unsigned int irq_mode[MAX_IRQ_ROUTINES];
+
+/** @brief Identificador del APIC local del BSP, destino de las IRQ */
+static unsigned int irq_destination;
+
+/**
+ * @brief Lee un registro interno de un I/O APIC.
+ * @param ioapic I/O APIC
+ * @param reg Numero del registro
+ * @return Valor del registro
+ */
+static __inline__ unsigned int ioapic_read(io_apic_t * ioapic,
+		unsigned int reg) {
+	*(volatile unsigned int *)(ioapic->address + IOAPIC_REGSEL) = reg;
+	return *(volatile unsigned int *)(ioapic->address + IOAPIC_WINDOW);
+}
+
+/**
+ * @brief Escribe un registro interno de un I/O APIC.
+ * @param ioapic I/O APIC
+ * @param reg Numero del registro
+ * @param value Valor a escribir
+ */
+static __inline__ void ioapic_write(io_apic_t * ioapic, unsigned int reg,
+		unsigned int value) {
+	*(volatile unsigned int *)(ioapic->address + IOAPIC_REGSEL) = reg;
+	*(volatile unsigned int *)(ioapic->address + IOAPIC_WINDOW) = value;
+}
+
+/**
+ * @brief Busca el I/O APIC que atiende una GSI.
+ * @param gsi Interrupcion global
+ * @return Apuntador al I/O APIC, 0 si ninguno la atiende.
+ */
+static io_apic_t * ioapic_for_gsi(unsigned int gsi) {
+	int i;
+
+	for (i = 0; i < io_apic_count; i++) {
+		if (gsi >= io_apics[i].gsi_base
+				&& gsi < io_apics[i].gsi_base + io_apics[i].pins) {
+			return &io_apics[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Programa la entrada de redireccion de una IRQ.
+ * @param irq Numero de IRQ
+ * @param masked IOAPIC_MASKED o 0
+ */
+static void ioapic_route(int irq, unsigned int masked) {
+	io_apic_t * ioapic;
+	unsigned int reg;
+	unsigned int flags;
+
+	if (irq < 0 || irq >= MAX_IRQ_ROUTINES || irq_gsi[irq] == IOAPIC_NO_GSI) {
+		return;
+	}
+	ioapic = ioapic_for_gsi(irq_gsi[irq]);
+	if (ioapic == 0) {
+		return;
+	}
+
+	/* Entrega fija, destino fisico: el APIC local del BSP */
+	reg = IOAPIC_REDIRECTION + 2 * (irq_gsi[irq] - ioapic->gsi_base);
+	flags = irq_save();
+	ioapic_write(ioapic, reg + 1, irq_destination << 24);
+	ioapic_write(ioapic, reg, (IDT_IRQ_OFFSET + irq) | irq_mode[irq]
+			| masked);
+	irq_restore(flags);
+}
+
+void ioapic_unmask_irq(int irq) {
+	if (apic_enabled) {
+		ioapic_route(irq, 0);
+	}
+}
+
+void ioapic_mask_irq(int irq) {
+	if (apic_enabled) {
+		ioapic_route(irq, IOAPIC_MASKED);
+	}
+}
+
+void lapic_enable(void) {
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, (lapic_read(LAPIC_SVR) & ~0xFF) | LAPIC_SVR_ENABLE
+			| LAPIC_SPURIOUS_VECTOR);
+}
+
+/**
+ * @brief Calcula los bits de polaridad y disparo de una IRQ ISA a partir de
+ * los flags MPS de una redefinicion de la MADT.
+ * @param flags Flags MPS
+ * @return Bits de la entrada de redireccion
+ @verbatim
+  El valor 0 de cada campo indica el valor por defecto del bus ISA: activa
+  en alto y por flanco.
+ @endverbatim*/
+static unsigned int __init isa_irq_mode(unsigned short flags) {
+	unsigned int mode;
+
+	mode = 0;
+	if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) {
+		mode |= IOAPIC_ACTIVE_LOW;
+	}
+	if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) {
+		mode |= IOAPIC_LEVEL;
+	}
+	return mode;
+}
+
+/**
+ * @brief Obtiene la direccion del APIC local, los I/O APIC y las
+ * redefiniciones de IRQ ISA de la MADT.
+ * @return 0 si se encontro al menos un I/O APIC, -1 en caso contrario.
+ @verbatim
+  setup_apic() se ejecuta antes de setup_smp(), por lo cual lapic_base se
+  debe obtener aqui y no solo en smp_find_madt().
+ @endverbatim*/
+static int __init apic_parse_madt(void) {
+	acpi_madt_t * madt;
+	madt_entry_t * entry;
+	madt_io_apic_t * ioapic;
+	madt_interrupt_override_t * override;
+	char * end;
+	int i;
+
+	madt = (acpi_madt_t *)acpi_find_table("APIC");
+	if (madt == 0) {
+		return -1;
+	}
+
+	lapic_base = madt->local_apic_address;
+
+	/* IRQ ISA: identidad, activas en alto y por flanco. Las demas: activas
+	 * en bajo y por nivel. */
+	for (i = 0; i < MAX_IRQ_ROUTINES; i++) {
+		irq_gsi[i] = i;
+		irq_mode[i] = (i < ISA_IRQS) ? 0 : (IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL);
+	}
+
+	entry = (madt_entry_t *)((char *)madt + sizeof(acpi_madt_t));
+	end = (char *)madt + madt->header.length;
+	while ((char *)entry < end && entry->length > 0) {
+		if (entry->type == MADT_IO_APIC && io_apic_count < MAX_IO_APICS) {
+			ioapic = (madt_io_apic_t *)entry;
+			io_apics[io_apic_count].address = ioapic->address;
+			io_apics[io_apic_count].gsi_base = ioapic->gsi_base;
+			io_apics[io_apic_count].pins = 0;
+			io_apic_count++;
+		}else if (entry->type == MADT_INTERRUPT_OVERRIDE) {
+			override = (madt_interrupt_override_t *)entry;
+			if (override->bus == 0 && override->source < ISA_IRQS) {
+				/* La IRQ que tenia la GSI queda sin conectar (por
+				 * ejemplo, la IRQ 2 cuando la IRQ 0 usa la GSI 2, o la
+				 * IRQ 20 cuando la IRQ 9 usa la GSI 20), para que la
+				 * entrada no se programe dos veces */
+				if (override->gsi < MAX_IRQ_ROUTINES
+						&& override->gsi != override->source
+						&& irq_gsi[override->gsi] == override->gsi) {
+					irq_gsi[override->gsi] = IOAPIC_NO_GSI;
+				}
+				irq_gsi[override->source] = override->gsi;
+				irq_mode[override->source] = isa_irq_mode(override->flags);
+			}
+		}
+		entry = (madt_entry_t *)((char *)entry + entry->length);
+	}
+
+	return (io_apic_count > 0) ? 0 : -1;
+}
+
+/**
+ * @brief Manejador de las interrupciones espurias del APIC local. No se
+ * envia EOI.
+ * @param state Estado del procesador
+ */
+static void lapic_spurious_handler(interrupt_state * state) {
+}
+
+int __init setup_apic(void) {
+	extern irq_handler irq_handlers[MAX_IRQ_ROUTINES];
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int pins;
+	int i;
+
+	/* El vector de las interrupciones espurias se usa aunque las IRQ se
+	 * sigan entregando por los PIC (temporizador del APIC local, AP) */
+	install_interrupt_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious_handler);
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_EDX_APIC) || apic_parse_madt() != 0) {
+		printf("IRQs delivered by the 8259 PIC\n");
+		return -1;
+	}
+
+	/* Las direcciones de los I/O APIC se acceden sin paginacion o con
+	 * identity_map() (ver setup_paging()) */
+	pins = 0;
+	for (i = 0; i < io_apic_count; i++) {
+		io_apics[i].pins = ((ioapic_read(&io_apics[i], IOAPIC_VERSION) >> 16)
+				& 0xFF) + 1;
+		pins += io_apics[i].pins;
+	}
+
+	lapic_enable();
+	irq_destination = lapic_read(LAPIC_ID) >> 24;
+
+	/* Enmascarar los PIC y la entrada LINT0 (ExtINT) del APIC local, y
+	 * conectar las IRQ al APIC en lugar de los PIC en los sistemas que tienen
+	 * IMCR */
+	pic_disable();
+	lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+	outb(IMCR_SELECT, 0x70);
+	outb(IMCR_DATA, 0x01);
+
+	/* Las IRQ que ya tienen manejador se habilitan, las demas se
+	 * enmascaran */
+	apic_enabled = 1;
+	for (i = 0; i < MAX_IRQ_ROUTINES; i++) {
+		ioapic_route(i, (irq_handlers[i] != NULL_INTERRUPT_HANDLER) ? 0
+				: IOAPIC_MASKED);
+	}
+
+	printf("IRQs delivered by %d I/O APIC (%u pins)\n", io_apic_count, pins);
+	return 0;
+}
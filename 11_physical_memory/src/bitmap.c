@@ -0,0 +1,513 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion del asignador de memoria basado en un
+ * mapa de bits.
+ */
+
+#include <bitmap.h>
+#include <physmem.h>
+#include <string.h>
+#include <fpu.h>
+#include <stdio.h>
+#include <init.h>
+
+/** @brief Mascaras de bitmap_count_xmm(), alineadas a 16 bytes */
+static const unsigned int popcount_masks[12] __attribute__ ((aligned(16))) = {
+		0x55555555, 0x55555555, 0x55555555, 0x55555555,
+		0x33333333, 0x33333333, 0x33333333, 0x33333333,
+		0x0F0F0F0F, 0x0F0F0F0F, 0x0F0F0F0F, 0x0F0F0F0F
+};
+
+/**
+ * @brief Inicializa un asignador sobre una region de memoria. Todas las
+ * unidades de la region quedan libres.
+ * @param a Asignador
+ * @param start Direccion de inicio de la region, alineada a unit_size
+ * @param length Tamano de la region en bytes
+ * @param unit_size Tamano de la unidad (potencia de 2)
+ * @param bitmap Mapa de bits de bitmap_size(length, unit_size) bytes. Si es
+ * 0, el mapa de bits se toma de la memoria del kernel con
+ * allocate_unit_region().
+ * @return 0 si el asignador se inicializo, -1 en caso contrario.
+ */
+int bitmap_allocator_init(bitmap_allocator_t * a, unsigned int start,
+		unsigned int length, unsigned int unit_size, unsigned int * bitmap) {
+	unsigned int shift;
+	unsigned int units;
+	unsigned int entries;
+
+	/* El tamano de la unidad debe ser una potencia de 2 */
+	if (unit_size == 0 || (unit_size & (unit_size - 1)) != 0 ||
+			(start & (unit_size - 1)) != 0) {
+		return -1;
+	}
+
+	for (shift = 0; (1U << shift) < unit_size; shift++);
+
+	units = length >> shift;
+	if (units == 0) {
+		return -1;
+	}
+
+	entries = bitmap_size(length, unit_size) / BYTES_PER_ENTRY;
+
+	if (bitmap == 0) {
+		bitmap = (unsigned int *)allocate_unit_region(
+				entries * BYTES_PER_ENTRY);
+		if (bitmap == 0) {
+			return -1;
+		}
+	}
+
+	/* Marcar todas las unidades como libres. Los bits de la ultima entrada
+	 * que no corresponden a una unidad quedan en 0 */
+	memset(bitmap, 0xFF, entries * BYTES_PER_ENTRY);
+	if (units % BITS_PER_ENTRY != 0) {
+		bitmap[entries - 1] = (1 << (units % BITS_PER_ENTRY)) - 1;
+	}
+
+	a->bitmap = bitmap;
+	a->base = start;
+	a->unit_size = unit_size;
+	a->unit_shift = shift;
+	a->first_unit = 0;
+	a->total_units = units;
+	a->free_units = units;
+	a->next_free_unit = 0;
+
+	return 0;
+}
+
+/**
+ * @brief Busca y toma count unidades contiguas del mapa de bits, a partir de
+ * un cursor.
+ * @param a Asignador
+ * @param cursor Unidad en la cual inicia la busqueda. Se actualiza con la
+ * unidad siguiente a la region tomada.
+ * @param count Numero de unidades
+ * @return Primera unidad tomada, BITMAP_NO_UNIT si no se encontraron.
+ @verbatim
+  Las entradas del mapa de bits que se encuentran en 0 (32 unidades
+  ocupadas) se saltan sin revisar cada bit. Las unidades de la region se
+  toman una por una con lock btr. Si otro procesador toma una de ellas, se
+  devuelven las que ya se habian tomado y la busqueda continua.
+ @endverbatim*/
+unsigned int bitmap_claim(bitmap_allocator_t * a,
+		volatile unsigned int * cursor, unsigned int count) {
+	unsigned int first;
+	unsigned int end;
+	unsigned int unit;
+	unsigned int next;
+	unsigned int scanned;
+	unsigned int i;
+
+	first = a->first_unit;
+	end = first + a->total_units;
+
+	if (count == 0 || count > a->total_units) {
+		return BITMAP_NO_UNIT;
+	}
+
+	unit = *cursor;
+	if (unit < first || unit >= end) {
+		unit = first;
+	}
+
+	for (scanned = 0; scanned < a->total_units; ) {
+		if (unit >= end) {
+			unit = first;
+		}
+
+		/* Saltar las entradas en las cuales todas las unidades se
+		 * encuentran ocupadas */
+		if (a->bitmap[unit / BITS_PER_ENTRY] == 0) {
+			next = bitmap_find_entry(a->bitmap, unit / BITS_PER_ENTRY,
+					(end + BITS_PER_ENTRY - 1) / BITS_PER_ENTRY) * BITS_PER_ENTRY;
+			if (next > end) {
+				next = end;
+			}
+			scanned += next - unit;
+			unit = next;
+			continue;
+		}
+
+		if (bitmap_test_unit(a, unit) && unit + count <= end) {
+			for (i=unit; i<unit + count && bitmap_test_unit(a, i); i++);
+
+			/* Tomar las unidades de la region */
+			if (i == unit + count) {
+				for (i=unit; i<unit + count && bitmap_clear_unit(a, i); i++);
+
+				if (i == unit + count) {
+					/* Avanzar en la posicion de busqueda de la proxima
+					 * unidad disponible */
+					next = unit + count;
+					if (next >= end) {
+						next = first;
+					}
+					*cursor = next;
+					return unit;
+				}
+
+				/* Otro procesador tomo una unidad de la region: devolver
+				 * las unidades tomadas */
+				while (i > unit) {
+					i--;
+					bitmap_set_unit(a, i);
+				}
+			}
+		}
+		unit++;
+		scanned++;
+	}
+
+	return BITMAP_NO_UNIT;
+}
+
+/**
+ * @brief Marca una unidad como libre e incrementa free_units.
+ * @param a Asignador
+ * @param unit Unidad a liberar
+ * @return 1 si la unidad se libero, 0 si ya se encontraba libre.
+ */
+int bitmap_release(bitmap_allocator_t * a, unsigned int unit) {
+	/* Una unidad liberada dos veces no se cuenta dos veces */
+	if (bitmap_set_unit(a, unit)) {
+		return 0;
+	}
+	atomic_add(&a->free_units, 1);
+	return 1;
+}
+
+/**
+ * @brief Asigna una unidad del asignador.
+ * @param a Asignador
+ * @return Direccion de inicio de la unidad, 0 si no existen unidades libres.
+ */
+char * bitmap_alloc(bitmap_allocator_t * a) {
+	return bitmap_alloc_region(a, a->unit_size);
+}
+
+/**
+ * @brief Asigna una region de unidades contiguas del asignador.
+ * @param a Asignador
+ * @param length Tamano de la region en bytes
+ * @return Direccion de inicio de la region, 0 si no existe una region libre
+ * del tamano solicitado.
+ */
+char * bitmap_alloc_region(bitmap_allocator_t * a, unsigned int length) {
+	unsigned int count;
+	unsigned int unit;
+
+	count = (length + a->unit_size - 1) >> a->unit_shift;
+
+	/* Descontar las unidades antes de buscarlas */
+	if (count == 0 || !atomic_take(&a->free_units, count)) {
+		return 0;
+	}
+
+	unit = bitmap_claim(a, &a->next_free_unit, count);
+	if (unit == BITMAP_NO_UNIT) {
+		atomic_add(&a->free_units, count);
+		return 0;
+	}
+
+	return bitmap_unit_address(a, unit);
+}
+
+/**
+ * @brief Libera una unidad del asignador.
+ * @param a Asignador
+ * @param addr Direccion dentro de la unidad a liberar
+ */
+void bitmap_free(bitmap_allocator_t * a, char * addr) {
+	bitmap_free_region(a, addr, 1);
+}
+
+/**
+ * @brief Libera una region del asignador.
+ * @param a Asignador
+ * @param addr Direccion de inicio de la region
+ * @param length Tamano de la region en bytes
+ */
+void bitmap_free_region(bitmap_allocator_t * a, char * addr,
+		unsigned int length) {
+	unsigned int unit;
+	unsigned int end;
+
+	if ((unsigned int)addr < a->base || length == 0) {
+		return;
+	}
+
+	unit = bitmap_address_unit(a, addr);
+	end = bitmap_address_unit(a, (unsigned int)addr + length - 1) + 1;
+
+	/* Ignorar las unidades que no pertenecen al asignador */
+	if (unit < a->first_unit) {
+		unit = a->first_unit;
+	}
+	if (end > a->first_unit + a->total_units) {
+		end = a->first_unit + a->total_units;
+	}
+	if (unit >= end) {
+		return;
+	}
+
+	/* Almacenar el inicio de la region liberada para una proxima
+	 * asignacion */
+	a->next_free_unit = unit;
+
+	for (; unit < end; unit++) {
+		bitmap_release(a, unit);
+	}
+}
+
+/**
+ * @brief Busca la primera entrada diferente de 0, una entrada a la vez.
+ * @param bitmap Mapa de bits
+ * @param entry Primera entrada a revisar
+ * @param end Entrada siguiente a la ultima a revisar
+ * @return Indice de la entrada, end si todas las entradas son 0.
+ */
+static unsigned int bitmap_find_entry_scalar(const unsigned int * bitmap,
+		unsigned int entry, unsigned int end) {
+	while (entry < end && bitmap[entry] == 0) {
+		entry++;
+	}
+	return entry;
+}
+
+/**
+ * @brief Busca la primera entrada diferente de 0, 128 bits a la vez. El
+ * llamador debe haber invocado fpu_begin().
+ * @param bitmap Mapa de bits
+ * @param entry Primera entrada a revisar
+ * @param end Entrada siguiente a la ultima a revisar
+ * @return Indice de la entrada, end si todas las entradas son 0.
+ @verbatim
+  pcmpeqd compara cada una de las 4 entradas del bloque con 0, y pmovmskb
+  toma el bit mas significativo de cada byte del resultado: si vale 0xFFFF,
+  las 4 entradas son 0 y el bloque se salta. La entrada exacta dentro del
+  bloque (y las entradas que no completan un bloque) se buscan una a una.
+ @endverbatim*/
+static unsigned int __xmm bitmap_find_entry_xmm(const unsigned int * bitmap,
+		unsigned int entry, unsigned int end) {
+	const unsigned int * p;
+	unsigned int blocks;
+
+	p = bitmap + entry;
+	blocks = (end - entry) / 4;
+	if (blocks > 0) {
+		inline_assembly("pxor %%xmm1, %%xmm1\n\t"
+				"1:\n\t"
+				"movdqu (%0), %%xmm0\n\t"
+				"pcmpeqd %%xmm1, %%xmm0\n\t"
+				"pmovmskb %%xmm0, %%eax\n\t"
+				"cmpl $0xFFFF, %%eax\n\t"
+				"jne 2f\n\t"
+				"addl $16, %0\n\t"
+				"decl %1\n\t"
+				"jnz 1b\n\t"
+				"2:"
+				: "+r" (p), "+r" (blocks)
+				: : "eax", "xmm0", "xmm1", "memory", "cc");
+	}
+
+	return bitmap_find_entry_scalar(bitmap, p - bitmap, end);
+}
+
+/**
+ * @brief Busca la primera entrada diferente de 0 (con al menos una unidad
+ * libre) de un mapa de bits.
+ * @param bitmap Mapa de bits
+ * @param entry Primera entrada a revisar
+ * @param end Entrada siguiente a la ultima a revisar
+ * @return Indice de la entrada, end si todas las entradas son 0.
+ */
+unsigned int bitmap_find_entry(const unsigned int * bitmap,
+		unsigned int entry, unsigned int end) {
+	if (entry + BITMAP_SSE_THRESHOLD <= end &&
+			(string_features & STRING_XMM) && fpu_begin()) {
+		entry = bitmap_find_entry_xmm(bitmap, entry, end);
+		fpu_end();
+		return entry;
+	}
+	return bitmap_find_entry_scalar(bitmap, entry, end);
+}
+
+/**
+ * @brief Cuenta los bits en 1 de un mapa de bits, una entrada a la vez.
+ * @param bitmap Mapa de bits
+ * @param entries Numero de entradas
+ * @return Numero de bits en 1
+ @verbatim
+  Cada entrada se cuenta sumando los bits por parejas, luego por grupos de
+  4 y luego por bytes; la multiplicacion suma los 4 bytes en el byte mas
+  significativo.
+ @endverbatim*/
+static unsigned int bitmap_count_scalar(const unsigned int * bitmap,
+		unsigned int entries) {
+	unsigned int count;
+	unsigned int v;
+	unsigned int i;
+
+	count = 0;
+	for (i=0; i<entries; i++) {
+		v = bitmap[i];
+		v = v - ((v >> 1) & 0x55555555);
+		v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+		count += (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+	}
+	return count;
+}
+
+/**
+ * @brief Cuenta los bits en 1 de un mapa de bits, 128 bits a la vez. El
+ * llamador debe haber invocado fpu_begin().
+ * @param bitmap Mapa de bits
+ * @param entries Numero de entradas
+ * @return Numero de bits en 1
+ @verbatim
+  Se aplica el mismo conteo por parejas y por grupos de 4 bits de
+  bitmap_count_scalar() a los 16 bytes del bloque; psadbw suma los bytes
+  de cada mitad del bloque en un acumulador de 64 bits (xmm6).
+ @endverbatim*/
+static unsigned int __xmm bitmap_count_xmm(const unsigned int * bitmap,
+		unsigned int entries) {
+	const unsigned int * p;
+	unsigned int blocks;
+	unsigned int count;
+
+	p = bitmap;
+	blocks = entries / 4;
+	count = 0;
+	if (blocks > 0) {
+		inline_assembly("pxor %%xmm7, %%xmm7\n\t"
+				"pxor %%xmm6, %%xmm6\n\t"
+				"movdqa (%3), %%xmm5\n\t"
+				"movdqa 16(%3), %%xmm4\n\t"
+				"movdqa 32(%3), %%xmm3\n\t"
+				"1:\n\t"
+				"movdqu (%0), %%xmm0\n\t"
+				"movdqa %%xmm0, %%xmm1\n\t"
+				"psrlw $1, %%xmm1\n\t"
+				"pand %%xmm5, %%xmm1\n\t"
+				"psubb %%xmm1, %%xmm0\n\t"
+				"movdqa %%xmm0, %%xmm1\n\t"
+				"psrlw $2, %%xmm1\n\t"
+				"pand %%xmm4, %%xmm0\n\t"
+				"pand %%xmm4, %%xmm1\n\t"
+				"paddb %%xmm1, %%xmm0\n\t"
+				"movdqa %%xmm0, %%xmm1\n\t"
+				"psrlw $4, %%xmm1\n\t"
+				"paddb %%xmm1, %%xmm0\n\t"
+				"pand %%xmm3, %%xmm0\n\t"
+				"psadbw %%xmm7, %%xmm0\n\t"
+				"paddq %%xmm0, %%xmm6\n\t"
+				"addl $16, %0\n\t"
+				"decl %1\n\t"
+				"jnz 1b\n\t"
+				"movdqa %%xmm6, %%xmm0\n\t"
+				"psrldq $8, %%xmm0\n\t"
+				"paddq %%xmm0, %%xmm6\n\t"
+				"movd %%xmm6, %2"
+				: "+r" (p), "+r" (blocks), "=r" (count)
+				: "r" (popcount_masks)
+				: "xmm0", "xmm1", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+				"memory", "cc");
+	}
+
+	return count + bitmap_count_scalar(p, entries % 4);
+}
+
+/**
+ * @brief Cuenta los bits en 1 de un mapa de bits.
+ * @param bitmap Mapa de bits
+ * @param entries Numero de entradas
+ * @return Numero de bits en 1
+ */
+unsigned int bitmap_count(const unsigned int * bitmap, unsigned int entries) {
+	unsigned int count;
+
+	if (entries >= BITMAP_SSE_THRESHOLD &&
+			(string_features & STRING_XMM) && fpu_begin()) {
+		count = bitmap_count_xmm(bitmap, entries);
+		fpu_end();
+		return count;
+	}
+	return bitmap_count_scalar(bitmap, entries);
+}
+
+/**
+ * @brief Cuenta las unidades libres de un asignador recorriendo su mapa de
+ * bits (para estadisticas: free_units es el valor que usan las
+ * asignaciones).
+ * @param a Asignador
+ * @return Numero de unidades libres
+ */
+unsigned int bitmap_count_free(bitmap_allocator_t * a) {
+	return bitmap_count(a->bitmap,
+			(a->first_unit + a->total_units + BITS_PER_ENTRY - 1)
+			/ BITS_PER_ENTRY);
+}
+
+/**
+ * @brief Mide el tiempo de bitmap_find_entry() y bitmap_count(), con y sin
+ * registros XMM, sobre un mapa de bits temporal.
+ * @param entries Numero de entradas del mapa de bits
+ @verbatim
+  La busqueda recorre un mapa en el cual solo la ultima entrada tiene una
+  unidad libre (el peor caso de bitmap_claim()). El conteo recorre el mismo
+  mapa con un patron de bits.
+ @endverbatim*/
+void __init bitmap_benchmark(unsigned int entries) {
+	unsigned int * bitmap;
+	unsigned long long start;
+	unsigned int cycles[4];
+	unsigned int found[2];
+	unsigned int count[2];
+	int xmm;
+
+	bitmap = (unsigned int *)allocate_unit_region(entries * BYTES_PER_ENTRY);
+	if (bitmap == 0) {
+		printf("Bitmap benchmark: not enough memory\n");
+		return;
+	}
+
+	for (xmm = 0; xmm < 2; xmm++) {
+		cycles[2 * xmm] = 0;
+		cycles[2 * xmm + 1] = 0;
+		if (xmm && !((string_features & STRING_XMM) && fpu_begin())) {
+			continue;
+		}
+
+		memset(bitmap, 0, entries * BYTES_PER_ENTRY);
+		bitmap[entries - 1] = 0x80000000;
+		start = rdtsc();
+		found[xmm] = xmm ? bitmap_find_entry_xmm(bitmap, 0, entries)
+				: bitmap_find_entry_scalar(bitmap, 0, entries);
+		cycles[2 * xmm] = (unsigned int)(rdtsc() - start);
+
+		memset(bitmap, 0xA5, entries * BYTES_PER_ENTRY);
+		start = rdtsc();
+		count[xmm] = xmm ? bitmap_count_xmm(bitmap, entries)
+				: bitmap_count_scalar(bitmap, entries);
+		cycles[2 * xmm + 1] = (unsigned int)(rdtsc() - start);
+
+		if (xmm) {
+			fpu_end();
+		}
+	}
+
+	printf("Bitmap scan of %u KB: find %u / %u cycles, count %u / %u cycles"
+			" (scalar / SSE2)\n", entries * BYTES_PER_ENTRY / 1024,
+			cycles[0], cycles[2], cycles[1], cycles[3]);
+	if (cycles[2] != 0 && (found[0] != found[1] || count[0] != count[1])) {
+		printf("Bitmap benchmark: SSE2 results differ!\n");
+	}
+
+	free_region((char *)bitmap, entries * BYTES_PER_ENTRY);
+}
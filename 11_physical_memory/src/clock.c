@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de la fuente de tiempo del kernel.
+ */
+
+#include <clock.h>
+#include <stdio.h>
+#include <init.h>
+
+/** @brief Frecuencia del TSC en kHz (0 si no se ha calibrado) */
+unsigned int tsc_khz = 0;
+
+/** @brief Factor de la conversion de ciclos a nanosegundos */
+unsigned int clock_mult = 0;
+
+/** @brief Valor del TSC al calibrarlo (instante 0 de clock_ns()) */
+unsigned long long clock_start = 0;
+
+/**
+ * @brief Lee el contador del canal 0 del PIT.
+ * @return Valor actual del contador
+ */
+static unsigned int pit_read(void) {
+	unsigned int low;
+
+	outb(PIT_COMMAND, PIT_CHANNEL0_LATCH);
+	low = inb(PIT_CHANNEL0);
+	return low | (inb(PIT_CHANNEL0) << 8);
+}
+
+/**
+ * @brief Programa el canal 0 del PIT y calibra el TSC.
+ * @return 0 si el TSC se calibro, -1 en caso contrario.
+ @verbatim
+  El canal 0 cuenta hacia atras desde PIT_RELOAD, PIT_FREQUENCY veces por
+  segundo, y vuelve a PIT_RELOAD al llegar a 1. Se suman las diferencias
+  entre lecturas consecutivas del contador (teniendo en cuenta la recarga)
+  hasta completar CLOCK_CALIBRATION_TICKS pulsos, y se mide el TSC al
+  inicio y al final:
+
+     tsc_khz = ciclos * PIT_FREQUENCY / (pulsos * 1000)
+
+  Las interrupciones deben estar deshabilitadas durante la calibracion.
+ @endverbatim*/
+int __init setup_clock(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int ticks;
+	unsigned int previous;
+	unsigned int current;
+	unsigned long long start;
+	unsigned long long elapsed;
+
+	outb(PIT_COMMAND, PIT_CHANNEL0_RATE);
+	outb(PIT_CHANNEL0, PIT_RELOAD & 0xFF);
+	outb(PIT_CHANNEL0, PIT_RELOAD >> 8);
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_EDX_TSC)) {
+		printf("TSC not supported\n");
+		return -1;
+	}
+
+	ticks = 0;
+	previous = pit_read();
+	start = rdtsc();
+	while (ticks < CLOCK_CALIBRATION_TICKS) {
+		current = pit_read();
+		if (current <= previous) {
+			ticks += previous - current;
+		}else {
+			ticks += previous + PIT_RELOAD - current;
+		}
+		previous = current;
+	}
+	elapsed = rdtsc() - start;
+
+	elapsed *= PIT_FREQUENCY;
+	divide64(&elapsed, ticks * 1000);
+	tsc_khz = (unsigned int)elapsed;
+	if (tsc_khz == 0) {
+		return -1;
+	}
+
+	elapsed = 1000000ULL << CLOCK_SHIFT;
+	divide64(&elapsed, tsc_khz);
+	clock_mult = (unsigned int)elapsed;
+	clock_start = start;
+
+	printf("TSC: %u.%03u MHz\n", tsc_khz / 1000, tsc_khz % 1000);
+
+	return 0;
+}
+
+/**
+ * @brief Espera activamente el numero de microsegundos especificado.
+ * @param us Microsegundos
+ @verbatim
+  Si el TSC no se ha calibrado, cada lectura del puerto 0x80 toma cerca de
+  un microsegundo.
+ @endverbatim*/
+void udelay(unsigned int us) {
+	unsigned long long end;
+
+	if (tsc_khz == 0) {
+		while (us-- > 0) {
+			inb(0x80);
+		}
+		return;
+	}
+
+	end = (unsigned long long)us * tsc_khz;
+	divide64(&end, 1000);
+	end += rdtsc();
+	while (rdtsc() < end) {
+		cpu_relax();
+	}
+}
@@ -9,6 +9,9 @@
  */
 
 #include <exception.h>
+#include <percpu.h>
+#include <init.h>
+#include <log.h>
 
 /** Estructura de datos para almacenar las rutinas que manejaran las
  * excepciones
@@ -21,7 +24,7 @@ exception_handler exception_handlers[MAX_EXCEPTIONS];
  * estado que recibe como parametro, y de invocar la rutina de manejo de
  * excepcion adecuada, si existe.
  */
-void exception_dispatcher();
+void exception_dispatcher(interrupt_state * state);
 
 /** @brief Excepciones del procesador IA-32 */
 unsigned char *exceptions[] = {
@@ -68,7 +71,7 @@ unsigned char *exceptions[] = {
  * configurado para cada una de ellas mediante la funcin
  * install_exception_handler().
  */
-void setup_exceptions(void) {
+void __init setup_exceptions(void) {
 	int i;
 
 	for (i=0; i<MAX_EXCEPTIONS; i++) {
@@ -90,17 +93,10 @@ void setup_exceptions(void) {
  * contexto actual de interrupcion, y de invocar la rutina de manejo de
  * excepcion adecuada, si existe.
  */
-void exception_dispatcher() {
-	/* Esta variable definida en isr.S contiene el valor del apuntador
-	 * actual al tope de la pila (esp)*/
-	extern unsigned int current_esp;
+void exception_dispatcher(interrupt_state * state) {
 
 	extern void dump_interrupt_state(interrupt_state *);
 
-	interrupt_state * state;
-
-	state = (interrupt_state *)current_esp;
-
 	exception_handler handler;
 
 	/* Buscar la rutina que maneja la excepcion. El numero
@@ -116,6 +112,9 @@ void exception_dispatcher() {
 		 * que no tiene un manejador asociado.*/
 		printf("x86 Exception [%d]: %s. System Halted!\n", state->number,
 				exceptions[state->number]);
+		/* Mostrar los mensajes del kernel que aun no se habian copiado a
+		 * la consola */
+		log_dump();
 		/* Bloquear el kernel cuando ocurre una excepcion que no tiene
 		 * manejador asociado.
 		 * Recuerde que esta rutina se esta ejecutando con las interrupciones
@@ -0,0 +1,233 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de la consola sobre el framebuffer
+ * lineal.
+ */
+
+#include <fbcon.h>
+#include <multiboot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <init.h>
+
+/** @brief Framebuffer de la consola */
+framebuffer_t framebuffer;
+
+/** @brief 1 si la consola escribe en el framebuffer */
+int fb_console_active = 0;
+
+/** @brief Los 16 colores de la consola en el formato de pixel del
+ * framebuffer */
+unsigned int fb_palette[16];
+
+/** @brief Linea del cursor */
+int fb_cursor_line;
+
+/** @brief Columna del cursor */
+int fb_cursor_column;
+
+/** @brief Colores RGB de la paleta de modo texto de la VGA */
+static const unsigned int vga_colors[16] = {
+	0x000000, 0x0000AA, 0x00AA00, 0x00AAAA,
+	0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+	0x555555, 0x5555FF, 0x55FF55, 0x55FFFF,
+	0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+/**
+ * @brief Convierte una componente de color de 8 bits al campo de un pixel.
+ * @param value Componente (0 - 255)
+ * @param size Tamano del campo en bits
+ * @param position Posicion del campo en el pixel
+ */
+static unsigned int color_field(unsigned int value, unsigned int size,
+		unsigned int position) {
+	if (size == 0 || size > 8) {
+		return 0;
+	}
+	return (value >> (8 - size)) << position;
+}
+
+/**
+ * @brief Busca la informacion del modo grafico en la estructura multiboot
+ * y, si el modo es soportado, pasa la consola al framebuffer.
+ * @return 0 si la consola usa el framebuffer, -1 si sigue en modo texto.
+ @verbatim
+  Se usan los campos framebuffer_* (flags[12]) si existen, y en caso
+  contrario el bloque de informacion del modo VBE (flags[11]). Solo se
+  soportan modos de color directo de 16, 24 o 32 bits por pixel.
+ @endverbatim*/
+int __init setup_fb_console(void) {
+	extern unsigned int multiboot_info_location;
+	multiboot_info_t * info = (multiboot_info_t *)multiboot_info_location;
+	vbe_mode_info_t * mode;
+	unsigned int rsize, rpos, gsize, gpos, bsize, bpos;
+	unsigned int bpp;
+	int i;
+
+	if (test_bit(info->flags, MULTIBOOT_INFO_FRAMEBUFFER)) {
+		if (info->framebuffer_type != MULTIBOOT_FRAMEBUFFER_RGB ||
+				info->framebuffer_addr_high != 0) {
+			return -1;
+		}
+		framebuffer.address = info->framebuffer_addr_low;
+		framebuffer.pitch = info->framebuffer_pitch;
+		framebuffer.width = info->framebuffer_width;
+		framebuffer.height = info->framebuffer_height;
+		bpp = info->framebuffer_bpp;
+		rsize = info->framebuffer_red_mask_size;
+		rpos = info->framebuffer_red_field_position;
+		gsize = info->framebuffer_green_mask_size;
+		gpos = info->framebuffer_green_field_position;
+		bsize = info->framebuffer_blue_mask_size;
+		bpos = info->framebuffer_blue_field_position;
+	}else if (test_bit(info->flags, MULTIBOOT_INFO_VBE) &&
+			info->vbe_mode_info != 0) {
+		mode = (vbe_mode_info_t *)info->vbe_mode_info;
+		/* Bit 7: framebuffer lineal. Modelo 6: color directo */
+		if (!(mode->mode_attributes & 0x80) || mode->memory_model != 6) {
+			return -1;
+		}
+		framebuffer.address = mode->phys_base;
+		framebuffer.pitch = mode->bytes_per_scan_line;
+		framebuffer.width = mode->x_resolution;
+		framebuffer.height = mode->y_resolution;
+		bpp = mode->bits_per_pixel;
+		rsize = mode->red_mask_size;
+		rpos = mode->red_field_position;
+		gsize = mode->green_mask_size;
+		gpos = mode->green_field_position;
+		bsize = mode->blue_mask_size;
+		bpos = mode->blue_field_position;
+	}else {
+		return -1;
+	}
+
+	if (framebuffer.address == 0 || (bpp != 16 && bpp != 24 && bpp != 32)) {
+		return -1;
+	}
+
+	framebuffer.bytes_per_pixel = bpp / 8;
+	framebuffer.size = framebuffer.pitch * framebuffer.height;
+	framebuffer.columns = framebuffer.width / FB_FONT_WIDTH;
+	framebuffer.lines = framebuffer.height / FB_FONT_HEIGHT;
+	if (framebuffer.columns > MAX_SCREEN_COLUMNS) {
+		framebuffer.columns = MAX_SCREEN_COLUMNS;
+	}
+	if (framebuffer.lines > MAX_SCREEN_LINES) {
+		framebuffer.lines = MAX_SCREEN_LINES;
+	}
+	if (framebuffer.columns == 0 || framebuffer.lines == 0) {
+		return -1;
+	}
+
+	for (i=0; i<16; i++) {
+		fb_palette[i] = color_field(vga_colors[i] >> 16, rsize, rpos)
+				| color_field((vga_colors[i] >> 8) & 0xFF, gsize, gpos)
+				| color_field(vga_colors[i] & 0xFF, bsize, bpos);
+	}
+
+	/* A partir de este punto flush_screen() dibuja en el framebuffer */
+	screen_lines = framebuffer.lines;
+	screen_columns = framebuffer.columns;
+	fb_console_active = 1;
+
+	return 0;
+}
+
+/**
+ * @brief Mueve el cursor de la consola grafica. Las celdas en la posicion
+ * anterior y en la nueva posicion se marcan como modificadas.
+ * @param line Linea
+ * @param column Columna
+ */
+void fb_set_cursor(int line, int column) {
+	if (line == fb_cursor_line && column == fb_cursor_column) {
+		return;
+	}
+	if (fb_cursor_column < framebuffer.columns) {
+		mark_dirty(fb_cursor_line, fb_cursor_column);
+	}
+	fb_cursor_line = line;
+	fb_cursor_column = column;
+	if (column < framebuffer.columns) {
+		mark_dirty(line, column);
+	}
+}
+
+/**
+ * @brief Dibuja un rango de celdas de screen_cells en el framebuffer.
+ * @param line Linea
+ * @param first Primera columna
+ * @param last Ultima columna
+ @verbatim
+  Se recorren las FB_FONT_HEIGHT filas de pixeles de la linea, y en cada
+  fila se escriben los glifos de todo el rango, de izquierda a derecha. De
+  esta forma cada fila del framebuffer se escribe en forma secuencial.
+ @endverbatim*/
+void fb_render(int line, int first, int last) {
+	unsigned short * cells;
+	unsigned char * row;
+	unsigned char * dst;
+	const unsigned char * glyph;
+	unsigned int fg;
+	unsigned int bg;
+	unsigned int bits;
+	unsigned int cell;
+	unsigned char c;
+	int y;
+	int column;
+	int b;
+
+	cells = screen_cells + line * framebuffer.columns;
+	row = (unsigned char *)framebuffer.address
+			+ line * FB_FONT_HEIGHT * framebuffer.pitch
+			+ first * FB_FONT_WIDTH * framebuffer.bytes_per_pixel;
+
+	for (y=0; y<FB_FONT_HEIGHT; y++, row += framebuffer.pitch) {
+		dst = row;
+		for (column = first; column <= last; column++) {
+			cell = cells[column];
+			c = cell & 0xFF;
+			fg = fb_palette[(cell >> 8) & 0x0F];
+			bg = fb_palette[(cell >> 12) & 0x0F];
+
+			if (c < FONT_FIRST_CHAR || c > FONT_LAST_CHAR) {
+				c = ' ';
+			}
+			glyph = font8x8[c - FONT_FIRST_CHAR];
+			bits = glyph[y >> 1];
+
+			/* Cursor: dos ultimas filas de la celda */
+			if (y >= FB_FONT_HEIGHT - 2 && line == fb_cursor_line &&
+					column == fb_cursor_column) {
+				bits = 0xFF;
+			}
+
+			switch (framebuffer.bytes_per_pixel) {
+			case 4:
+				for (b=0; b<FB_FONT_WIDTH; b++) {
+					((unsigned int *)dst)[b] = (bits & (1 << b)) ? fg : bg;
+				}
+				break;
+			case 2:
+				for (b=0; b<FB_FONT_WIDTH; b++) {
+					((unsigned short *)dst)[b] = (bits & (1 << b)) ? fg : bg;
+				}
+				break;
+			default:
+				for (b=0; b<FB_FONT_WIDTH; b++) {
+					cell = (bits & (1 << b)) ? fg : bg;
+					dst[b * 3] = cell;
+					dst[b * 3 + 1] = cell >> 8;
+					dst[b * 3 + 2] = cell >> 16;
+				}
+				break;
+			}
+			dst += FB_FONT_WIDTH * framebuffer.bytes_per_pixel;
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de las rutinas para habilitar SSE y
+ * guardar el estado de los registros XMM.
+ */
+
+#include <fpu.h>
+#include <asm.h>
+#include <percpu.h>
+
+/** @brief Vale 1 si setup_fpu() habilito SSE. Todos los procesadores
+ * deben soportarlo, dado que son del mismo modelo. */
+int fpu_enabled = 0;
+
+/**
+ * @brief Habilita la FPU y SSE en el procesador actual. Se debe invocar en
+ * cada procesador, antes de usar fpu_begin().
+ * @return 0 si SSE quedo habilitado, -1 si el procesador no lo soporta.
+ @verbatim
+  - CR0.EM = 0: las instrucciones de la FPU y SSE se ejecutan.
+  - CR0.MP = 1, CR0.TS = 0: wait / fwait no generan \#NM.
+  - CR4.OSFXSR = 1: FXSAVE / FXRSTOR guardan los registros XMM, y las
+    instrucciones SSE quedan habilitadas.
+  - CR4.OSXMMEXCPT = 1: los errores SIMD no enmascarados se reportan con
+    la excepcion 19 en lugar de \#UD.
+ @endverbatim*/
+int setup_fpu(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int mxcsr;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_EDX_FXSR) || !(edx & CPUID_EDX_SSE)) {
+		return -1;
+	}
+
+	write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+	write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+	mxcsr = MXCSR_DEFAULT;
+	inline_assembly("fninit\n\t"
+			"ldmxcsr %0" : : "m" (mxcsr));
+
+	this_cpu_write(fpu_depth, 0);
+	fpu_enabled = 1;
+
+	return 0;
+}
+
+/**
+ * @brief Inicia una seccion de codigo que usa los registros XMM.
+ * @return 1 si la seccion puede usar los registros XMM, 0 si no (SSE no se
+ * encuentra habilitado, o se agotaron las areas de FXSAVE del procesador).
+ * Solo si retorna 1 se debe invocar fpu_end().
+ @verbatim
+  Si fpu_depth es mayor que 0, esta rutina interrumpio a otra seccion que
+  usa los registros XMM: su estado se guarda en fpu_area[fpu_depth - 1].
+  Si una interrupcion llega entre la lectura y la escritura de fpu_depth,
+  su propia seccion guarda y restaura los registros, por lo cual el estado
+  que se guarda aqui no cambia.
+ @endverbatim*/
+int fpu_begin(void) {
+	percpu_t * self;
+	int depth;
+
+	if (!fpu_enabled) {
+		return 0;
+	}
+
+	self = this_cpu_ptr();
+	depth = self->fpu_depth;
+	if (depth > PERCPU_FPU_AREAS) {
+		return 0;
+	}
+	if (depth > 0) {
+		inline_assembly("fxsave %0" : "=m" (self->fpu_area[depth - 1])
+				: : "memory");
+	}
+	self->fpu_depth = depth + 1;
+
+	return 1;
+}
+
+/**
+ * @brief Termina una seccion iniciada por fpu_begin(). Si la seccion
+ * interrumpio a otra, restaura sus registros XMM.
+ */
+void fpu_end(void) {
+	percpu_t * self;
+	int depth;
+
+	self = this_cpu_ptr();
+	depth = self->fpu_depth;
+	if (depth > 1) {
+		inline_assembly("fxrstor %0" : : "m" (self->fpu_area[depth - 2])
+				: "memory");
+	}
+	self->fpu_depth = depth - 1;
+}
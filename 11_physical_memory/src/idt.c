@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <asm.h>
 #include <pm.h>
+#include <percpu.h>
+#include <init.h>
 
 /** @brief Tabla de descriptores de interrupcin (IDT) */
 idt_descriptor idt[MAX_IDT_ENTRIES] __attribute__((aligned(8)));
@@ -83,7 +85,7 @@ extern unsigned short kernel_code_selector;
 /**
  * @brief Esta rutina se encarga de cargar la IDT.
  */
-void setup_idt(void) {
+void __init setup_idt(void) {
 
 	int i;
 
@@ -134,16 +136,11 @@ void uninstall_interrupt_handler(unsigned char index) {
  * Su trabajo consiste en determinar el vector de interrupcin a partir del
  * estado que recibe como parametro, y de invocar la rutina de manejo de
  * interrupcin adecuada, si existe.
+ * interrupt_entry (isr.S) invoca directamente los manejadores instalados,
+ * por lo cual esta rutina solo recibe el control de los vectores sin
+ * manejador y de isr_reference.
  */
-void interrupt_dispatcher() {
-
-	/* Esta variable definida en isr.S contiene el valor del apuntador
-	 * actual al tope de la pila (esp)*/
-	extern unsigned int current_esp;
-
-	interrupt_state * state;
-
-	state = (interrupt_state *)current_esp;
+void interrupt_dispatcher(interrupt_state * state) {
 
 	interrupt_handler handler;
 
@@ -163,6 +160,7 @@ void interrupt_dispatcher() {
 		}
 		/* Mostrar el estado de la interrupcion. */
 		dump_interrupt_state(state);
+		flush_screen();
 
 		/* Bloquear el kernel cuando ocurre una excepcion o una
 		 * interrupcion que no tiene manejador asociado.
@@ -173,3 +171,76 @@ void interrupt_dispatcher() {
 			;
 	}
 }
+
+/** @brief Ruta de entrada de referencia (isr.S) */
+extern void isr_reference(void);
+
+/** @brief Valor del TSC al entrar al manejador de interrupt_benchmark() */
+static volatile unsigned long long benchmark_tsc;
+
+/**
+ * @brief Manejador de los vectores de interrupt_benchmark().
+ * @param state Estado del procesador
+ */
+static void benchmark_handler(interrupt_state * state) {
+	benchmark_tsc = rdtsc();
+}
+
+/**
+ * @brief Genera una interrupcion por software y mide sus dos mitades.
+ * @param vector INTERRUPT_BENCHMARK_VECTOR o INTERRUPT_REFERENCE_VECTOR
+ * @param entry Minimo de ciclos desde int hasta el manejador
+ * @param exit Minimo de ciclos desde el manejador hasta el retorno
+ */
+static void benchmark_vector(int vector, unsigned int * entry,
+		unsigned int * exit) {
+	unsigned long long start;
+	unsigned long long end;
+
+	start = rdtsc();
+	if (vector == INTERRUPT_BENCHMARK_VECTOR) {
+		inline_assembly("int %0" : : "i"(INTERRUPT_BENCHMARK_VECTOR)
+				: "memory");
+	}else {
+		inline_assembly("int %0" : : "i"(INTERRUPT_REFERENCE_VECTOR)
+				: "memory");
+	}
+	end = rdtsc();
+
+	if ((unsigned int)(benchmark_tsc - start) < *entry) {
+		*entry = (unsigned int)(benchmark_tsc - start);
+	}
+	if ((unsigned int)(end - benchmark_tsc) < *exit) {
+		*exit = (unsigned int)(end - benchmark_tsc);
+	}
+}
+
+void __init interrupt_benchmark(unsigned int iterations) {
+	unsigned int direct_entry, direct_exit;
+	unsigned int reference_entry, reference_exit;
+	unsigned int i;
+
+	install_interrupt_handler(INTERRUPT_BENCHMARK_VECTOR, benchmark_handler);
+	install_interrupt_handler(INTERRUPT_REFERENCE_VECTOR, benchmark_handler);
+	idt[INTERRUPT_REFERENCE_VECTOR] = idt_descriptor_32(kernel_code_selector,
+			(unsigned int)isr_reference, RING0_DPL, INTERRUPT_GATE_TYPE);
+
+	direct_entry = direct_exit = 0xFFFFFFFF;
+	reference_entry = reference_exit = 0xFFFFFFFF;
+	for (i = 0; i < iterations; i++) {
+		benchmark_vector(INTERRUPT_REFERENCE_VECTOR, &reference_entry,
+				&reference_exit);
+		benchmark_vector(INTERRUPT_BENCHMARK_VECTOR, &direct_entry,
+				&direct_exit);
+	}
+
+	idt[INTERRUPT_REFERENCE_VECTOR] = idt_descriptor_32(kernel_code_selector,
+			isr_table[INTERRUPT_REFERENCE_VECTOR], RING0_DPL,
+			INTERRUPT_GATE_TYPE);
+	uninstall_interrupt_handler(INTERRUPT_BENCHMARK_VECTOR);
+	uninstall_interrupt_handler(INTERRUPT_REFERENCE_VECTOR);
+
+	printf("Interrupt entry to handler: %u / %u cycles, handler to iret: "
+			"%u / %u cycles (reference / direct)\n", reference_entry,
+			direct_entry, reference_exit, direct_exit);
+}
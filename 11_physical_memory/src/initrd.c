@@ -0,0 +1,165 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion del initrd: la tabla de archivos que
+ * apunta a los modulos cargados por GRUB.
+ */
+
+#include <initrd.h>
+#include <multiboot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <init.h>
+
+/** @brief Archivos del initrd */
+initrd_file_t initrd_files[MAX_INITRD_FILES];
+
+/** @brief Numero de archivos en initrd_files */
+int initrd_file_count;
+
+/**
+ * @brief Compara dos cadenas terminadas en nulo.
+ * @return 1 si son iguales, 0 en caso contrario.
+ */
+static int same_name(const char * a, const char * b) {
+	while (*a != 0 && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+/**
+ * @brief Agrega un archivo a la tabla.
+ * @param name Nombre del archivo. Se copian hasta length caracteres.
+ * @param length Numero maximo de caracteres del nombre
+ * @param data Datos del archivo
+ * @param size Tamano del archivo en bytes
+ */
+static void __init add_file(const char * name, unsigned int length,
+		const char * data, unsigned int size) {
+	initrd_file_t * file;
+	unsigned int i;
+
+	if (initrd_file_count == MAX_INITRD_FILES) {
+		printf("initrd: too many files, %s ignored\n", name);
+		return;
+	}
+
+	file = &initrd_files[initrd_file_count++];
+
+	if (length > INITRD_NAME_LENGTH - 1) {
+		length = INITRD_NAME_LENGTH - 1;
+	}
+	for (i=0; i<length && name[i] != 0; i++) {
+		file->name[i] = name[i];
+	}
+	file->name[i] = 0;
+
+	file->data = data;
+	file->size = size;
+}
+
+/**
+ * @brief Agrega a la tabla las entradas de un archivo empaquetado.
+ * @param start Inicio del modulo
+ * @param size Tamano del modulo en bytes
+ @verbatim
+  Las entradas cuyo rango de datos no se encuentra dentro del modulo se
+  ignoran.
+ @endverbatim*/
+static void __init add_archive(const char * start, unsigned int size) {
+	initrd_header_t * header;
+	initrd_entry_t * entry;
+	unsigned int i;
+
+	header = (initrd_header_t *)start;
+
+	if (header->count > (size - sizeof(initrd_header_t))
+			/ sizeof(initrd_entry_t)) {
+		printf("initrd: invalid archive at %x\n", start);
+		return;
+	}
+
+	entry = (initrd_entry_t *)(start + sizeof(initrd_header_t));
+	for (i=0; i<header->count; i++, entry++) {
+		if (entry->offset > size || entry->size > size - entry->offset) {
+			continue;
+		}
+		add_file(entry->name, INITRD_NAME_LENGTH, start + entry->offset,
+				entry->size);
+	}
+}
+
+/**
+ * @brief Construye la tabla de archivos a partir de los modulos cargados por
+ * GRUB.
+ * @return Numero de archivos encontrados.
+ @verbatim
+  El nombre de un modulo es la primera palabra de su linea de comandos, sin
+  los directorios: "/boot/config.txt debug" -> "config.txt".
+ @endverbatim*/
+int __init setup_initrd(void) {
+	extern unsigned int multiboot_info_location;
+	multiboot_info_t * info = (multiboot_info_t *)multiboot_info_location;
+	mod_info_t * mod_info;
+	unsigned int i;
+	unsigned int size;
+	char * name;
+	char * end;
+
+	initrd_file_count = 0;
+
+	if (!test_bit(info->flags, 3)) {
+		return 0;
+	}
+
+	for (mod_info = (mod_info_t*)info->mods_addr, i=0; i<info->mods_count;
+			i++, mod_info++) {
+		size = mod_info->mod_end - mod_info->mod_start;
+
+		if (size >= sizeof(initrd_header_t) &&
+				((initrd_header_t *)mod_info->mod_start)->magic ==
+						INITRD_MAGIC) {
+			add_archive((char *)mod_info->mod_start, size);
+			continue;
+		}
+
+		/* Tomar el nombre sin directorios de la primera palabra */
+		name = mod_info->string;
+		if (name == 0) {
+			name = "";
+		}
+		for (end = name; *end != 0 && *end != ' '; end++) {
+			if (*end == '/') {
+				name = end + 1;
+			}
+		}
+		add_file(name, end - name, (char *)mod_info->mod_start, size);
+	}
+
+	for (i=0; i<initrd_file_count; i++) {
+		printf("initrd: %s (%u bytes)\n", initrd_files[i].name,
+				initrd_files[i].size);
+	}
+
+	return initrd_file_count;
+}
+
+/**
+ * @brief Busca un archivo del initrd por su nombre.
+ * @param name Nombre del archivo
+ * @return Apuntador al archivo, 0 si no existe.
+ */
+initrd_file_t * initrd_find(char * name) {
+	int i;
+
+	for (i=0; i<initrd_file_count; i++) {
+		if (same_name(initrd_files[i].name, name)) {
+			return &initrd_files[i];
+		}
+	}
+	return 0;
+}
@@ -11,25 +11,34 @@
 
 #include <idt.h>
 #include <irq.h>
+#include <apic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <init.h>
 
 /** @brief Arreglo que contiene los apuntadores a las rutinas de manejo de
  * interrupcin
  */
 irq_handler irq_handlers[MAX_IRQ_ROUTINES];
 
-/**
- * @brief Esta rutina recibe el control de la rutina de manejo de
- * interrupcion y canaliza esta solicitud a la rutina de manejo de IRQ
- * correspondiente, si se encuentra definida.
- * Dentro de la estructura de datos que recibe, se puede obtener el numero
- * de la interrupcion que ocurrio, asi como el estado del procesador.
- * Con el numero de la interrupcion y restando IDT_IRQ_OFFSET se puede
- * obtener el numero de IRQ.
- * @param state Apuntador al estado del procesador cuando ocurre la IRQ
- */
-void irq_dispatcher(interrupt_state * state);
+/** @brief Numero de IRQ espurias que se descartaron */
+volatile int spurious_irqs = 0;
+
+/** @brief Copia del IMR (Interrupt Mask Register) de los PIC: bits 0..7 del
+ * maestro, 8..15 del esclavo, 1 = linea enmascarada. Solo se escriben en
+ * los puertos los bytes que cambian. */
+static unsigned short pic_imr;
+
+/** @brief IRQ deshabilitadas con irq_disable() */
+static volatile unsigned int irq_disabled[MAX_IRQ_ROUTINES / 32];
+
+/** @brief IRQ que ocurrieron mientras estaban deshabilitadas */
+static volatile unsigned int irq_pending[MAX_IRQ_ROUTINES / 32];
+
+/** @brief Protege pic_imr y las mascaras del hardware. Se toma con las
+ * interrupciones deshabilitadas. */
+static volatile unsigned int irq_mask_lock;
 
 /**
  * @brief Funcin que se encarga de re-mapear las IRQ 0x8 a 0xF.
@@ -43,7 +52,115 @@ void irq_remap(void);
 
 /* Implementacin de las rutinas */
 
-void irq_remap(void) {
+/**
+ * @brief Deshabilita las interrupciones y toma irq_mask_lock.
+ * @return Valor de EFLAGS para irq_mask_lock_release()
+ */
+static __inline__ unsigned int irq_mask_lock_acquire(void) {
+	unsigned int flags;
+
+	flags = irq_save();
+	while (atomic_cmpxchg(&irq_mask_lock, 0, 1) != 0) {
+		cpu_relax();
+	}
+	return flags;
+}
+
+/**
+ * @brief Libera irq_mask_lock y restaura las interrupciones.
+ * @param flags Valor retornado por irq_mask_lock_acquire()
+ */
+static __inline__ void irq_mask_lock_release(unsigned int flags) {
+	inline_assembly("" : : : "memory");
+	irq_mask_lock = 0;
+	irq_restore(flags);
+}
+
+/**
+ * @brief Escribe el IMR de los PIC, omitiendo los bytes que no cambian. La
+ * linea del esclavo en el maestro se habilita solo si alguna linea del
+ * esclavo esta habilitada. Se invoca con irq_mask_lock tomado.
+ * @param imr Nuevo valor del IMR
+ */
+static void pic_write_imr(unsigned short imr) {
+	if ((imr & 0xFF00) != 0xFF00) {
+		imr &= ~(1 << PIC_CASCADE_IRQ);
+	}else {
+		imr |= (1 << PIC_CASCADE_IRQ);
+	}
+	if ((imr & 0xFF) != (pic_imr & 0xFF)) {
+		outb(MASTER_PIC_DATA_PORT, imr & 0xFF);
+	}
+	if ((imr >> 8) != (pic_imr >> 8)) {
+		outb(SLAVE_PIC_DATA_PORT, imr >> 8);
+	}
+	pic_imr = imr;
+}
+
+/**
+ * @brief Enmascara la linea de una IRQ en el I/O APIC o en los PIC.
+ * @param number Numero de IRQ
+ */
+static void irq_mask_line(int number) {
+	unsigned int flags;
+
+	flags = irq_mask_lock_acquire();
+	if (apic_enabled) {
+		ioapic_mask_irq(number);
+	}else if (number < 16) {
+		pic_write_imr(pic_imr | (1 << number));
+	}
+	irq_mask_lock_release(flags);
+}
+
+/**
+ * @brief Habilita la linea de una IRQ en el I/O APIC o en los PIC.
+ * @param number Numero de IRQ
+ */
+static void irq_unmask_line(int number) {
+	unsigned int flags;
+
+	flags = irq_mask_lock_acquire();
+	if (apic_enabled) {
+		ioapic_unmask_irq(number);
+	}else if (number < 16) {
+		pic_write_imr(pic_imr & ~(1 << number));
+	}
+	irq_mask_lock_release(flags);
+}
+
+void pic_disable(void) {
+	unsigned int flags;
+
+	flags = irq_mask_lock_acquire();
+	pic_write_imr(0xFFFF);
+	irq_mask_lock_release(flags);
+}
+
+/**
+ * @brief Verifica si una IRQ7 o IRQ15 es espuria. El PIC genera el vector de
+ * su ultima linea cuando la solicitud desaparece antes del ciclo INTA; en
+ * ese caso el bit de la linea no esta en el ISR.
+ * @param index IRQ 7 o 15
+ * @return 1 si la IRQ es espuria y se debe descartar sin EOI, 0 si no.
+ @verbatim
+  Una IRQ15 espuria si paso por la linea 2 del maestro, por lo cual el
+  maestro si recibe el EOI.
+ @endverbatim*/
+static __inline__ int pic_spurious(int index) {
+	if (index == 7) {
+		outb(MASTER_PIC_COMMAND_PORT, PIC_READ_ISR);
+		return !(inb(MASTER_PIC_COMMAND_PORT) & 0x80);
+	}
+	outb(SLAVE_PIC_COMMAND_PORT, PIC_READ_ISR);
+	if (inb(SLAVE_PIC_COMMAND_PORT) & 0x80) {
+		return 0;
+	}
+	outb(MASTER_PIC_COMMAND_PORT, EOI);
+	return 1;
+}
+
+void __init irq_remap(void) {
 	/** Reprogramacin del PIC  */
 
 	/** Initialization Command Word 1 - ICW1
@@ -109,21 +226,50 @@ void irq_remap(void) {
 	outb(MASTER_PIC_DATA_PORT, 0x01);
 	outb(SLAVE_PIC_DATA_PORT, 0x01);
 
+	/* Enmascarar todas las lineas: install_irq_handler() habilita la linea
+	 * de cada IRQ que tiene manejador. Luego de la inicializacion el IMR
+	 * es 0, por lo cual la copia se inicializa con ese valor. */
+	pic_imr = 0;
+	pic_write_imr(0xFFFF);
+
 	/** Se han mapeado las IRQ!.
 	 * Las IRQ 0-7 seran atendidas por el PIC maestro, y las IRQ 8-15
 	 * por el PIC esclavo. Las IRQ0-15 estaran mapeadas en la IDT a partir
 	 * de la entrada 32 hasta la 47.*/
 }
 
+/**
+ * @brief Actualiza la entrada de interrupt_handlers del vector de una IRQ.
+ * @param number Numero de IRQ
+ @verbatim
+  Si la IRQ tiene manejador y no se encuentra deshabilitada, el manejador
+  se instala directamente en el vector: interrupt_entry (isr.S) incrementa
+  irq_nesting, lo invoca y envia el EOI. En caso contrario el vector pasa
+  por irq_dispatcher(), que implementa la deshabilitacion perezosa. Las
+  IRQ 7 y 15 siempre pasan por irq_dispatcher(), que descarta las IRQ
+  espurias de los PIC.
+ @endverbatim*/
+static void irq_update_vector(int number) {
+	extern interrupt_handler interrupt_handlers[MAX_IDT_ENTRIES];
+	irq_handler handler;
+
+	handler = irq_handlers[number];
+	if (handler == NULL_INTERRUPT_HANDLER || number == 7 || number == 15
+			|| (irq_disabled[number / 32] & (1 << (number % 32)))) {
+		handler = irq_dispatcher;
+	}
+	interrupt_handlers[IDT_IRQ_OFFSET + number] = handler;
+}
+
 /**
  * @brief Esta rutina se encarga de crear los manejadores de
  * interrupcion para las 16 IRQ en los procesadores x86. Estas IRQ
  * se re-mapean a las interrupciones con vector 32 .. 47.
- * Todas ellas son manejadas por la rutina 'irq_dispatcher', que se encarga
- * de invocar la rutina de manejo de IRQ correspondiente, si se encuentra
- * definida.
+ * Mientras no tienen manejador, todas ellas son manejadas por la rutina
+ * 'irq_dispatcher'. install_irq_handler() instala el manejador directamente
+ * en el vector (ver irq_update_vector()).
  */
-void setup_irq(void) {
+void __init setup_irq(void) {
 	int i;
 
 	for (i=0; i<MAX_IRQ_ROUTINES;i++) {
@@ -134,8 +280,9 @@ void setup_irq(void) {
 		irq_remap();
 
 	/* Ahora configurar el manejador para las interrupciones re-mapeadas
-	 * (32..47)
-	 * Todas estas interrupciones son manejadas por la rutina irq_dispatcher */
+	 * (32..47), y para las IRQ 16.. que entrega el I/O APIC (48..)
+	 * Mientras no tienen manejador, son manejadas por la rutina
+	 * irq_dispatcher */
 
 	for (i=0; i<MAX_IRQ_ROUTINES; i++) {
 		install_interrupt_handler(i + IDT_IRQ_OFFSET, irq_dispatcher);
@@ -150,10 +297,14 @@ void setup_irq(void) {
 void install_irq_handler(int number, irq_handler handler){
 	/* Simplemente sobre-escribir la rutina anterior, si existe.
 	 * */
-	if (number > MAX_IRQ_ROUTINES) {
+	if (number < 0 || number >= MAX_IRQ_ROUTINES) {
 		return;
 	}
 	irq_handlers[number] = handler;
+	irq_update_vector(number);
+
+	/* La linea de la IRQ solo se habilita mientras tiene manejador */
+	irq_unmask_line(number);
 }
 
 /**
@@ -163,15 +314,67 @@ void install_irq_handler(int number, irq_handler handler){
  * 	@return void*/
 void uninstall_irq_handler(int number) {
 
-	if (number < MAX_IRQ_ROUTINES) {
+	if (number >= 0 && number < MAX_IRQ_ROUTINES) {
+		irq_mask_line(number);
 		irq_handlers[number] = NULL_INTERRUPT_HANDLER;
+		irq_update_vector(number);
+	}
+}
+
+void irq_disable(int number) {
+	if (number >= 0 && number < MAX_IRQ_ROUTINES) {
+		atomic_test_and_set_bit(&irq_disabled[number / 32], number % 32);
+		irq_update_vector(number);
+	}
+}
+
+void irq_enable(int number) {
+	irq_handler handler;
+	interrupt_state state;
+	unsigned int flags;
+
+	if (number < 0 || number >= MAX_IRQ_ROUTINES) {
+		return;
+	}
+	atomic_test_and_clear_bit(&irq_disabled[number / 32], number % 32);
+	irq_update_vector(number);
+	if (!atomic_test_and_clear_bit(&irq_pending[number / 32], number % 32)) {
+		return;
+	}
+
+	/* La IRQ ocurrio mientras estaba deshabilitada: irq_dispatcher()
+	 * enmascaro la linea. Habilitarla y reenviar la IRQ al manejador. */
+	irq_unmask_line(number);
+	handler = irq_handlers[number];
+	if (handler != NULL_INTERRUPT_HANDLER) {
+		flags = irq_save();
+
+		/* El manejador recibe un estado construido a partir del
+		 * procesador actual, como si la IRQ hubiera ocurrido en el punto
+		 * desde el cual se invoco irq_enable() */
+		memset(&state, 0, sizeof(interrupt_state));
+		inline_assembly("mov %%ds, %0" : "=r"(state.ds));
+		inline_assembly("mov %%es, %0" : "=r"(state.es));
+		inline_assembly("mov %%fs, %0" : "=r"(state.fs));
+		inline_assembly("mov %%gs, %0" : "=r"(state.gs));
+		inline_assembly("mov %%cs, %0" : "=r"(state.old_cs));
+		state.number = IDT_IRQ_OFFSET + number;
+		state.old_eip = (unsigned int)__builtin_return_address(0);
+		state.old_eflags = flags;
+
+		this_cpu_add(irq_nesting, 1);
+		handler(&state);
+		this_cpu_add(irq_nesting, -1);
+		irq_restore(flags);
 	}
 }
 
 /**
  * @brief Esta rutina recibe el control de la rutina de manejo de
  * interrupcion y canaliza esta solicitud a la rutina de manejo de IRQ
- * correspondiente, si se encuentra definida.
+ * correspondiente, si se encuentra definida. Solo recibe las IRQ sin
+ * manejador, deshabilitadas, o que pueden ser espurias (ver
+ * irq_update_vector()).
  * Dentro de la estructura de datos que recibe, se puede obtener el numero
  * de la interrupcion que ocurrio, asi como el estado del procesador.
  * Con el numero de la interrupcion y restando IDT_IRQ_OFFSET se puede
@@ -187,25 +390,61 @@ void irq_dispatcher(interrupt_state * state) {
 	/* Determinar el numero de la IRQ */
 	index = state->number - IDT_IRQ_OFFSET;
 
+	/* Descartar las IRQ espurias de los PIC antes de enviar el EOI */
+	if (!apic_enabled && (index == 7 || index == 15) && pic_spurious(index)) {
+		atomic_add(&spurious_irqs, 1);
+		return;
+	}
+
 	/*
-	 * Enviar EOI al puerto de control del 8259 que lanzo la interrupcion
+	 * Enviar EOI al puerto de control del 8259 que lanzo la interrupcion.
+	 * Con el APIC el EOI (una escritura en memoria) se envia despues del
+	 * manejador: el I/O APIC vuelve a entregar una IRQ por nivel que recibe
+	 * el EOI mientras el dispositivo mantiene la linea activa.
 	 * */
-
-	/* Si la IRQ es 8..15, se debe enviar EOI al 8259 esclavo tambien. */
-	if (index >= 8) {
-		outb(SLAVE_PIC_COMMAND_PORT, EOI);
+	if (!apic_enabled) {
+		/* Si la IRQ es 8..15, se debe enviar EOI al 8259 esclavo tambien. */
+		if (index >= 8) {
+			outb(SLAVE_PIC_COMMAND_PORT, EOI);
+		}
+		outb(MASTER_PIC_COMMAND_PORT, EOI);
 	}
-	outb(MASTER_PIC_COMMAND_PORT, EOI);
 
 	/* Buscar la rutina que maneja la interrupcion */
 	handler = irq_handlers[index];
 
+	/* Deshabilitacion perezosa: la linea se enmascara solo cuando la IRQ
+	 * ocurre mientras esta deshabilitada. irq_enable() pudo ejecutarse en
+	 * otro procesador antes de marcarla como pendiente. */
+	if (handler != NULL_INTERRUPT_HANDLER
+			&& (irq_disabled[index / 32] & (1 << (index % 32)))) {
+		irq_mask_line(index);
+		atomic_test_and_set_bit(&irq_pending[index / 32], index % 32);
+		if ((irq_disabled[index / 32] & (1 << (index % 32)))
+				|| !atomic_test_and_clear_bit(&irq_pending[index / 32],
+						index % 32)) {
+			/* La linea ya esta enmascarada: el EOI no la vuelve a
+			 * entregar */
+			if (apic_enabled) {
+				lapic_eoi();
+			}
+			return;
+		}
+		irq_unmask_line(index);
+	}
+
 	/* Si la rutina existe, ejecutarla y pasarle como parametro los
 	 * registros.*/
 	if (handler != NULL_INTERRUPT_HANDLER) {
+			this_cpu_add(irq_nesting, 1);
 			handler(state);
+			this_cpu_add(irq_nesting, -1);
 	}else {
 		/* En caso contrario ignorar la interrupcion. */
 		/*printf(" Warning! unhandled IRQ %d (INT %d)", index, state->number);*/
 	}
+
+	if (apic_enabled) {
+		lapic_eoi();
+	}
 }
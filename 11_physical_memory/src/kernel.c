@@ -25,11 +25,94 @@
 #include <stdlib.h>
 #include <idt.h>
 #include <physmem.h>
+#include <acpi.h>
+#include <smp.h>
+#include <apic.h>
+#include <percpu.h>
+#include <string.h>
+#include <fpu.h>
+#include <serial.h>
+#include <log.h>
+#include <clock.h>
+#include <timer.h>
+#include <initrd.h>
+#include <paging.h>
+#include <fbcon.h>
 
 /** @brief Variable global del kernel que almacena la localizacion de la
  * estructura multiboot */
 unsigned int multiboot_info_location;
 
+/** @brief Temporizador que despierta el ciclo de espera mientras el registro
+ * del kernel tiene mensajes pendientes */
+static timer_t log_timer;
+
+/** @brief Temporizador de prueba */
+static timer_t demo_timer;
+
+/**
+ * @brief Rutina de log_timer. Solo despierta al procesador.
+ * @param t Temporizador
+ * @param arg No se usa
+ */
+static void log_timer_function(timer_t * t, void * arg) {
+}
+
+/**
+ * @brief Rutina de demo_timer: registra cuanto tardo en vencer, y se vuelve
+ * a agregar hasta completar 3 vencimientos.
+ * @param t Temporizador
+ * @param arg Instante en ns en el cual se agrego
+ */
+static void demo_timer_function(timer_t * t, void * arg) {
+	static int count = 0;
+	unsigned long long * start;
+	unsigned long long elapsed;
+
+	start = (unsigned long long *)arg;
+	elapsed = clock_ns() - *start;
+	divide64(&elapsed, 1000);
+	klog("Timer %d expired after %u us", count, (unsigned int)elapsed);
+
+	if (++count < 3) {
+		*start = clock_ns();
+		timer_start(t, 100000);
+	}
+}
+
+/**
+ * @brief Permite saber si la linea de comandos del kernel (ver
+ * filesys/boot/grub/menu.lst) contiene una opcion.
+ * @param name Nombre de la opcion
+ * @return 1 si la linea de comandos contiene la opcion, 0 si no
+ */
+static int boot_option(char * name) {
+	multiboot_info_t * info;
+	char * s;
+	int i;
+
+	info = (multiboot_info_t *)multiboot_info_location;
+	if (!test_bit(info->flags, 2) || info->cmdline == 0) {
+		return 0;
+	}
+
+	/* Comparar cada palabra de la linea de comandos con la opcion */
+	s = (char *)info->cmdline;
+	while (*s != '\0') {
+		while (*s == ' ') {
+			s++;
+		}
+		for (i = 0; name[i] != '\0' && s[i] == name[i]; i++);
+		if (name[i] == '\0' && (s[i] == ' ' || s[i] == '\0')) {
+			return 1;
+		}
+		while (*s != ' ' && *s != '\0') {
+			s++;
+		}
+	}
+	return 0;
+}
+
 /**
  * @brief Funcin principal del kernel. Esta rutina recibe el control del
  * codigo en ensamblador de start.S.
@@ -40,6 +123,8 @@ unsigned int multiboot_info_location;
 void cmain(unsigned int magic, void * multiboot_info) {
 	unsigned int i;
 	unsigned int allocations;
+	unsigned long long demo_start;
+	int benchmarks;
 
 	char * addr;
 
@@ -48,11 +133,25 @@ void cmain(unsigned int magic, void * multiboot_info) {
 
 	multiboot_info_location = (unsigned int) multiboot_info;
 
+	/* Si el cargador establecio un modo grafico, usar la consola sobre el
+	 * framebuffer */
+	setup_fb_console();
+
 	cls();
 
 	/* Configurar y cargar la GDT definida en pm.c*/
 	setup_gdt();
 
+	/* Cargar en GS el segmento del bloque de datos del BSP. Las rutinas de
+	 * servicio de interrupcion usan este bloque, por lo cual debe existir
+	 * antes de configurar la IDT */
+	load_percpu(setup_percpu(0, &boot_percpu));
+
+	/* Habilitar SSE, y escoger las implementaciones de memcpy / memset
+	 * segun el procesador */
+	setup_fpu();
+	setup_string();
+
 	/* Configurar y cargar la IDT definida en idt.c */
 	setup_idt();
 
@@ -62,9 +161,82 @@ void cmain(unsigned int magic, void * multiboot_info) {
 	/* Configurar las IRQ */
 	setup_irq();
 
+	/* Programar el PIT y calibrar el TSC contra el */
+	setup_clock();
+
+	/* Copiar la salida de printf() al puerto serial y al puerto 0xE9, si
+	 * existen */
+	if (setup_serial() == 0) {
+		console_sinks |= CONSOLE_SERIAL;
+	}
+	if (setup_debugcon() == 0) {
+		console_sinks |= CONSOLE_DEBUGCON;
+	}
+
 	/* Configurar el mapa de bits de memoria del kernel */
 	setup_memory();
 
+	/* Exponer los modulos cargados por GRUB como archivos de solo lectura */
+	setup_initrd();
+
+	/* Buscar las tablas ACPI y construir los nodos NUMA, si existen */
+	if (setup_acpi() == 0) {
+		setup_numa();
+	}
+
+	/* Entregar las IRQ por medio del I/O APIC, si la MADT lo describe. En
+	 * caso contrario se siguen usando los PIC. */
+	setup_apic();
+
+	/* Las pruebas de rendimiento solo se ejecutan si la linea de comandos
+	 * del kernel contiene la opcion "benchmark" */
+	benchmarks = boot_option("benchmark");
+
+	/* Arrancar los demas procesadores y medir el rendimiento del asignador
+	 * con uno y con todos los procesadores */
+	if (setup_smp() > 1 && benchmarks) {
+		smp_allocation_benchmark(10000);
+	}
+
+	/* Activar la paginacion y probar un rango que recibe sus paginas en el
+	 * primer acceso: de 64 MB reservados solo se asignan 4 paginas */
+	if (setup_paging() == 0) {
+		addr = reserve_lazy_range(0x4000000);
+		if (addr != 0) {
+			for (i=0; i<4; i++) {
+				addr[i * 0x1000000] = 1;
+			}
+			printf("Lazy range at %x: %u of %u pages used\n", addr,
+					release_lazy_range(addr), 0x4000000 / PAGE_SIZE);
+		}
+	}
+
+	/* Usar el temporizador del APIC local (o el PIT) en modo one shot */
+	setup_timers();
+
+	/* Medir el ancho de banda de cada implementacion de memcpy / memset,
+	 * el recorrido de un mapa de bits del tamano del de memory_allocator,
+	 * los temporizadores y la entrada a las interrupciones */
+	if (benchmarks) {
+		string_benchmark();
+		bitmap_benchmark((memory_allocator.total_units + BITS_PER_ENTRY - 1)
+				/ BITS_PER_ENTRY);
+		timer_benchmark(4096);
+		interrupt_benchmark(1000);
+	}
+
+	/* La inicializacion termino: devolver al mapa de bits la memoria de las
+	 * estructuras de GRUB y de la seccion .init. Los modulos solo se
+	 * liberan si el initrd no los usa. */
+	i = 0;
+	if (initrd_file_count == 0) {
+		i = free_boot_modules();
+	}
+	i += free_boot_memory();
+	printf("Boot memory released: %u KB\n", i * (MEMORY_UNIT_SIZE / 1024));
+	printf("Free units: %d, %u in the bitmap\n", memory_allocator.free_units,
+			bitmap_count_free(&memory_allocator));
+
 	printf("Kernel started\n");
 
 	/* Probar la gestion de unidades de memoria */
@@ -85,8 +257,26 @@ void cmain(unsigned int magic, void * multiboot_info) {
 
 	printf("Last allocated address: %x, %u\n",addr, addr);
 
+	timer_init(&log_timer, log_timer_function, 0);
+	timer_init(&demo_timer, demo_timer_function, &demo_start);
+	demo_start = clock_ns();
+	timer_start(&demo_timer, 100000);
+
 	inline_assembly("sti");
 
 	printf("Kernel finished\n");
 
+	/* Copiar el registro del kernel a la consola mientras el procesador
+	 * espera interrupciones: a lo sumo LOG_FLUSH_BATCH mensajes por cada
+	 * interrupcion. Si quedan mensajes, un temporizador despierta al
+	 * procesador 1 ms despues (el hardware no interrumpe periodicamente). */
+	for (;;) {
+		if (log_flush(LOG_FLUSH_BATCH) == LOG_FLUSH_BATCH) {
+			timer_start(&log_timer, 1000);
+		}
+		/* Dibujar el desplazamiento que console_write() haya aplazado */
+		flush_screen();
+		inline_assembly("hlt");
+	}
+
 }
@@ -0,0 +1,160 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion del registro de mensajes del kernel.
+ */
+
+#include <log.h>
+#include <asm.h>
+#include <stdio.h>
+#include <serial.h>
+#include <percpu.h>
+#include <clock.h>
+
+/** @brief Buffer circular de registros */
+static log_record_t log_ring[LOG_RECORDS];
+
+/** @brief Numero de secuencia del proximo mensaje. Los productores lo
+ * incrementan con lock xadd. */
+static volatile int log_head;
+
+/** @brief Numero de secuencia del proximo mensaje a copiar a la consola */
+static unsigned int log_tail;
+
+/** @brief Vale 1 mientras un procesador ejecuta log_flush() */
+static volatile unsigned int log_flushing;
+
+/**
+ * @brief Almacena un mensaje con formato en el registro del kernel.
+ * @param format Formato del mensaje (ver vsnprintf())
+ * @param ... Argumentos
+ @verbatim
+  El productor toma un numero de secuencia con lock xadd, de forma que
+  cada productor escribe en un registro diferente. El campo seq se escribe
+  al final: mientras vale 0 el consumidor no copia el registro.
+ @endverbatim*/
+void klog(char * format, ...) {
+	log_record_t * record;
+	unsigned int seq;
+	va_list args;
+
+	seq = atomic_add(&log_head, 1);
+	record = &log_ring[seq % LOG_RECORDS];
+
+	record->seq = 0;
+	record->timestamp = cycles();
+	record->cpu = this_cpu_read(cpu);
+
+	va_start(args, format);
+	vsnprintf(record->text, LOG_TEXT_SIZE, format, args);
+	va_end(args);
+
+	inline_assembly("" : : : "memory");
+	record->seq = seq + 1;
+}
+
+/**
+ * @brief Copia a la consola los registros pendientes, con el candado de
+ * log_flush() tomado.
+ * @param max Numero maximo de registros a copiar
+ * @return Numero de registros copiados
+ @verbatim
+  El registro se copia a un buffer local y luego se verifica que su numero
+  de secuencia no cambio: si cambio, un productor lo reemplazo mientras se
+  copiaba y el mensaje se cuenta como perdido.
+ @endverbatim*/
+static int log_copy(int max) {
+	log_record_t * record;
+	char line[LOG_TEXT_SIZE + 32];
+	unsigned long long timestamp;
+	unsigned int us;
+	unsigned int head;
+	unsigned int lost;
+	int length;
+	int copied;
+
+	for (copied = 0; copied < max; copied++) {
+		head = log_head;
+		if (log_tail == head) {
+			break;
+		}
+
+		lost = 0;
+		if (head - log_tail > LOG_RECORDS) {
+			lost = head - log_tail - LOG_RECORDS;
+			log_tail += lost;
+		}
+
+		record = &log_ring[log_tail % LOG_RECORDS];
+		if (record->seq != log_tail + 1) {
+			/* El productor aun no termina de escribir el mensaje */
+			if (lost == 0) {
+				break;
+			}
+			length = 0;
+		}else {
+			/* Segundos y microsegundos desde la calibracion del TSC */
+			timestamp = cycles_to_ns(record->timestamp);
+			divide64(&timestamp, 1000);
+			us = divide64(&timestamp, 1000000);
+			length = snprintf(line, sizeof(line), "[%5u.%06u] cpu %u: %s",
+					(unsigned int)timestamp, us, record->cpu, record->text);
+			if (record->seq != log_tail + 1) {
+				lost++;
+				length = 0;
+			}
+			log_tail++;
+		}
+
+		if (lost > 0) {
+			printf("[log] %u messages lost\n", lost);
+		}
+		if (length > 0) {
+			if (length >= sizeof(line) - 1) {
+				length = sizeof(line) - 2;
+			}
+			/* Cada registro ocupa una linea, aunque el mensaje no termine
+			 * en salto de linea */
+			if (line[length - 1] != '\n') {
+				line[length++] = '\n';
+			}
+			console_write(line, length);
+		}
+	}
+
+	return copied;
+}
+
+/**
+ * @brief Copia a la consola los registros pendientes.
+ * @param max Numero maximo de registros a copiar
+ * @return Numero de registros copiados
+ @verbatim
+  Si otro procesador esta copiando los registros, retorna sin esperarlo.
+ @endverbatim*/
+int log_flush(int max) {
+	int copied;
+
+	if (atomic_cmpxchg(&log_flushing, 0, 1) != 0) {
+		return 0;
+	}
+	copied = log_copy(max);
+	log_flushing = 0;
+
+	return copied;
+}
+
+/**
+ * @brief Copia a la consola todos los registros pendientes, aunque otro
+ * procesador este copiandolos. Se usa antes de detener el sistema.
+ */
+void log_dump(void) {
+	if (log_tail != log_head) {
+		printf("--- kernel log (%u pending) ---\n", log_head - log_tail);
+		log_copy(LOG_RECORDS);
+	}
+	flush_screen();
+	serial_flush();
+}
@@ -0,0 +1,565 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de la paginacion del kernel y de los
+ * rangos de memoria que se asignan en el primer acceso.
+ */
+
+#include <paging.h>
+#include <asm.h>
+#include <physmem.h>
+#include <exception.h>
+#include <smp.h>
+#include <apic.h>
+#include <stdio.h>
+#include <init.h>
+#include <fbcon.h>
+#include <string.h>
+#include <log.h>
+
+/** @brief Directorio de paginas del kernel. Su direccion fisica se carga en
+ * CR3 en todos los procesadores. */
+unsigned int * page_directory = 0;
+
+/** @brief Rangos de direcciones lineales por encima de identity_end,
+ * ordenados por direccion de inicio */
+vm_range_t vm_ranges[MAX_VM_RANGES];
+
+/** @brief Numero de rangos en vm_ranges */
+int vm_range_count;
+
+/** @brief Fin de la memoria mapeada en su misma direccion al arranque
+ * (alineado a LARGE_PAGE_SIZE). Los rangos lazy se ubican por encima. */
+unsigned int identity_end;
+
+/** @brief 1 si el mapeo inicial usa paginas de 4 MB */
+int large_pages;
+
+/** @brief 1 si la entrada 1 de la PAT se programo como write-combining */
+int pat_enabled;
+
+/** @brief Protege vm_ranges. Se toma con lock cmpxchg. */
+static volatile unsigned int vm_lock;
+
+/**
+ * @brief Toma el candado de vm_ranges.
+ */
+static __inline__ void vm_lock_acquire(void) {
+	while (atomic_cmpxchg(&vm_lock, 0, 1) != 0) {
+		cpu_relax();
+	}
+}
+
+/**
+ * @brief Libera el candado de vm_ranges.
+ */
+static __inline__ void vm_lock_release(void) {
+	inline_assembly("" : : : "memory");
+	vm_lock = 0;
+}
+
+/**
+ * @brief Asigna una unidad y la llena de ceros.
+ * @return Direccion de la unidad, 0 si no existe memoria disponible.
+ */
+static unsigned int * zeroed_unit(void) {
+	unsigned int * unit;
+
+	unit = (unsigned int *)allocate_unit();
+	if (unit == 0) {
+		return 0;
+	}
+	memset(unit, 0, PAGE_SIZE);
+	return unit;
+}
+
+/**
+ * @brief Obtiene la tabla de paginas que mapea una direccion lineal.
+ * @param virt Direccion lineal
+ * @param create 1 si se debe crear la tabla cuando no existe
+ * @return Apuntador a la tabla, 0 si no existe (o si la direccion se
+ * encuentra en una pagina de 4 MB).
+ @verbatim
+  La entrada del directorio se instala con lock cmpxchg: si dos procesadores
+  crean la misma tabla al mismo tiempo, el que pierde libera la suya.
+ @endverbatim*/
+static unsigned int * page_table(unsigned int virt, int create) {
+	volatile unsigned int * pde;
+	unsigned int * table;
+
+	pde = &page_directory[virt >> 22];
+
+	if (!(*pde & PAGE_PRESENT)) {
+		if (!create) {
+			return 0;
+		}
+		table = zeroed_unit();
+		if (table == 0) {
+			return 0;
+		}
+		if (atomic_cmpxchg(pde, 0,
+				(unsigned int)table | PAGE_PRESENT | PAGE_WRITE) != 0) {
+			free_unit((char *)table);
+		}
+	}
+
+	if (*pde & PAGE_LARGE) {
+		return 0;
+	}
+
+	return (unsigned int *)(*pde & PAGE_FRAME_MASK);
+}
+
+/**
+ * @brief Mapea una pagina.
+ * @param virt Direccion lineal de la pagina
+ * @param phys Direccion fisica del marco
+ * @param flags Bits de la entrada (PAGE_WRITE, PAGE_PCD, ...)
+ * @return 0 si la pagina se mapeo, -1 si ya estaba mapeada o no fue posible
+ * asignar la tabla de paginas.
+ */
+int map_page(unsigned int virt, unsigned int phys, unsigned int flags) {
+	unsigned int * table;
+
+	table = page_table(virt, 1);
+	if (table == 0) {
+		return -1;
+	}
+
+	/* Una entrada que no esta presente no se almacena en la TLB, por lo cual
+	 * no es necesario invalidarla */
+	if (atomic_cmpxchg(&table[(virt >> 12) & (PAGE_ENTRIES - 1)], 0,
+			(phys & PAGE_FRAME_MASK) | flags | PAGE_PRESENT) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Quita el mapeo de una pagina.
+ * @param virt Direccion lineal de la pagina
+ * @return Direccion fisica del marco que estaba mapeado, 0 si la pagina no
+ * estaba mapeada.
+ @verbatim
+  Solo se invalida la entrada en la TLB del procesador actual.
+ @endverbatim*/
+unsigned int unmap_page(unsigned int virt) {
+	unsigned int * table;
+	unsigned int index;
+	unsigned int entry;
+
+	table = page_table(virt, 0);
+	if (table == 0) {
+		return 0;
+	}
+
+	index = (virt >> 12) & (PAGE_ENTRIES - 1);
+	entry = table[index];
+	if (!(entry & PAGE_PRESENT)) {
+		return 0;
+	}
+
+	table[index] = 0;
+	invlpg(virt);
+
+	return entry & PAGE_FRAME_MASK;
+}
+
+/**
+ * @brief Traduce una direccion lineal a una direccion fisica.
+ * @param virt Direccion lineal
+ * @return Direccion fisica, 0 si la direccion no se encuentra mapeada.
+ */
+unsigned int virtual_to_physical(unsigned int virt) {
+	unsigned int pde;
+	unsigned int entry;
+
+	if (page_directory == 0) {
+		return virt;
+	}
+
+	pde = page_directory[virt >> 22];
+	if (!(pde & PAGE_PRESENT)) {
+		return 0;
+	}
+	if (pde & PAGE_LARGE) {
+		return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+	}
+
+	entry = ((unsigned int *)(pde & PAGE_FRAME_MASK))
+			[(virt >> 12) & (PAGE_ENTRIES - 1)];
+	if (!(entry & PAGE_PRESENT)) {
+		return 0;
+	}
+	return (entry & PAGE_FRAME_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Busca el rango que contiene una direccion lineal. Se debe invocar
+ * con vm_lock tomado.
+ * @param addr Direccion lineal
+ * @return Apuntador al rango, 0 si la direccion no pertenece a ningun rango.
+ */
+static vm_range_t * find_range(unsigned int addr) {
+	int i;
+
+	for (i=0; i<vm_range_count; i++) {
+		if (addr >= vm_ranges[i].start && addr < vm_ranges[i].end) {
+			return &vm_ranges[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Inserta un rango en vm_ranges, en la posicion index. Se debe
+ * invocar con vm_lock tomado.
+ * @return 0 si el rango se inserto, -1 si la tabla esta llena.
+ */
+static int insert_range(int index, unsigned int start, unsigned int end,
+		int type, unsigned int flags) {
+	int i;
+
+	if (vm_range_count == MAX_VM_RANGES) {
+		return -1;
+	}
+	for (i=vm_range_count; i>index; i--) {
+		vm_ranges[i] = vm_ranges[i - 1];
+	}
+	vm_ranges[index].start = start;
+	vm_ranges[index].end = end;
+	vm_ranges[index].type = type;
+	vm_ranges[index].flags = flags;
+	vm_range_count++;
+	return 0;
+}
+
+/**
+ * @brief Mapea una region (por ejemplo, registros de un dispositivo) en su
+ * misma direccion fisica.
+ * @param start Direccion fisica de inicio
+ * @param length Tamano de la region
+ * @param flags Bits de las entradas (PAGE_WRITE, PAGE_PCD, ...)
+ * @return 0 si la region se mapeo, -1 en caso contrario.
+ @verbatim
+  La memoria por debajo de identity_end ya se encuentra mapeada. Una region
+  por encima se registra en vm_ranges para que no se use en un rango lazy.
+ @endverbatim*/
+int identity_map(unsigned int start, unsigned int length, unsigned int flags) {
+	unsigned int end;
+	unsigned int page;
+	int i;
+
+	if (page_directory == 0 || length == 0) {
+		return -1;
+	}
+
+	end = start + length - 1;
+	start &= PAGE_FRAME_MASK;
+	end = (end & PAGE_FRAME_MASK) + PAGE_SIZE;
+
+	if (end != 0 && end <= identity_end) {
+		return 0;
+	}
+
+	vm_lock_acquire();
+	for (i=0; i<vm_range_count; i++) {
+		if (vm_ranges[i].start >= start) {
+			break;
+		}
+	}
+	if ((i > 0 && vm_ranges[i - 1].end - 1 >= start) ||
+			(i < vm_range_count && vm_ranges[i].start <= end - 1) ||
+			insert_range(i, start, end, VM_RANGE_IDENTITY, flags) != 0) {
+		vm_lock_release();
+		printf("Unable to map %x - %x\n", start, end);
+		return -1;
+	}
+	vm_lock_release();
+
+	for (page = start; page != end; page += PAGE_SIZE) {
+		if (map_page(page, page, flags) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Reserva un rango de direcciones lineales cuyas paginas se asignan
+ * en el primer acceso.
+ * @param length Tamano del rango
+ * @return Direccion de inicio del rango, 0 si no existe espacio.
+ @verbatim
+  El rango se busca entre identity_end y LAZY_WINDOW_END (primer hueco en
+  el que quepa). Despues de cada rango se deja una pagina sin mapear, de
+  forma que un acceso por fuera del final del rango genere un fallo de
+  pagina que no se atiende.
+ @endverbatim*/
+char * reserve_lazy_range(unsigned int length) {
+	unsigned int start;
+	int i;
+
+	if (page_directory == 0 || length == 0 ||
+			length > LAZY_WINDOW_END - PAGE_SIZE) {
+		return 0;
+	}
+
+	length = (length + PAGE_SIZE - 1) & PAGE_FRAME_MASK;
+
+	vm_lock_acquire();
+	start = identity_end;
+	for (i=0; i<vm_range_count; i++) {
+		if (vm_ranges[i].start >= start &&
+				vm_ranges[i].start - start >= length + PAGE_SIZE) {
+			break;
+		}
+		if (vm_ranges[i].end + PAGE_SIZE > start) {
+			start = vm_ranges[i].end + PAGE_SIZE;
+		}
+	}
+
+	if (start > LAZY_WINDOW_END || LAZY_WINDOW_END - start < length ||
+			insert_range(i, start, start + length, VM_RANGE_LAZY,
+					PAGE_WRITE) != 0) {
+		vm_lock_release();
+		return 0;
+	}
+	vm_lock_release();
+
+	return (char *)start;
+}
+
+/**
+ * @brief Invalida la TLB del procesador actual.
+ * @param cpu Indice del procesador
+ * @param arg No usado
+ */
+static void flush_tlb(int cpu, void * arg) {
+	write_cr3(read_cr3());
+}
+
+/**
+ * @brief Libera un rango reservado con reserve_lazy_range() y las unidades
+ * que se asignaron a sus paginas.
+ * @param addr Direccion de inicio del rango
+ * @return Numero de paginas que tenian un marco asignado.
+ @verbatim
+  Las tablas de paginas que ya no cubren ningun rango tambien se liberan.
+  Con varios procesadores en ejecucion, la TLB de los demas se invalida con
+  smp_call(), por lo cual esta rutina solo se debe invocar desde el BSP.
+ @endverbatim*/
+unsigned int release_lazy_range(char * addr) {
+	vm_range_t * range;
+	unsigned int start;
+	unsigned int end;
+	unsigned int page;
+	unsigned int phys;
+	unsigned int slot;
+	unsigned int * table;
+	unsigned int n;
+	int i;
+
+	vm_lock_acquire();
+	range = find_range((unsigned int)addr);
+	if (range == 0 || range->type != VM_RANGE_LAZY ||
+			range->start != (unsigned int)addr) {
+		vm_lock_release();
+		return 0;
+	}
+	start = range->start;
+	end = range->end;
+
+	/* Quitar el rango: a partir de este punto un acceso al rango ya no se
+	 * atiende en el manejador de fallos de pagina */
+	for (i = range - vm_ranges; i < vm_range_count - 1; i++) {
+		vm_ranges[i] = vm_ranges[i + 1];
+	}
+	vm_range_count--;
+
+	n = 0;
+	for (page = start; page < end; page += PAGE_SIZE) {
+		phys = unmap_page(page);
+		if (phys != 0) {
+			free_unit((char *)phys);
+			n++;
+		}
+	}
+
+	/* Liberar las tablas de paginas que no comparten su espacio de 4 MB con
+	 * otro rango */
+	for (slot = start >> 22; slot <= (end - 1) >> 22; slot++) {
+		for (i=0; i<vm_range_count; i++) {
+			if (vm_ranges[i].start >> 22 <= slot &&
+					(vm_ranges[i].end - 1) >> 22 >= slot) {
+				break;
+			}
+		}
+		table = page_table(slot << 22, 0);
+		if (i == vm_range_count && table != 0) {
+			page_directory[slot] = 0;
+			free_unit((char *)table);
+		}
+	}
+	vm_lock_release();
+
+	if (online_cpus > 1) {
+		smp_call(flush_tlb, 0, cpu_count);
+	}
+
+	return n;
+}
+
+/**
+ * @brief Manejador de la excepcion de fallo de pagina.
+ * @param state Estado del procesador. La direccion que causo el fallo se
+ * encuentra en CR2.
+ @verbatim
+  Si la direccion pertenece a un rango lazy y la pagina no estaba presente,
+  se mapea una unidad llena de ceros y se reintenta la instruccion. En
+  cualquier otro caso el fallo no se puede atender y el sistema se detiene.
+  La unidad se asigna antes de tomar vm_lock, dado que allocate_unit() puede
+  invocar las rutinas de recuperacion de memoria.
+ @endverbatim*/
+static void page_fault_handler(interrupt_state * state) {
+	unsigned int addr;
+	unsigned int * frame;
+	vm_range_t * range;
+	int mapped;
+
+	addr = read_cr2();
+
+	if (!(state->error_code & PAGE_FAULT_PRESENT)) {
+		frame = zeroed_unit();
+		if (frame != 0) {
+			mapped = 0;
+			vm_lock_acquire();
+			range = find_range(addr);
+			if (range != 0 && range->type == VM_RANGE_LAZY) {
+				mapped = (map_page(addr & PAGE_FRAME_MASK, (unsigned int)frame,
+						range->flags) == 0);
+				/* Otro procesador pudo mapear la pagina primero */
+				if (!mapped && virtual_to_physical(addr) != 0) {
+					vm_lock_release();
+					free_unit((char *)frame);
+					return;
+				}
+			}
+			vm_lock_release();
+			if (mapped) {
+				return;
+			}
+			free_unit((char *)frame);
+		}
+	}
+
+	printf("Page Fault at %x (eip: %x, error: %x). System Halted!\n", addr,
+			state->old_eip, state->error_code);
+	log_dump();
+	for (;;)
+		;
+}
+
+/**
+ * @brief Activa la paginacion en el procesador actual con el directorio
+ * del kernel.
+ * @param cpu Indice del procesador
+ * @param arg No usado
+ */
+static void enable_paging(int cpu, void * arg) {
+	/* Todos los procesadores deben tener la misma PAT */
+	if (pat_enabled) {
+		wbinvd();
+		wrmsr(IA32_PAT_MSR, PAT_LOW, PAT_HIGH);
+	}
+	if (large_pages) {
+		write_cr4(read_cr4() | CR4_PSE);
+	}
+	write_cr3((unsigned int)page_directory);
+	write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+/**
+ * @brief Crea el directorio de paginas del kernel, mapea la memoria en su
+ * misma direccion, instala el manejador de fallos de pagina y activa la
+ * paginacion en todos los procesadores en ejecucion.
+ * @return 0 si la paginacion se activo, -1 en caso contrario.
+ @verbatim
+  Se mapean en su misma direccion los espacios de 4 MB desde 0 hasta el fin
+  de la memoria que gestiona memory_allocator, con paginas de 4 MB si el
+  procesador soporta PSE. Esto incluye el primer MB (mapa de bits, memoria
+  de video, tablas de la BIOS), el kernel y todas las unidades que entrega
+  allocate_unit(). El APIC local se mapea aparte, sin cache, y el
+  framebuffer de la consola grafica (si existe) como write-combining.
+ @endverbatim*/
+int __init setup_paging(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int end;
+	unsigned int slots;
+	unsigned int slot;
+	unsigned int * table;
+	int i;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	large_pages = (edx & CPUID_EDX_PSE) != 0;
+	pat_enabled = (edx & CPUID_EDX_PAT) != 0;
+
+	page_directory = zeroed_unit();
+	if (page_directory == 0) {
+		printf("Unable to allocate the page directory\n");
+		return -1;
+	}
+
+	end = (memory_allocator.first_unit + memory_allocator.total_units)
+			* MEMORY_UNIT_SIZE;
+	slots = (end >> 22) + ((end & (LARGE_PAGE_SIZE - 1)) != 0);
+
+	for (slot = 0; slot < slots; slot++) {
+		if (large_pages) {
+			page_directory[slot] = (slot << 22) | PAGE_LARGE | PAGE_WRITE
+					| PAGE_PRESENT;
+			continue;
+		}
+		table = zeroed_unit();
+		if (table == 0) {
+			printf("Unable to allocate the kernel page tables\n");
+			return -1;
+		}
+		for (i=0; i<PAGE_ENTRIES; i++) {
+			table[i] = (slot << 22) | (i << 12) | PAGE_WRITE | PAGE_PRESENT;
+		}
+		page_directory[slot] = (unsigned int)table | PAGE_WRITE | PAGE_PRESENT;
+	}
+
+	identity_end = (slots < PAGE_ENTRIES) ? slots << 22 : LAZY_WINDOW_END;
+	vm_range_count = 0;
+
+	/* Registros del APIC local y de los I/O APIC: sin cache */
+	identity_map(lapic_base, PAGE_SIZE, PAGE_WRITE | PAGE_PCD | PAGE_PWT);
+	for (i = 0; i < io_apic_count; i++) {
+		identity_map(io_apics[i].address & ~(PAGE_SIZE - 1), PAGE_SIZE,
+				PAGE_WRITE | PAGE_PCD | PAGE_PWT);
+	}
+
+	/* Framebuffer de la consola grafica: write-combining */
+	if (fb_console_active) {
+		identity_map(framebuffer.address, framebuffer.size,
+				PAGE_WRITE | PAGE_WRITE_COMBINING);
+	}
+
+	install_exception_handler(PAGE_FAULT_EXCEPTION, page_fault_handler);
+
+	/* Todos los procesadores comparten el mismo directorio */
+	if (online_cpus > 1) {
+		smp_call(enable_paging, 0, cpu_count);
+	}else {
+		enable_paging(0, 0);
+	}
+
+	printf("Paging enabled: %u MB mapped (%s pages)\n", identity_end >> 20,
+			large_pages ? "4 MB" : "4 KB");
+
+	return 0;
+}
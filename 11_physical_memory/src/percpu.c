@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de los bloques de datos por procesador,
+ * accedidos a traves de un segmento de datos cargado en GS.
+ */
+
+#include <percpu.h>
+#include <pm.h>
+#include <stdio.h>
+
+/** @brief Bloque de datos del BSP. Los bloques de los AP se asignan al
+ * arrancarlos. */
+percpu_t boot_percpu;
+
+/** @brief Verifica en tiempo de compilacion que los desplazamientos usados
+ * por isr.S coinciden con la estructura percpu_t */
+typedef char percpu_offsets_check[
+		(__builtin_offsetof(percpu_t, current_esp) == PERCPU_CURRENT_ESP &&
+		__builtin_offsetof(percpu_t, current_ss) == PERCPU_CURRENT_SS &&
+		__builtin_offsetof(percpu_t, interrupt_stack_top) ==
+				PERCPU_INTERRUPT_STACK_TOP) ? 1 : -1];
+
+/**
+ * @brief Inicializa el bloque de datos de un procesador y crea su
+ * descriptor de segmento en la GDT.
+ * @param cpu Indice del procesador
+ * @param block Bloque de datos del procesador
+ * @return Selector del descriptor, 0 si no existe espacio en la GDT.
+ @verbatim
+  El descriptor es un segmento de datos con base igual a la direccion del
+  bloque y limite igual a su tamano, por lo cual un acceso por fuera del
+  bloque a traves de GS genera una excepcion de proteccion general.
+ @endverbatim*/
+unsigned short setup_percpu(int cpu, percpu_t * block) {
+	unsigned short selector;
+	unsigned int i;
+
+	selector = allocate_gdt_selector();
+	if (selector == 0) {
+		printf("No GDT entry for the data of CPU %d\n", cpu);
+		return 0;
+	}
+
+	for (i=0; i<sizeof(percpu_t); i++) {
+		((char *)block)[i] = 0;
+	}
+
+	block->self = block;
+	block->cpu = cpu;
+	block->selector = selector;
+	block->interrupt_stack_top =
+			(unsigned int)&block->interrupt_stack[PERCPU_INTERRUPT_STACK_SIZE];
+	block->next_free_unit = memory_allocator.next_free_unit;
+
+	setup_gdt_descriptor(selector, (unsigned int)block, sizeof(percpu_t) - 1,
+			DATA_SEGMENT, RING0_DPL, 1, 1);
+
+	return selector;
+}
@@ -10,8 +10,16 @@
 
 #include <physmem.h>
 #include <multiboot.h>
+#include <idt.h>
+#include <irq.h>
+#include <acpi.h>
+#include <smp.h>
+#include <percpu.h>
+#include <init.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <log.h>
 
 /** @brief Mapa de bits de memoria disponible
  * @details Esta variable almacena el apuntador del inicio del mapa de bits
@@ -20,17 +28,16 @@
  * un computador)*/
  unsigned int * memory_bitmap =(unsigned int*)MMAP_LOCATION;
 
- /** @brief Siguiente unidad disponible en el mapa de bits */
- unsigned int next_free_unit;
-
- /** @brief Numero de marcos libres en la memoria */
- int free_units;
-
- /** @brief Numero total de unidades en la memoria */
- int total_units;
-
- /** @brief Marco inicial de las unidades  disponibles en memoria */
- unsigned int base_unit;
+ /** @brief Asignador por defecto del kernel. Gestiona las unidades de
+  * MEMORY_UNIT_SIZE bytes por debajo de LOW_MEMORY_LIMIT sobre
+  * memory_bitmap; sus unidades coinciden con las direcciones fisicas
+  * (base = 0). Las rutinas de este archivo agregan sobre el las caches, las
+  * reservas, el pool de emergencia y las politicas NUMA.
+  * Cada procesador busca a partir de su propio cursor
+  * (percpu_t.next_free_unit), que se inicializa con next_free_unit. */
+ bitmap_allocator_t memory_allocator = {
+		 (unsigned int*)MMAP_LOCATION, 0, MEMORY_UNIT_SIZE, MEMORY_UNIT_SHIFT
+ };
 
  /** @brief Tamao del mapa de bits en memoria.
   * @details
@@ -63,6 +70,162 @@ unsigned int memory_length;
 /** @brief Mnima direccin de memoria permitida para liberar */
 unsigned int allowed_free_start;
 
+/** @brief Fin de la seccin .init si ya fue devuelta al mapa de bits con
+ * free_boot_memory(), 0 en caso contrario */
+unsigned int released_init_end;
+
+/** @brief Cache de regiones liberadas recientemente, por clase de tamao.
+ * @details Las clases corresponden a regiones de 16 KB, 64 KB y 256 KB
+ * (4, 16 y 64 unidades), los tamaos que con mayor frecuencia se asignan y
+ * se liberan con allocate_unit_region() y free_region(). */
+region_cache_t region_cache[REGION_CACHE_CLASSES] = { {4}, {16}, {64} };
+
+/** @brief Nmero de unidades retenidas en la cache de regiones. Estas
+ * unidades no se cuentan dentro de free_units. */
+int cached_units;
+
+/** @brief Nmero de unidades reservadas con reserve_units(). Las unidades
+ * reservadas siguen libres en el mapa de bits, pero no se cuentan dentro de
+ * free_units. */
+int reserved_units;
+
+/** @brief Pool de emergencia: unidades tomadas previamente del mapa de bits
+ * que los manejadores de IRQ pueden usar sin tocar el mapa de bits. Una
+ * posicin con valor 0 se encuentra vaca. */
+unsigned int emergency_pool[2 * EMERGENCY_POOL_UNITS];
+
+/** @brief Nmero de unidades disponibles en el pool de emergencia */
+int emergency_count;
+
+/** @brief Marca de agua mnima (en unidades). Por debajo de ella la
+ * recuperacin de memoria se repite hasta alcanzar la marca alta o hasta que
+ * ninguna rutina de recuperacin pueda devolver ms memoria. */
+int watermark_min;
+
+/** @brief Marca de agua baja (en unidades). Por debajo de ella se le pide
+ * una vez a cada rutina de recuperacin que devuelva memoria. */
+int watermark_low;
+
+/** @brief Marca de agua alta (en unidades). Objetivo de la recuperacin de
+ * memoria. */
+int watermark_high;
+
+/** @brief Rutinas registradas para recuperar memoria de las caches
+ * construidas sobre el asignador */
+reclaim_callback reclaim_callbacks[MAX_RECLAIM_CALLBACKS];
+
+/** @brief Indica que se est ejecutando una recuperacin de memoria. Evita
+ * la recursin si una rutina de recuperacin asigna memoria. */
+volatile unsigned int reclaiming;
+
+/** @brief Regiones de memoria por encima de LOW_MEMORY_LIMIT, cada una con
+ * su propio mapa de bits */
+memory_region_t high_regions[MAX_HIGH_REGIONS];
+
+/** @brief Nmero de regiones en high_regions */
+int high_region_count;
+
+/** @brief Nmero de marcos libres en las regiones altas */
+int free_high_frames;
+
+/** @brief Vale 1 cuando la paginacin usa PAE y puede mapear los marcos
+ * altos. setup_paging() crea tablas de 32 bits sin PAE, por lo cual los
+ * marcos altos no se entregan. */
+int high_frames_enabled = 0;
+
+/** @brief Nodos NUMA construidos a partir de la SRAT */
+numa_node_t numa_nodes[MAX_NUMA_NODES];
+
+/** @brief Nmero de nodos NUMA. Si es 0 o 1 no se aplica ninguna poltica
+ * NUMA. */
+int numa_node_count;
+
+/** @brief Rangos de unidades de memory_bitmap de cada nodo NUMA */
+numa_range_t numa_ranges[MAX_NUMA_RANGES];
+
+/** @brief Nmero de rangos en numa_ranges */
+int numa_range_count;
+
+/** @brief Nodo de cada procesador, indexado por el identificador de su APIC
+ * local. Almacena el ndice del nodo + 1 (0 = desconocido). */
+unsigned char numa_apic_node[256];
+
+/** @brief Rangos de memoria usados durante el arranque: mdulos y
+ * estructuras de informacin multiboot */
+boot_range_t boot_ranges[MAX_BOOT_RANGES];
+
+/** @brief Nmero de rangos en boot_ranges */
+int boot_range_count;
+
+/**
+ * @brief Marca como disponibles en el mapa de bits las unidades que se
+ * encuentran entre start y end, sin pasar por la cache de regiones.
+ * @param start Direccin de inicio, alineada a MEMORY_UNIT_SIZE
+ * @param end Direccin final (no incluida)
+ */
+static void release_region(unsigned int start, unsigned int end);
+
+/**
+ * @brief Actualiza el contador de unidades libres del nodo NUMA al cual
+ * pertenece una unidad.
+ * @param unit Unidad asignada o liberada
+ * @param delta -1 si la unidad se asign, 1 si se liber
+ */
+static void node_account(unsigned int unit, int delta);
+
+/**
+ * @brief Toma una unidad del nodo NUMA local, o del nodo ms cercano que
+ * tenga memoria disponible.
+ * @return Direccin de inicio de la unidad, 0 si ningn nodo tiene memoria.
+ */
+static char * claim_local_unit(void);
+
+/**
+ * @brief Registra la parte de una regin del mapa de memoria de GRUB que se
+ * encuentra por encima de LOW_MEMORY_LIMIT.
+ * @param mmap Regin del mapa de memoria
+ */
+static void register_high_region(memory_map_t * mmap);
+
+/**
+ * @brief Crea los mapas de bits de las regiones altas registradas.
+ */
+static void setup_high_memory(void);
+
+/**
+ * @brief Verifica la memoria libre contra las marcas de agua, e invoca las
+ * rutinas de recuperacin de memoria si es necesario.
+ */
+static void check_watermarks(void);
+
+/**
+ * @brief Lleva el pool de emergencia a EMERGENCY_POOL_UNITS unidades,
+ * tomando o devolviendo unidades del mapa de bits. Solo se debe invocar
+ * fuera de interrupcion.
+ */
+static void balance_emergency_pool(void);
+
+/**
+ * @brief Registra un rango de memoria usado durante el arranque.
+ * @param start Direccin de inicio del rango
+ * @param length Tamao del rango en bytes
+ * @param type Tipo de rango (BOOT_RANGE_*)
+ */
+static void add_boot_range(unsigned int start, unsigned int length,
+		int type);
+
+/**
+ * @brief Registra la memoria que ocupa una cadena de caracteres de GRUB.
+ * @param str Cadena terminada en nulo
+ */
+static void add_boot_string(char * str);
+
+/**
+ * @brief Marca como ocupadas las unidades de los rangos de arranque que se
+ * encuentran dentro del rango de memory_allocator.
+ */
+static void reserve_boot_ranges(void);
+
 /**
  * @brief Esta rutina inicializa el mapa de bits de memoria,
  * a partir de la informacion obtenida del GRUB.
@@ -76,7 +239,7 @@ unsigned int allowed_free_start;
  * base sea mayor o igual a la posicion del kernel.
  * se establece esta memoria como disponible para liberar memoria.
  */
-void setup_memory(void){
+void __init setup_memory(void){
 
 	extern multiboot_header_t multiboot_header;
 	extern unsigned int multiboot_info_location;
@@ -88,16 +251,9 @@ void setup_memory(void){
 	int mod_count;
 	multiboot_info_t * info = (multiboot_info_t *)multiboot_info_location;
 
-	int i;
-
-	unsigned int mods_end; /* Almacena la direccin de memoria final
-	del ultimo modulo cargado, o 0 si no se cargaron modulos. */
-
 	/*printf("Bitmap array size: %d\n", memory_bitmap_length);*/
 
-	for(i=0; i<memory_bitmap_length; i++){
-		memory_bitmap[i] = 0;
-	}
+	memset(memory_bitmap, 0, memory_bitmap_length * BYTES_PER_ENTRY);
 
 	/*
 	printf("Inicio del kernel: %x\n", multiboot_header.kernel_start);
@@ -106,17 +262,37 @@ void setup_memory(void){
 	printf("Punto de entrada del kernel: %x\n", multiboot_header.entry_point);
 	*/
 
-	/* si flags[3] = 1, se especificaron mdulos que deben ser cargados junto
-	 * con el kernel*/
+	/* Registrar las estructuras de informacion multiboot. Sus unidades se
+	 * marcan como ocupadas hasta que el kernel invoque free_boot_memory() */
+	boot_range_count = 0;
+
+	add_boot_range(multiboot_info_location, sizeof(multiboot_info_t),
+			BOOT_RANGE_MULTIBOOT);
+
+	if (test_bit(info->flags, 2)) {
+		add_boot_string((char *)info->cmdline);
+	}
+
+	if (test_bit(info->flags, 6)) {
+		add_boot_range(info->mmap_addr, info->mmap_length,
+				BOOT_RANGE_MULTIBOOT);
+	}
 
-	mods_end = 0;
+	if (test_bit(info->flags, 9)) {
+		add_boot_string((char *)info->boot_loader_name);
+	}
 
+	/* si flags[3] = 1, se especificaron mdulos que deben ser cargados junto
+	 * con el kernel*/
 	if (test_bit(info->flags, 3)) {
 		mod_info_t * mod_info;
 		/*
 		printf("Modules available!. Start: %u Count: %u\n", info->mods_addr,
 				info->mods_count);
 		*/
+		add_boot_range(info->mods_addr, info->mods_count * sizeof(mod_info_t),
+				BOOT_RANGE_MULTIBOOT);
+
 		for (mod_info = (mod_info_t*)info->mods_addr, mod_count=0;
 				mod_count <info->mods_count;
 				mod_count++, mod_info++) {
@@ -124,16 +300,16 @@ void setup_memory(void){
 			printf("[%d] start: %u end: %u cmdline: %s \n", mod_count,
 					mod_info->mod_start, mod_info->mod_end,
 					mod_info->string);*/
-			if (mod_info->mod_end > mods_end) {
-				/* Los modulos se redondean a limites de 4 KB, redondear
-				 * la direccin final del modulo a un limite de 4096 */
-				mods_end = mod_info->mod_end + (mod_info->mod_end % 4096);
-			}
+			/* Los modulos inician en un limite de 4 KB. add_boot_range()
+			 * redondea el final del modulo al siguiente limite de 4 KB, de
+			 * forma que la ultima unidad del modulo no se entregue */
+			add_boot_range(mod_info->mod_start,
+					mod_info->mod_end - mod_info->mod_start,
+					BOOT_RANGE_MODULE);
+			add_boot_string(mod_info->string);
 		}
 	}
 
-	//printf("Mods end: %u\n", mods_end);
-
 	/* si flags[6] = 1, los campos mmap_length y mmap_addr son validos */
 
 	/* Revisar las regiones de memoria, y extraer la region de memoria
@@ -144,7 +320,7 @@ void setup_memory(void){
 	memory_start = 0;
 	memory_length = 0;
 
-	free_units = 0;
+	memory_allocator.free_units = 0;
 
 	/**@brief inicio pemitido para liberar
 	 * Suponer que el inicio de la memoria disponible se encuentra
@@ -176,10 +352,12 @@ void setup_memory(void){
 	  /** Verificar si la regin de memoria cumple con las condiciones
 	   * para ser considerada "memoria disponible".
 	   *
-	   * Importante: Si se supone un procesador de 32 bits, los valores
-	   * de la parte alta de base y length (base_addr_high y
-	   * length_high) son cero. Por esta razon se pueden ignorar y solo
-	   * se usan los 32 bits menos significativos de base y length.
+	   * Importante: Los valores de la parte alta de base y length
+	   * (base_addr_high y length_high) solo son diferentes de cero para
+	   * la memoria por encima de 4 GB. Esa memoria (o la parte de una
+	   * regin que supere LOW_MEMORY_LIMIT) se registra como una regin
+	   * alta con su propio mapa de bits, y memory_bitmap solo usa los 32
+	   * bits menos significativos de base y length.
 	   *
 	   * Para que una region de memoria sea considerada "memoria
 	   * disponible", debe cumplir con las siguientes condiciones:
@@ -190,11 +368,22 @@ void setup_memory(void){
 	   * */
 		 /* La region esta marcada como disponible y su direccin base
 		  * esta por encima de la posicion del kernel en memoria ?*/
-		 if (mmap->type == 1 &&
-			 mmap->base_addr_low >= multiboot_header.kernel_start) {
+		 if (mmap->type == 1) {
+			 register_high_region(mmap);
+		 }
+
+		 if (mmap->type == 1 && mmap->base_addr_high == 0 &&
+			 mmap->base_addr_low >= multiboot_header.kernel_start &&
+			 mmap->base_addr_low < LOW_MEMORY_LIMIT) {
 			 tmp_start = mmap->base_addr_low;
 			 tmp_length = mmap->length_low;
 
+			 /* Recortar la region al limite de memory_bitmap */
+			 if (mmap->length_high != 0 ||
+					 tmp_length > LOW_MEMORY_LIMIT - tmp_start) {
+				 tmp_length = LOW_MEMORY_LIMIT - tmp_start;
+			 }
+
 			 /* Verificar si el kernel se encuentra en esta region */
 			 if (multiboot_header.bss_end >= tmp_start &&
 					 multiboot_header.bss_end <= tmp_start + tmp_length) {
@@ -205,18 +394,11 @@ void setup_memory(void){
 				 */
 				 tmp_start = multiboot_header.bss_end;
 
-				 /* Ahora verificar si ser cargaron modulos junto con el
-				  * kernel. Estos modulos se cargan en regiones continuas
-				  * al kernel.
-				  * Si es asi, la nueva posicion inicial de la memoria
-				  * disponible es la posicion en la cual terminan los modulos
-				  * */
-				 if (mods_end > 0 &&
-						 mods_end >= tmp_start &&
-						 mods_end <= tmp_start + tmp_length) {
-						//printf("Adding module space...\n");
-						tmp_start = mods_end;
-				 }
+				 /* Los modulos que GRUB carga a continuacion del kernel
+				  * quedan dentro de la region. Sus unidades se marcan como
+				  * ocupadas con reserve_boot_ranges(), y se pueden devolver
+				  * al mapa de bits con free_boot_modules(). */
+
 				 /* Restar al espacio disponible.*/
 				 tmp_length -= tmp_start - mmap->base_addr_low;
 				 if (tmp_length > memory_length) {
@@ -247,7 +429,7 @@ void setup_memory(void){
 
 		tmp_start = memory_start;
 		/* Calcular la direccin en la cual finaliza la memoria disponible */
-		tmp_end = tmp_start + tmp_length;
+		tmp_end = tmp_start + memory_length;
 
 		/* Redondear el inicio y el fin de la regin de memoria disponible a
 		 * unidades de memoria */
@@ -263,190 +445,348 @@ void setup_memory(void){
 		memory_length = tmp_length;
 
 		/* Marcar la regin de memoria como disponible */
-		free_region((char*)memory_start, memory_length);
+		release_region(memory_start, memory_start + memory_length);
 
 		/* Establecer la direccin de memoria a partir
 		 * de la cual se puede liberar memoria */
 		allowed_free_start = memory_start;
-		next_free_unit = allowed_free_start / MEMORY_UNIT_SIZE;
+		memory_allocator.next_free_unit = allowed_free_start / MEMORY_UNIT_SIZE;
+		this_cpu_write(next_free_unit, memory_allocator.next_free_unit);
+
+		/* Rango de unidades que gestiona el asignador por defecto */
+		memory_allocator.total_units = memory_length / MEMORY_UNIT_SIZE;
+		memory_allocator.first_unit = memory_allocator.next_free_unit;
+
+		/* Marcar como ocupadas las unidades de los modulos y de las
+		 * estructuras de GRUB que se encuentran dentro de la region */
+		reserve_boot_ranges();
 
-		total_units = free_units;
-		base_unit = next_free_unit;
+		/* Marcas de agua por defecto: 1/128, 1/64 y 1/32 de la memoria */
+		set_memory_watermarks(memory_allocator.total_units / 128,
+				memory_allocator.total_units / 64,
+				memory_allocator.total_units / 32);
+
+		/* Crear los mapas de bits de las regiones por encima de 4 GB */
+		setup_high_memory();
+
+		/* Llenar el pool de emergencia para los manejadores de IRQ */
+		balance_emergency_pool();
 
 		/* printf("Available memory at: 0x%x units: %d Total memory: %d\n",
-				memory_start, total_units, memory_length);*/
+				memory_start, memory_allocator.total_units, memory_length);*/
 	}
  }
 
-/** @brief Permite verificar si la unidad se encuentra disponible.
- * @param unit unidad a verificar
- * @return int que es la direccion en donde empieza la unidad de memoria
- *
- * @verbatim
-   Ejemplo
-   unit = 1000000 (bytes)
-   entry= 1000000/ 32 (bytes) =31250 (bytes)
-   offset= 1000000 % 32 =0
-   retorna memory_bitmap[31250] & 0x1 << 0
-   si retorna un 1 significa que la unidad se encuentra libre
-   si retorna 0 significa que la unidad se encuentra ocupada.
-
-                        ....   1    0
-                  ---------------------
-31250 --------->  |   |   |   |   | x |  <---------- x = bit a verificar
-                  ---------------------
-                  |   |   |   |   |   |
-                  ---------------------
-                            ....
+/**
+ * @brief Busca y toma una unidad libre del mapa de bits, a partir del
+ * cursor del procesador actual.
+ * @return Direccin de inicio de la unidad, 0 si no se encontr ninguna.
+ @verbatim
+  El llamador ya debe haber descontado la unidad de free_units (o de
+  reserved_units). Si otro procesador toma la unidad entre bitmap_test_unit() y
+  bitmap_clear_unit(), la bsqueda contina con la siguiente unidad.
+ @endverbatim*/
+static char * claim_unit(void) {
+	 unsigned int unit;
+	 char * addr;
+
+	 /* Con varios nodos NUMA, asignar primero del nodo local y luego de
+	  * los nodos mas cercanos */
+	 if (numa_node_count > 1) {
+		 addr = claim_local_unit();
+		 if (addr != 0) {
+			 return addr;
+		 }
+	 }
 
+	 /* Cada procesador tiene su propio cursor (ver percpu.h), por lo cual
+	  * los procesadores no comparten la linea de cache del cursor */
+	 unit = bitmap_claim(&memory_allocator, &this_cpu_ptr()->next_free_unit, 1);
+	 if (unit == BITMAP_NO_UNIT) {
+		 return 0;
+	 }
 
-  @endverbatim
+	 node_account(unit, -1);
+	 return (char*)(unit * MEMORY_UNIT_SIZE);
+ }
+
+/**
+ * @brief Marca una unidad como libre en el mapa de bits y actualiza los
+ * contadores, sin equilibrar el pool de emergencia.
+ * @param unit Unidad a liberar
+ * @return 1 si la unidad se liber, 0 si ya se encontraba libre.
  */
-static __inline__ int test_unit(unsigned int unit) {
-	 volatile entry = unit / BITS_PER_ENTRY;
-	 volatile offset = unit % BITS_PER_ENTRY;
-	 return (memory_bitmap[entry] & 0x1 << offset);
-}
+static int release_unit(unsigned int unit) {
+	 /* Una unidad liberada dos veces no se cuenta dos veces */
+	 if (!bitmap_release(&memory_allocator, unit)) {
+		 return 0;
+	 }
 
+	 /* Marcar la unidad recien liberada como la proxima unidad
+	  * para asignar */
+	 this_cpu_write(next_free_unit, unit);
 
-/** @brief  Permite marcar la unidad como ocupada.
- * @param unit unidad a verificar
-*@verbatim
-   Ejemplo:
-   unit= 1000000 (bytes)
-   entry = 1000000/32 = 31250 (bytes)
-   offset = 1000000 % 32 = 0
-   memory_bitmap[31250] &= ~(0x1 << 0)
-   esto quiere decir que la unidad 1000000 que se va a marcar como ocupada (0)
-   se encuentra ubicada dentro del mapa de bits en la region 31250 en el bit 0
-   en esa region tal como se muestra en la siguiente figura
-
-               ....
-    -------------------------
-    | 1 | 1 | 1 | 1 | 1 | 1 |
-    -------------------------
-    | 1 | 1 | 1 | 1 | 1 | 0 | <----- bit 0 de la posicion 31250
-    -------------------------            de memory_bitmap
-    | 1 | 1 | 1 | 1 | 1 | 1 |
-    -------------------------
-               .....
-    @endverbatim
-   */
-static __inline__ void clear_unit(unsigned int unit) {
-	 volatile entry = unit / BITS_PER_ENTRY;
-	 volatile offset = unit % BITS_PER_ENTRY;
-	 memory_bitmap[entry] &= ~(0x1 << offset);
-}
+	 node_account(unit, 1);
+	 return 1;
+ }
 
-/** @brief Permite marcar la unidad como libre.
- *@param unit unidad a verificar
+/**
+ * @brief Toma una unidad de la cache del procesador actual. Si la cache
+ * est vaca, se recarga con CPU_UNIT_CACHE_BATCH unidades del mapa de bits.
+ * @return Direccin de inicio de la unidad, 0 si no fue posible recargar la
+ * cache.
  @verbatim
-   Ejemplo:
-   unit= 335000 (bytes)
-   entry = 335000/32 = 10468 (bytes)
-   offset = 335000 % 32 = 24
-   memory_bitmap[10468] &= ~(0x1 << 24)
-   esto quiere decir que la unidad 335000 que se va a marcar como libre (1)
-   se encuentra ubicada dentro del mapa de bits en la region 10468 en el bit 24
-   en esa region tal como se muestra en la siguiente figura.
-
-       bit 24 de la posicion 10468 de memory_bitmap
-              |
-              |
-              V  ....
-    ---------------------------
-    | 0 | 0 | 1|...| 0 | 0 | 0 |
-    ---------------------------
-    | 1 | 1 | 1|...| 1 | 1 | 1 |
-    ---------------------------
-    | 0 | 0 | 0|...| 0 | 0 | 0 |
-    ---------------------------
-    | 1 | 1 | 1|...| 1 | 1 | 1 |
-    ---------------------------
-               .....
-    @endverbatim
+  Cada cache solo es accedida por su procesador, y nunca desde un manejador
+  de IRQ (allocate_unit() y free_unit() usan el pool de emergencia dentro de
+  una interrupcin), por lo cual no requiere operaciones atmicas.
+ @endverbatim*/
+static char * cpu_cache_alloc(void) {
+	 cpu_unit_cache_t * cache;
+	 char * addr;
+	 int n;
 
-  */
-static __inline__ void set_unit(unsigned int unit) {
-	 volatile entry = unit / BITS_PER_ENTRY;
-	 volatile offset = unit % BITS_PER_ENTRY;
-	 memory_bitmap[entry] |= (0x1 << offset);
-}
+	 cache = &this_cpu_ptr()->unit_cache;
+
+	 if (cache->count == 0) {
+		 check_watermarks();
+		 if (!atomic_take(&memory_allocator.free_units, CPU_UNIT_CACHE_BATCH)) {
+			 return 0;
+		 }
+		 for (n=0; n<CPU_UNIT_CACHE_BATCH; n++) {
+			 addr = claim_unit();
+			 if (addr == 0) {
+				 break;
+			 }
+			 cache->unit[cache->count++] = (unsigned int)addr / MEMORY_UNIT_SIZE;
+		 }
+		 if (n < CPU_UNIT_CACHE_BATCH) {
+			 atomic_add(&memory_allocator.free_units, CPU_UNIT_CACHE_BATCH - n);
+		 }
+		 if (cache->count == 0) {
+			 return 0;
+		 }
+	 }
+
+	 cache->count--;
+	 return (char*)(cache->unit[cache->count] * MEMORY_UNIT_SIZE);
+ }
+
+/**
+ * @brief Almacena una unidad en la cache del procesador actual. Si la cache
+ * est llena, se devuelven CPU_UNIT_CACHE_BATCH unidades al mapa de bits.
+ * @param unit Unidad liberada
+ @verbatim
+  Una unidad que ya se encuentra libre en el mapa de bits o dentro de la
+  cache se ignora, al igual que en release_unit(): almacenarla de nuevo
+  hara que se entregara dos veces.
+ @endverbatim*/
+static void cpu_cache_free(unsigned int unit) {
+	 cpu_unit_cache_t * cache;
+	 int n;
+
+	 cache = &this_cpu_ptr()->unit_cache;
+
+	 if (!bitmap_unit_in_range(&memory_allocator, unit) ||
+			 bitmap_test_unit(&memory_allocator, unit)) {
+		 return;
+	 }
+	 for (n=0; n<cache->count; n++) {
+		 if (cache->unit[n] == unit) {
+			 return;
+		 }
+	 }
+
+	 if (cache->count == CPU_UNIT_CACHE_SIZE) {
+		 for (n=0; n<CPU_UNIT_CACHE_BATCH; n++) {
+			 release_unit(cache->unit[--cache->count]);
+		 }
+	 }
+
+	 cache->unit[cache->count++] = unit;
+ }
+
+/**
+ * @brief Devuelve al mapa de bits las unidades de la cache del procesador
+ * actual.
+ * @return Nmero de unidades devueltas
+ */
+unsigned int drain_cpu_unit_cache(void) {
+	 cpu_unit_cache_t * cache;
+	 unsigned int n;
+
+	 cache = &this_cpu_ptr()->unit_cache;
+
+	 n = 0;
+	 while (cache->count > 0) {
+		 release_unit(cache->unit[--cache->count]);
+		 n++;
+	 }
+	 return n;
+ }
 
 
 /**
  @brief Busca una unidad libre dentro del mapa de bits de memoria.
  * @return Direccin de inicio de la unidad en memoria.
  * @verbatim
-   Al inicio de esta funcion se verifica si no existen unidades
-  libres lo cual retornaria 0. caso contrario Busca una unidad de memoria
-  disponible. si al hacer la busqueda no encuentra una unidad disponible
-  dentro del mapa de bits entonces retornara 0, caso contrario retorna
-  la direccion de inicio de la unidad de memoria.
+   Al inicio de esta funcion se descuenta atomicamente una unidad de
+  free_units; si no existen unidades libres retornaria 0. caso contrario
+  Busca una unidad de memoria disponible y la toma con lock btr. si al hacer
+  la busqueda no encuentra una unidad disponible dentro del mapa de bits
+  entonces retornara 0, caso contrario retorna la direccion de inicio de la
+  unidad de memoria.
  @endverbatim
  */
   char * allocate_unit(void) {
-	 unsigned int unit; /**unit cuenta las unidades disponibles.*/
-	 unsigned int entry;
-	 unsigned int offset;
+	 char * addr;
 
+	 /* Un manejador de IRQ no puede invocar las rutinas de recuperacion:
+	  * tomar la unidad del pool de emergencia */
+	 if (in_interrupt()) {
+		 return allocate_emergency_unit();
+	 }
 
-	// printf ("%d ", free_units);
-	 /* Si no existen unidades libres, retornar*/
-	 if (free_units == 0) {
-		 //printf("Warning! out of memory!\n");
-		 return 0;
+	 /* Reponer el pool si algun manejador de IRQ lo ha consumido */
+	 if (emergency_count < EMERGENCY_POOL_UNITS) {
+		 balance_emergency_pool();
 	 }
 
-	/* Iterar por el mapa de bits*/
- 	unit = next_free_unit;
- 	 do {
- 		 if (test_unit(unit)) {
- 			 entry = unit / BITS_PER_ENTRY;
- 			 offset = unit % BITS_PER_ENTRY;
- 			 memory_bitmap[entry] &= ~(0x1 << offset);
-
- 			 /* printf("\tFree unit at %x offset %d %b %x\n",
- 					 unit * MEMORY_UNIT_SIZE,
- 					 offset, memory_bitmap[entry], &memory_bitmap[entry]);*/
- 			 /* Avanzar en la posicion de busqueda de la proxima unidad
- 			  * disponible */
- 			 next_free_unit++;
-			 if (next_free_unit > base_unit + total_units) {
-				 next_free_unit = base_unit;
-			 }
- 			/* Descontar la unidad tomada */
-
- 			free_units--;
- 			return (char*)(unit * MEMORY_UNIT_SIZE);
- 		 }
- 		unit++;
- 		if (unit > base_unit + total_units) {
- 			unit = base_unit;
- 		}
- 	 }while (unit != next_free_unit);
-
- 	 return 0;
+	 /* Con varios procesadores, tomar la unidad de la cache del procesador
+	  * actual sin tocar el mapa de bits global */
+	 if (online_cpus > 1) {
+		 addr = cpu_cache_alloc();
+		 if (addr != 0) {
+			 return addr;
+		 }
+	 }
+
+	 /* Pedir a las caches que se reduzcan si la memoria libre se
+	  * encuentra por debajo de las marcas de agua */
+	 check_watermarks();
+
+	 /* Descontar la unidad antes de buscarla. Si no existen unidades
+	  * libres (sin contar las reservadas), intentar recuperar memoria antes
+	  * de retornar */
+	 if (!atomic_take(&memory_allocator.free_units, 1)) {
+		 reclaim_memory(1);
+		 if (!atomic_take(&memory_allocator.free_units, 1)) {
+			 klog("Warning! out of memory!\n");
+			 return 0;
+		 }
+	 }
+
+	 addr = claim_unit();
+	 if (addr == 0) {
+		 atomic_add(&memory_allocator.free_units, 1);
+	 }
+	 return addr;
   }
 
 
+/**
+ * @brief Toma una regin de una clase de la cache de regiones.
+ * @param cache Clase de la cache
+ * @return Unidad inicial de la regin, 0 si la clase est vaca.
+ @verbatim
+  Cada posicin de la clase se toma con lock cmpxchg (0 = posicin vaca),
+  por lo cual no es necesario deshabilitar las interrupciones.
+ @endverbatim*/
+static unsigned int cache_pop(region_cache_t * cache) {
+	unsigned int i;
+	unsigned int start;
+
+	for (i=0; i<REGION_CACHE_DEPTH && cache->count > 0; i++) {
+		start = cache->start_unit[i];
+		if (start != 0 &&
+				atomic_cmpxchg(&cache->start_unit[i], start, 0) == start) {
+			atomic_add(&cache->count, -1);
+			atomic_add(&cached_units, -(int)cache->units);
+			return start;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Almacena una regin en una clase de la cache de regiones.
+ * @param cache Clase de la cache
+ * @param start Unidad inicial de la regin
+ * @return 1 si la regin se almacen, 0 si la clase est llena.
+ */
+static int cache_push(region_cache_t * cache, unsigned int start) {
+	unsigned int i;
+
+	for (i=0; i<REGION_CACHE_DEPTH && cache->count < REGION_CACHE_DEPTH;
+			i++) {
+		if (atomic_cmpxchg(&cache->start_unit[i], 0, start) == 0) {
+			atomic_add(&cache->count, 1);
+			atomic_add(&cached_units, cache->units);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Permite saber si una regin ya se encuentra en una clase de la
+ * cache de regiones.
+ * @param cache Clase de la cache
+ * @param start Unidad inicial de la regin
+ * @return 1 si la regin est en la clase, 0 si no
+ */
+static int cache_contains(region_cache_t * cache, unsigned int start) {
+	unsigned int i;
+
+	for (i=0; i<REGION_CACHE_DEPTH; i++) {
+		if (cache->start_unit[i] == start) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Permite saber si todas las unidades de una regin se encuentran
+ * marcadas como ocupadas en el mapa de bits.
+ * @param start Unidad inicial de la regin
+ * @param count Nmero de unidades
+ * @return 1 si todas las unidades estn ocupadas, 0 si alguna est libre.
+ */
+static int region_allocated(unsigned int start, unsigned int count) {
+	unsigned int i;
+
+	for (i=start; i<start + count; i++) {
+		if (!bitmap_unit_in_range(&memory_allocator, i) ||
+				bitmap_test_unit(&memory_allocator, i)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
   /** @brief Busca una regin de memoria contigua libre dentro del mapa de bits
    * de memoria.
    * @param length Tamao de la regin de memoria a asignar.
    * @return Direccin de inicio de la regin en memoria.
    * @verbatim
-     Al inicio de esta funcion se verifica si no existen regiones
-     libres lo cual retornaria 0. caso contrario Busca una region de memoria que tenga
+     Al inicio de esta funcion se descuentan atomicamente las unidades de
+     free_units; si no existen suficientes unidades libres retornaria 0. caso
+     contrario Busca una region de memoria que tenga
      un tamao mayor o igual a length disponible. si al hacer la busqueda no encuentra
      una region disponible dentro del mapa de bits entonces retornara 0, caso contrario retorna
      la direccion de inicio de la region de memoria.
+     Las unidades de la region se toman una por una con lock btr. Si otro
+     procesador toma una de ellas, se devuelven las que ya se habian tomado
+     y la busqueda continua.
     @endverbatim
    */
   char * allocate_unit_region(unsigned int length) {
 	unsigned int unit;
+	unsigned int start;
 	unsigned int unit_count;
 	unsigned int i;
-	int result;
+	int available;
+	region_cache_t * cache;
 
 	unit_count = (length / MEMORY_UNIT_SIZE);
 
@@ -456,52 +796,76 @@ static __inline__ void set_unit(unsigned int unit) {
 
 	//printf("\tAllocating %d units\n", unit_count);
 
-	if (free_units < unit_count) {
-		 //printf("Warning! out of memory!\n");
-		 return 0;
+	/* Si existe una region del mismo tamao en la cache, entregarla sin
+	 * recorrer el mapa de bits. Sus unidades siguen marcadas como ocupadas. */
+	for (i=0; i<REGION_CACHE_CLASSES; i++) {
+		cache = &region_cache[i];
+		if (cache->units == unit_count) {
+			start = cache_pop(cache);
+			if (start != 0) {
+				return (char*)(start * MEMORY_UNIT_SIZE);
+			}
+		}
 	}
 
-	/* Iterar por el mapa de bits*/
-	unit = next_free_unit;
+	/* Pedir a las caches que se reduzcan si la memoria libre se
+	 * encuentra por debajo de las marcas de agua */
+	check_watermarks();
 
-	 /* Iterar por el mapa de bits*/
-	unit = next_free_unit;
-	 do {
-		 if (test_unit(unit) &&
-				 (unit + unit_count) < (base_unit + total_units)) {
+	if (!atomic_take(&memory_allocator.free_units, unit_count)) {
+		 /* Presion de memoria: pedir a la cache de regiones y a las rutinas
+		  * de recuperacion que devuelvan la memoria que hace falta */
+		 available = memory_allocator.free_units;
+		 if (available < (int)unit_count) {
+			 reclaim_memory(unit_count - available);
+		 }
+		 if (!atomic_take(&memory_allocator.free_units, unit_count)) {
+			 klog("Warning! out of memory (%d units)!\n", unit_count);
+			 return 0;
+		 }
+	}
 
-			 result = 1;
-			 for (i=unit; i<unit + unit_count; i++){
-				 result = (result && test_unit(i));
-			 }
-			 /* Marcar la unidad como libre */
-			 if (result) {
-				 for (i=unit; i<unit + unit_count; i++){
-					 //printf("\tFree unit at %x\n", i *  MEMORY_UNIT_SIZE);
-					 /* Descontar la unidad tomada */
-					 free_units--;
-					 clear_unit(i);
-				 }
+	 /* Iterar por el mapa de bits, a partir del cursor del procesador */
+	unit = bitmap_claim(&memory_allocator, &this_cpu_ptr()->next_free_unit,
+			unit_count);
+	if (unit != BITMAP_NO_UNIT) {
+		for (i=unit; i<unit + unit_count; i++){
+			node_account(i, -1);
+		}
+		return (char*)(unit * MEMORY_UNIT_SIZE);
+	}
 
-				 /* Avanzar en la posicion de busqueda de la proxima unidad
-				 			  * disponible */
-				 next_free_unit = unit + unit_count;
-				 if (next_free_unit > base_unit + total_units) {
-					 next_free_unit = base_unit;
-				 }
+	 atomic_add(&memory_allocator.free_units, unit_count);
 
-				return (char*)(unit * MEMORY_UNIT_SIZE);
-			 }
-		 }
-		unit++;
-		if (unit > base_unit + total_units) {
-			unit = base_unit;
-		}
-	 }while (unit != next_free_unit);
+	 /* No se encontro una region contigua. Si la cache retiene regiones,
+	  * devolverlas al mapa de bits (pueden unirse con sus vecinas) y
+	  * reintentar la busqueda */
+	 if (cached_units > 0) {
+		 flush_region_cache();
+		 return allocate_unit_region(length);
+	 }
 
 	  return 0;
   }
 
+/**
+ * @brief Permite saber si una regin se puede devolver al mapa de bits.
+ * @param start Direccin de inicio de la regin
+ * @param length Tamao de la regin en bytes
+ * @return 1 si la regin se puede liberar, 0 si pertenece al kernel
+ @verbatim
+  Por debajo de allowed_free_start solo se aceptan las unidades de la
+  seccin .init, luego de que free_boot_memory() la devuelve al mapa de
+  bits. Las unidades de .data y .bss nunca se liberan.
+ @endverbatim*/
+static int free_allowed(unsigned int start, unsigned int length) {
+	 if (start >= allowed_free_start) {
+		 return 1;
+	 }
+	 return (start >= (unsigned int)init_start &&
+			 start + length <= released_init_end);
+ }
+
 /**
  * @brief Permite liberar una unidad de memoria.
  * @param addr Direccin de memoria dentro del rea a liberar.
@@ -513,24 +877,31 @@ static __inline__ void set_unit(unsigned int unit) {
  @endverbatim*/
 void free_unit(char * addr) {
 	 unsigned int start;
-	 unsigned int entry;
-	 int offset;
-	 unsigned int unit;
-
-	 start = round_down_to_memory_unit((unsigned int)addr);
 
-	 if (start < allowed_free_start) {return;}
+	 /* Dentro de un manejador de IRQ la unidad se devuelve al pool de
+	  * emergencia. El pool se equilibra en la proxima llamada fuera de
+	  * interrupcion. */
+	 if (in_interrupt()) {
+		 free_emergency_unit(addr);
+		 return;
+	 }
 
-	 unit = start / MEMORY_UNIT_SIZE;
+	 start = round_down_to_memory_unit((unsigned int)addr);
 
-	 set_unit(unit);
+	 if (!free_allowed(start, MEMORY_UNIT_SIZE)) {return;}
 
-	 /* Marcar la unidad recien liberada como la proxima unidad
-	  * para asignar */
-	 next_free_unit = unit;
+	 /* Con varios procesadores, devolver la unidad a la cache del
+	  * procesador actual */
+	 if (online_cpus > 1) {
+		 cpu_cache_free(start / MEMORY_UNIT_SIZE);
+	 }else {
+		 release_unit(start / MEMORY_UNIT_SIZE);
+	 }
 
-	 /* Aumentar en 1 el numero de unidades libres */
-	 free_units ++;
+	 /* Reponer el pool si algun manejador de IRQ lo ha consumido */
+	 if (emergency_count != EMERGENCY_POOL_UNITS) {
+		 balance_emergency_pool();
+	 }
 
  }
 
@@ -546,18 +917,1118 @@ void free_unit(char * addr) {
  @endverbatim*/
 void free_region(char * start_addr, unsigned int length) {
 	 unsigned int start;
-	 unsigned int end;
+	 unsigned int unit_count;
+	 unsigned int i;
+	 region_cache_t * cache;
 
 	 start = round_down_to_memory_unit((unsigned int)start_addr);
 
-	 if (start < allowed_free_start) {return;}
+	 unit_count = (length / MEMORY_UNIT_SIZE);
 
-	 end = start + length;
+	 if (length % MEMORY_UNIT_SIZE > 0) {
+		 unit_count++;
+	 }
+
+	 if (!free_allowed(start, unit_count * MEMORY_UNIT_SIZE)) {return;}
+
+	 /* Si la region corresponde a una clase de la cache y esta no se
+	  * encuentra llena, almacenarla para la proxima asignacion del mismo
+	  * tamao. Una region que ya estaba libre (o en la cache) no se
+	  * almacena: release_region() ignora las unidades libres, mientras que
+	  * la cache la entregaria dos veces */
+	 for (i=0; i<REGION_CACHE_CLASSES; i++) {
+		 cache = &region_cache[i];
+		 if (cache->units == unit_count &&
+				 region_allocated(start / MEMORY_UNIT_SIZE, unit_count) &&
+				 !cache_contains(cache, start / MEMORY_UNIT_SIZE) &&
+				 cache_push(cache, start / MEMORY_UNIT_SIZE)) {
+
+			 /* Si la cache retiene demasiada memoria respecto a la memoria
+			  * libre, el mapa de bits se fragmenta: devolverla */
+			 if (cached_units * REGION_CACHE_MAX_SHARE >
+					 memory_allocator.free_units + cached_units) {
+				 flush_region_cache();
+			 }
+			 return;
+		 }
+	 }
+
+	 release_region(start, start + length);
+
+	 /* Almacenar el inicio de la regin liberada para una prxima asignacin */
+	 this_cpu_write(next_free_unit, (unsigned int)start_addr / MEMORY_UNIT_SIZE);
+ }
 
+/**
+ * @brief Marca como disponibles en el mapa de bits las unidades que se
+ * encuentran entre start y end, sin pasar por la cache de regiones.
+ * @param start Direccin de inicio, alineada a MEMORY_UNIT_SIZE
+ * @param end Direccin final (no incluida)
+ */
+static void release_region(unsigned int start, unsigned int end) {
 	 for (; start < end; start += MEMORY_UNIT_SIZE) {
 		 free_unit((char*)start);
 	 }
+ }
 
-	 /* Almacenar el inicio de la regin liberada para una prxima asignacin */
-	 next_free_unit = (unsigned int)start_addr / MEMORY_UNIT_SIZE;
+/**
+ * @brief Devuelve al mapa de bits todas las regiones almacenadas en la
+ * cache de regiones liberadas.
+ @verbatim
+  Se invoca cuando no existe memoria suficiente en el mapa de bits para
+  atender una solicitud, o cuando la cache retiene mas de
+  1 / REGION_CACHE_MAX_SHARE de la memoria libre.
+ @endverbatim*/
+void flush_region_cache(void) {
+	 unsigned int i;
+	 unsigned int start;
+	 region_cache_t * cache;
+
+	 for (i=0; i<REGION_CACHE_CLASSES; i++) {
+		 cache = &region_cache[i];
+		 while ((start = cache_pop(cache)) != 0) {
+			 start *= MEMORY_UNIT_SIZE;
+			 release_region(start, start + cache->units * MEMORY_UNIT_SIZE);
+		 }
+	 }
+ }
+
+/**
+ * @brief Reserva unidades de memoria para garantizar que asignaciones
+ * posteriores con allocate_reserved_unit() no van a fallar.
+ * @param n Nmero de unidades a reservar
+ * @return 0 si la reserva se realiz, -1 si no existe memoria suficiente.
+ */
+int reserve_units(unsigned int n) {
+	 /* Las unidades reservadas se descuentan de free_units, de forma que
+	  * allocate_unit() no las puede tomar */
+	 if (!atomic_take(&memory_allocator.free_units, n)) {
+		 flush_region_cache();
+		 if (!atomic_take(&memory_allocator.free_units, n)) {
+			 return -1;
+		 }
+	 }
+
+	 atomic_add(&reserved_units, n);
+	 return 0;
+ }
+
+/**
+ * @brief Libera unidades reservadas con reserve_units() que no se van a usar.
+ * @param n Nmero de unidades a liberar de la reserva
+ */
+void unreserve_units(unsigned int n) {
+	 int available;
+
+	 available = reserved_units;
+	 if ((int)n > available) {
+		 n = available;
+	 }
+	 if (atomic_take(&reserved_units, n)) {
+		 atomic_add(&memory_allocator.free_units, n);
+	 }
+ }
+
+/**
+ * @brief Asigna una unidad tomndola de una reserva hecha con
+ * reserve_units().
+ * @return Direccin de inicio de la unidad en memoria.
+ @verbatim
+  Se descuenta una unidad de la reserva y se toma del mapa de bits sin
+  pasar por free_units. Si no existe reserva, se comporta igual que
+  allocate_unit().
+ @endverbatim*/
+char * allocate_reserved_unit(void) {
+	 char * addr;
+
+	 if (in_interrupt() || !atomic_take(&reserved_units, 1)) {
+		 return allocate_unit();
+	 }
+
+	 addr = claim_unit();
+	 if (addr == 0) {
+		 atomic_add(&reserved_units, 1);
+	 }
+	 return addr;
+ }
+
+/**
+ * @brief Toma una unidad del pool de emergencia, sin tocar el mapa de bits.
+ * @return Direccin de inicio de la unidad, 0 si el pool esta vacio.
+ @verbatim
+  Cada posicin del pool se toma con lock cmpxchg (0 = posicin vaca), por
+  lo cual esta rutina se puede invocar desde cualquier contexto. Si el pool
+  est vaco, la unidad se toma directamente del mapa de bits.
+ @endverbatim*/
+char * allocate_emergency_unit(void) {
+	 unsigned int i;
+	 unsigned int unit;
+	 char * addr;
+
+	 for (i=0; i<2 * EMERGENCY_POOL_UNITS && emergency_count > 0; i++) {
+		 unit = emergency_pool[i];
+		 if (unit != 0 &&
+				 atomic_cmpxchg(&emergency_pool[i], unit, 0) == unit) {
+			 atomic_add(&emergency_count, -1);
+			 return (char*)(unit * MEMORY_UNIT_SIZE);
+		 }
+	 }
+
+	 /* Pool vacio: tomar la unidad directamente del mapa de bits, sin
+	  * invocar las rutinas de recuperacion */
+	 if (!atomic_take(&memory_allocator.free_units, 1)) {
+		 return 0;
+	 }
+	 addr = claim_unit();
+	 if (addr == 0) {
+		 atomic_add(&memory_allocator.free_units, 1);
+	 }
+	 return addr;
+ }
+
+/**
+ * @brief Devuelve una unidad al pool de emergencia.
+ * @param addr Direccin de memoria dentro de la unidad a devolver
+ @verbatim
+  Si el pool esta lleno, la unidad se devuelve al mapa de bits con lock bts
+  (tambien dentro de un manejador de IRQ). Una unidad que ya se encuentra
+  libre en el mapa de bits o dentro del pool no se agrega al pool, ya que
+  se entregaria dos veces.
+ @endverbatim*/
+void free_emergency_unit(char * addr) {
+	 unsigned int i;
+	 unsigned int start;
+	 unsigned int unit;
+
+	 start = round_down_to_memory_unit((unsigned int)addr);
+
+	 if (!free_allowed(start, MEMORY_UNIT_SIZE)) {return;}
+
+	 unit = start / MEMORY_UNIT_SIZE;
+	 if (!bitmap_unit_in_range(&memory_allocator, unit) ||
+			 bitmap_test_unit(&memory_allocator, unit)) {
+		 return;
+	 }
+	 for (i=0; i<2 * EMERGENCY_POOL_UNITS; i++) {
+		 if (emergency_pool[i] == unit) {
+			 return;
+		 }
+	 }
+
+	 for (i=0; i<2 * EMERGENCY_POOL_UNITS; i++) {
+		 if (atomic_cmpxchg(&emergency_pool[i], 0, unit) == 0) {
+			 atomic_add(&emergency_count, 1);
+			 return;
+		 }
+	 }
+
+	 /* Pool lleno: devolver la unidad al mapa de bits */
+	 release_unit(unit);
+ }
+
+/**
+ * @brief Lleva el pool de emergencia a EMERGENCY_POOL_UNITS unidades,
+ * tomando o devolviendo unidades del mapa de bits. Solo se debe invocar
+ * fuera de interrupcion.
+ */
+static void balance_emergency_pool(void) {
+	 static volatile unsigned int balancing = 0;
+	 char * addr;
+
+	 /* allocate_unit() y free_unit() invocan esta rutina: evitar la
+	  * recursion. Tampoco se puede usar antes de configurar el mapa de bits */
+	 if (memory_allocator.total_units == 0 ||
+			 atomic_cmpxchg(&balancing, 0, 1) != 0) {
+		 return;
+	 }
+
+	 while (emergency_count < EMERGENCY_POOL_UNITS) {
+		 addr = allocate_unit();
+		 if (addr == 0) {
+			 break;
+		 }
+		 free_emergency_unit(addr);
+	 }
+
+	 while (emergency_count > EMERGENCY_POOL_UNITS) {
+		 addr = allocate_emergency_unit();
+		 if (addr == 0) {
+			 break;
+		 }
+		 release_unit((unsigned int)addr / MEMORY_UNIT_SIZE);
+	 }
+
+	 balancing = 0;
+ }
+
+/**
+ * @brief Configura las marcas de agua de memoria libre.
+ * @param min Marca mnima, en unidades
+ * @param low Marca baja, en unidades
+ * @param high Marca alta, en unidades
+ * @return 0 si las marcas son vlidas (min <= low <= high), -1 en caso
+ * contrario.
+ */
+int set_memory_watermarks(unsigned int min, unsigned int low,
+		unsigned int high) {
+	 if (min > low || low > high) {
+		 return -1;
+	 }
+	 watermark_min = min;
+	 watermark_low = low;
+	 watermark_high = high;
+	 return 0;
+ }
+
+/**
+ * @brief Registra una rutina de recuperacin de memoria.
+ * @param callback Rutina que se invoca cuando la memoria libre cae por
+ * debajo de las marcas de agua
+ * @return Posicin de la rutina en la tabla, -1 si la tabla est llena o la
+ * rutina ya se encontraba registrada.
+ */
+int register_reclaim_callback(reclaim_callback callback) {
+	 int i;
+	 int index;
+
+	 index = -1;
+	 for (i=0; i<MAX_RECLAIM_CALLBACKS; i++) {
+		 if (reclaim_callbacks[i] == callback) {
+			 printf("Error! reclaim callback was already set!\n");
+			 return -1;
+		 }
+		 if (reclaim_callbacks[i] == 0 && index < 0) {
+			 index = i;
+		 }
+	 }
+
+	 if (index >= 0) {
+		 reclaim_callbacks[index] = callback;
+	 }
+	 return index;
+ }
+
+/**
+ * @brief Quita una rutina de recuperacin de memoria.
+ * @param callback Rutina registrada con register_reclaim_callback()
+ */
+void unregister_reclaim_callback(reclaim_callback callback) {
+	 int i;
+
+	 for (i=0; i<MAX_RECLAIM_CALLBACKS; i++) {
+		 if (reclaim_callbacks[i] == callback) {
+			 reclaim_callbacks[i] = 0;
+		 }
+	 }
+ }
+
+/**
+ * @brief Recorre una vez las rutinas de recuperacin de memoria.
+ * @param units Nmero de unidades que se desea recuperar
+ * @return Nmero de unidades recuperadas
+ */
+static unsigned int reclaim_pass(unsigned int units) {
+	 unsigned int recovered;
+	 int i;
+
+	 recovered = 0;
+	 for (i=0; i<MAX_RECLAIM_CALLBACKS && recovered < units; i++) {
+		 if (reclaim_callbacks[i] != 0) {
+			 recovered += reclaim_callbacks[i](units - recovered);
+		 }
+	 }
+	 return recovered;
+ }
+
+/**
+ * @brief Intenta recuperar memoria de la cache de regiones y de las rutinas
+ * de recuperacin registradas.
+ * @param units Nmero de unidades que se desea recuperar
+ * @return Nmero de unidades recuperadas
+ @verbatim
+  Primero se devuelven la cache de regiones y la cache del procesador
+  actual al mapa de bits. Luego se
+  recorren las rutinas de recuperacin hasta recuperar el nmero de unidades
+  solicitado, o hasta que ninguna rutina pueda devolver ms memoria.
+ @endverbatim*/
+unsigned int reclaim_memory(unsigned int units) {
+	 unsigned int recovered;
+	 unsigned int pass;
+
+	 if (in_interrupt() || atomic_cmpxchg(&reclaiming, 0, 1) != 0) {
+		 return 0;
+	 }
+
+	 recovered = cached_units;
+	 flush_region_cache();
+
+	 /* Las caches de los demas procesadores solo pueden ser vaciadas por
+	  * ellos mismos */
+	 recovered += drain_cpu_unit_cache();
+
+	 while (recovered < units) {
+		 pass = reclaim_pass(units - recovered);
+		 if (pass == 0) {
+			 break;
+		 }
+		 recovered += pass;
+	 }
+
+	 reclaiming = 0;
+	 return recovered;
+ }
+
+/**
+ * @brief Verifica la memoria libre contra las marcas de agua, e invoca las
+ * rutinas de recuperacin de memoria si es necesario.
+ @verbatim
+  - Por encima de la marca baja no se realiza ninguna accin.
+  - Entre la marca mnima y la marca baja se recorren una vez las rutinas
+    de recuperacin, pidiendo la memoria necesaria para llegar a la marca
+    alta.
+  - Por debajo de la marca mnima se recupera memoria con reclaim_memory()
+    hasta llegar a la marca alta.
+ @endverbatim*/
+static void check_watermarks(void) {
+	 int available;
+
+	 available = memory_allocator.free_units;
+
+	 if (available >= watermark_low || reclaiming) {
+		 return;
+	 }
+
+	 if (available < watermark_min) {
+		 reclaim_memory(watermark_high - available);
+		 return;
+	 }
+
+	 if (atomic_cmpxchg(&reclaiming, 0, 1) != 0) {
+		 return;
+	 }
+	 reclaim_pass(watermark_high - available);
+	 reclaiming = 0;
+ }
+
+/**
+ * @brief Registra la parte de una regin del mapa de memoria de GRUB que se
+ * encuentra por encima de LOW_MEMORY_LIMIT.
+ * @param mmap Regin del mapa de memoria
+ @verbatim
+  Solo se almacenan los lmites de la regin, redondeados a marcos
+  completos. El mapa de bits se crea en setup_high_memory(), cuando
+  memory_bitmap ya se encuentra configurado.
+ @endverbatim*/
+static void __init register_high_region(memory_map_t * mmap) {
+	 frame_t start;
+	 frame_t end;
+	 memory_region_t * region;
+
+	 start = ((frame_t)mmap->base_addr_high << 32) | mmap->base_addr_low;
+	 end = start + (((frame_t)mmap->length_high << 32) | mmap->length_low);
+
+	 if (end <= LOW_MEMORY_LIMIT || high_region_count == MAX_HIGH_REGIONS) {
+		 return;
+	 }
+
+	 if (start < LOW_MEMORY_LIMIT) {
+		 start = LOW_MEMORY_LIMIT;
+	 }
+
+	 /* Redondear a marcos completos */
+	 start = address_to_frame(start + MEMORY_UNIT_SIZE - 1);
+	 end = address_to_frame(end);
+
+	 if (end <= start) {
+		 return;
+	 }
+
+	 region = &high_regions[high_region_count++];
+	 region->base_frame = start;
+	 /* Una region de mas de 2^32 marcos (16 TB) se recorta */
+	 if (end - start > 0xFFFFFFE0) {
+		 region->frames = 0xFFFFFFE0;
+	 }else {
+		 region->frames = (unsigned int)(end - start);
+	 }
+	 region->free_frames = 0;
+	 region->next_entry = 0;
+	 region->bitmap = 0;
+ }
+
+/**
+ * @brief Crea los mapas de bits de las regiones altas registradas.
+ @verbatim
+  La memoria por encima de 4 GB solo se puede acceder con PAE. Si el
+  procesador no soporta PAE, las regiones altas se descartan. En caso
+  contrario se crean sus mapas de bits, pero allocate_frame() no entrega
+  marcos altos hasta que high_frames_enabled valga 1. El mapa de
+  bits de cada regin se toma de memory_bitmap con allocate_unit_region(),
+  y solo cubre los marcos de la regin.
+ @endverbatim*/
+static void __init setup_high_memory(void) {
+	 unsigned int eax, ebx, ecx, edx;
+	 unsigned int entries;
+	 unsigned int i;
+	 int r;
+	 memory_region_t * region;
+
+	 if (high_region_count == 0) {
+		 return;
+	 }
+
+	 cpuid(1, &eax, &ebx, &ecx, &edx);
+	 if (!(edx & CPUID_EDX_PAE)) {
+		 printf("PAE not supported, ignoring memory above 4 GB\n");
+		 high_region_count = 0;
+		 return;
+	 }
+
+	 for (r=0; r<high_region_count; r++) {
+		 region = &high_regions[r];
+		 entries = (region->frames + BITS_PER_ENTRY - 1) / BITS_PER_ENTRY;
+		 region->bitmap = (unsigned int *)allocate_unit_region(
+				 entries * BYTES_PER_ENTRY);
+		 if (region->bitmap == 0) {
+			 printf("Not enough memory for the bitmap of region %d\n", r);
+			 continue;
+		 }
+
+		 /* Marcar todos los marcos de la region como disponibles */
+		 for (i=0; i<entries; i++) {
+			 region->bitmap[i] = 0xFFFFFFFF;
+		 }
+		 if (region->frames % BITS_PER_ENTRY) {
+			 region->bitmap[entries - 1] =
+					 (1 << (region->frames % BITS_PER_ENTRY)) - 1;
+		 }
+		 region->free_frames = region->frames;
+		 atomic_add(&free_high_frames, region->frames);
+	 }
+ }
+
+/**
+ * @brief Asigna un marco de memoria fsica, preferiblemente por encima de
+ * 4 GB.
+ * @return Nmero del marco asignado, 0 si no existe memoria disponible.
+ @verbatim
+  Si high_frames_enabled vale 1, se busca primero en las regiones altas,
+  para conservar la memoria baja (que se puede acceder sin paginacin)
+  para el kernel. Mientras la paginacin no use PAE los marcos altos no se
+  pueden mapear, por lo cual solo se asignan unidades de memory_bitmap.
+ @endverbatim*/
+frame_t allocate_frame(void) {
+	 int r;
+	 unsigned int entry;
+	 unsigned int entries;
+	 unsigned int offset;
+	 unsigned int value;
+	 unsigned int i;
+	 memory_region_t * region;
+	 char * addr;
+
+	 for (r=0; high_frames_enabled && r<high_region_count &&
+			 free_high_frames > 0; r++) {
+		 region = &high_regions[r];
+		 /* Descontar el marco antes de buscarlo */
+		 if (region->bitmap == 0 || !atomic_take(&region->free_frames, 1)) {
+			 continue;
+		 }
+		 entries = (region->frames + BITS_PER_ENTRY - 1) / BITS_PER_ENTRY;
+		 entry = region->next_entry;
+		 for (i=0; i<entries; i++) {
+			 /* Primer bit en 1 de la entrada. Si otro procesador lo toma
+			  * antes que lock btr, probar con el siguiente bit */
+			 while ((value = region->bitmap[entry]) != 0) {
+				 offset = __builtin_ctz(value);
+				 if (atomic_test_and_clear_bit(&region->bitmap[entry], offset)) {
+					 atomic_add(&free_high_frames, -1);
+					 region->next_entry = entry;
+					 return region->base_frame + entry * BITS_PER_ENTRY + offset;
+				 }
+			 }
+			 entry++;
+			 if (entry == entries) {
+				 entry = 0;
+			 }
+		 }
+		 atomic_add(&region->free_frames, 1);
+	 }
+
+	 addr = allocate_unit();
+	 return address_to_frame((unsigned int)addr);
+ }
+
+/**
+ * @brief Libera un marco asignado con allocate_frame().
+ * @param frame Nmero del marco a liberar
+ */
+void free_frame(frame_t frame) {
+	 int r;
+	 unsigned int index;
+	 memory_region_t * region;
+
+	 if (frame < address_to_frame(LOW_MEMORY_LIMIT)) {
+		 free_unit((char*)(unsigned int)frame_to_address(frame));
+		 return;
+	 }
+
+	 for (r=0; r<high_region_count; r++) {
+		 region = &high_regions[r];
+		 if (region->bitmap != 0 && frame >= region->base_frame &&
+				 frame < region->base_frame + region->frames) {
+			 index = (unsigned int)(frame - region->base_frame);
+			 if (atomic_test_and_set_bit(&region->bitmap[index / BITS_PER_ENTRY],
+					 index % BITS_PER_ENTRY)) {
+				 return; /* El marco ya se encontraba libre */
+			 }
+			 atomic_add(&free_high_frames, 1);
+			 atomic_add(&region->free_frames, 1);
+			 region->next_entry = index / BITS_PER_ENTRY;
+			 return;
+		 }
+	 }
+ }
+
+/**
+ * @brief Permite obtener el nodo NUMA al cual pertenece una unidad.
+ * @param unit Unidad de memory_bitmap
+ * @return ndice del nodo, -1 si la unidad no pertenece a ningn nodo.
+ */
+static int unit_node(unsigned int unit) {
+	 int i;
+
+	 for (i=0; i<numa_range_count; i++) {
+		 if (unit >= numa_ranges[i].start_unit &&
+				 unit < numa_ranges[i].end_unit) {
+			 return numa_ranges[i].node;
+		 }
+	 }
+	 return -1;
+ }
+
+/**
+ * @brief Actualiza el contador de unidades libres del nodo NUMA al cual
+ * pertenece una unidad.
+ * @param unit Unidad asignada o liberada
+ * @param delta -1 si la unidad se asign, 1 si se liber
+ */
+static void node_account(unsigned int unit, int delta) {
+	 int node;
+
+	 if (numa_node_count == 0) {
+		 return;
+	 }
+
+	 node = unit_node(unit);
+	 if (node >= 0) {
+		 atomic_add(&numa_nodes[node].free_units, delta);
+	 }
+ }
+
+/**
+ * @brief Busca una unidad libre dentro de los rangos de un nodo NUMA, a
+ * partir del cursor de cada rango.
+ * @param n ndice del nodo
+ * @return Direccin de inicio de la unidad, 0 si el nodo no tiene memoria.
+ * El llamador ya debe haber descontado la unidad de free_units.
+ @verbatim
+  Los rangos de varios nodos se pueden intercalar, por lo cual cada rango
+  del nodo se recorre por separado con bitmap_claim() sobre una copia de
+  memory_allocator limitada al rango: las entradas del mapa de bits sin
+  unidades libres se saltan completas.
+ @endverbatim*/
+static char * claim_node_unit(int n) {
+	 numa_node_t * node;
+	 numa_range_t * range;
+	 bitmap_allocator_t view;
+	 unsigned int unit;
+	 int i;
+
+	 node = &numa_nodes[n];
+
+	 if (node->free_units <= 0) {
+		 return 0;
+	 }
+
+	 view = memory_allocator;
+	 for (i=0; i<numa_range_count; i++) {
+		 range = &numa_ranges[i];
+		 if (range->node != n) {
+			 continue;
+		 }
+		 view.first_unit = range->start_unit;
+		 view.total_units = range->end_unit - range->start_unit;
+		 unit = bitmap_claim(&view, &range->next_free_unit, 1);
+		 if (unit != BITMAP_NO_UNIT) {
+			 atomic_add(&node->free_units, -1);
+			 return (char*)(unit * MEMORY_UNIT_SIZE);
+		 }
+	 }
+
+	 return 0;
+ }
+
+/**
+ * @brief Toma una unidad del nodo NUMA local, o del nodo ms cercano que
+ * tenga memoria disponible.
+ * @return Direccin de inicio de la unidad, 0 si ningn nodo tiene memoria.
+ */
+static char * claim_local_unit(void) {
+	 numa_node_t * local;
+	 char * addr;
+	 int i;
+
+	 local = &numa_nodes[current_numa_node()];
+
+	 for (i=0; i<numa_node_count; i++) {
+		 addr = claim_node_unit(local->fallback[i]);
+		 if (addr != 0) {
+			 return addr;
+		 }
+	 }
+	 return 0;
+ }
+
+/**
+ * @brief Almacena en el bloque de datos del procesador actual el nodo NUMA
+ * al cual pertenece.
+ @verbatim
+  Se invoca en el BSP desde setup_numa() y en cada AP desde ap_main(), de
+  forma que current_numa_node() no ejecute CPUID en cada asignacin. El
+  identificador del APIC local del procesador se obtiene de
+  CPUID.01H:EBX[31:24].
+ @endverbatim*/
+void numa_cpu_online(void) {
+	 unsigned int eax, ebx, ecx, edx;
+	 int node;
+
+	 node = 0;
+	 if (numa_node_count > 0) {
+		 cpuid(1, &eax, &ebx, &ecx, &edx);
+		 node = numa_apic_node[ebx >> 24];
+		 if (node > 0) {
+			 node--;
+		 }
+	 }
+	 this_cpu_write(numa_node, node);
+ }
+
+/**
+ * @brief Permite obtener el nodo NUMA del procesador actual.
+ * @return ndice del nodo, 0 si no existe informacin NUMA.
+ */
+int current_numa_node(void) {
+	 return this_cpu_read(numa_node);
+ }
+
+/**
+ * @brief Busca una unidad libre dentro de un nodo NUMA.
+ * @param node ndice del nodo
+ * @return Direccin de inicio de la unidad, 0 si el nodo no tiene memoria
+ * disponible.
+ */
+char * allocate_unit_node(int node) {
+	 char * addr;
+
+	 if (in_interrupt()) {
+		 return allocate_emergency_unit();
+	 }
+
+	 /* Sin informacion NUMA, toda la memoria pertenece al nodo 0 */
+	 if (numa_node_count == 0 && node == 0) {
+		 return allocate_unit();
+	 }
+
+	 if (node < 0 || node >= numa_node_count) {
+		 return 0;
+	 }
+
+	 check_watermarks();
+
+	 if (!atomic_take(&memory_allocator.free_units, 1)) {
+		 reclaim_memory(1);
+		 if (!atomic_take(&memory_allocator.free_units, 1)) {
+			 return 0;
+		 }
+	 }
+
+	 addr = claim_node_unit(node);
+	 if (addr == 0) {
+		 atomic_add(&memory_allocator.free_units, 1);
+	 }
+	 return addr;
+ }
+
+/**
+ * @brief Obtiene el nodo NUMA de un dominio de proximidad, crendolo si no
+ * existe.
+ * @param domain Dominio de proximidad ACPI
+ * @return ndice del nodo, -1 si no existe espacio para ms nodos.
+ */
+static int __init numa_domain_node(unsigned int domain) {
+	 int i;
+
+	 for (i=0; i<numa_node_count; i++) {
+		 if (numa_nodes[i].domain == domain) {
+			 return i;
+		 }
+	 }
+
+	 if (numa_node_count == MAX_NUMA_NODES) {
+		 return -1;
+	 }
+
+	 numa_nodes[numa_node_count].domain = domain;
+	 numa_nodes[numa_node_count].start_unit = 0xFFFFFFFF;
+	 numa_nodes[numa_node_count].end_unit = 0;
+	 return numa_node_count++;
+ }
+
+/**
+ * @brief Agrega un rango de memoria de la SRAT a un nodo NUMA.
+ * @param mem Estructura de afinidad de memoria de la SRAT
+ @verbatim
+  Solo se tiene en cuenta la parte del rango que se gestiona con
+  memory_bitmap.
+ @endverbatim*/
+static void __init numa_add_memory(srat_memory_affinity_t * mem) {
+	 unsigned int start;
+	 unsigned int end;
+	 int node;
+	 numa_range_t * range;
+
+	 if (!(mem->flags & SRAT_ENABLED) || mem->base_high != 0 ||
+			 mem->base_low >= LOW_MEMORY_LIMIT) {
+		 return;
+	 }
+
+	 start = round_up_to_memory_unit(mem->base_low) / MEMORY_UNIT_SIZE;
+	 if (mem->length_high != 0 ||
+			 mem->length_low > LOW_MEMORY_LIMIT - mem->base_low) {
+		 end = LOW_MEMORY_LIMIT / MEMORY_UNIT_SIZE;
+	 }else {
+		 end = (mem->base_low + mem->length_low) / MEMORY_UNIT_SIZE;
+	 }
+
+	 /* Recortar el rango a las unidades gestionadas */
+	 if (start < memory_allocator.first_unit) {
+		 start = memory_allocator.first_unit;
+	 }
+	 if (end > memory_allocator.first_unit + memory_allocator.total_units) {
+		 end = memory_allocator.first_unit + memory_allocator.total_units;
+	 }
+	 if (start >= end || numa_range_count == MAX_NUMA_RANGES) {
+		 return;
+	 }
+
+	 node = numa_domain_node(mem->domain);
+	 if (node < 0) {
+		 return;
+	 }
+
+	 range = &numa_ranges[numa_range_count++];
+	 range->start_unit = start;
+	 range->end_unit = end;
+	 range->node = node;
+	 range->next_free_unit = start;
+
+	 if (start < numa_nodes[node].start_unit) {
+		 numa_nodes[node].start_unit = start;
+	 }
+	 if (end > numa_nodes[node].end_unit) {
+		 numa_nodes[node].end_unit = end;
+	 }
+ }
+
+/**
+ * @brief Calcula el orden en el cual se buscan unidades en los nodos cuando
+ * el nodo local no tiene memoria disponible.
+ @verbatim
+  Si existe la tabla SLIT, los nodos se ordenan por distancia al nodo
+  local. En caso contrario se usa el orden de los nodos a partir del nodo
+  local.
+ @endverbatim*/
+static void __init numa_build_fallback(void) {
+	 acpi_slit_t * slit;
+	 unsigned int localities;
+	 unsigned int dist_i, dist_j;
+	 int n, i, j, tmp;
+	 numa_node_t * node;
+
+	 slit = (acpi_slit_t *)acpi_find_table("SLIT");
+	 localities = (slit != 0 && slit->localities_high == 0) ?
+			 slit->localities_low : 0;
+
+	 for (n=0; n<numa_node_count; n++) {
+		 node = &numa_nodes[n];
+		 for (i=0; i<numa_node_count; i++) {
+			 node->fallback[i] = (n + i) % numa_node_count;
+		 }
+
+		 if (node->domain >= localities) {
+			 continue;
+		 }
+
+		 /* Ordenar por distancia (el nodo local tiene la menor distancia) */
+		 for (i=1; i<numa_node_count; i++) {
+			 for (j=i+1; j<numa_node_count; j++) {
+				 if (numa_nodes[node->fallback[i]].domain >= localities ||
+					 numa_nodes[node->fallback[j]].domain >= localities) {
+					 continue;
+				 }
+				 dist_i = slit->distance[node->domain * localities +
+						 numa_nodes[node->fallback[i]].domain];
+				 dist_j = slit->distance[node->domain * localities +
+						 numa_nodes[node->fallback[j]].domain];
+				 if (dist_j < dist_i) {
+					 tmp = node->fallback[i];
+					 node->fallback[i] = node->fallback[j];
+					 node->fallback[j] = tmp;
+				 }
+			 }
+		 }
+	 }
+ }
+
+/**
+ * @brief Construye los nodos NUMA a partir de la tabla SRAT de ACPI. Se
+ * debe invocar despus de setup_memory() y setup_acpi().
+ @verbatim
+  Por cada dominio de proximidad de la SRAT se crea un nodo, con los rangos
+  de memory_bitmap que le pertenecen, su propio cursor de bsqueda y sus
+  contadores. Las estructuras de afinidad de procesador permiten saber a
+  qu nodo pertenece cada APIC local.
+ @endverbatim*/
+void __init setup_numa(void) {
+	 acpi_srat_t * srat;
+	 char * ptr;
+	 char * end;
+	 srat_processor_affinity_t * cpu;
+	 int node;
+	 int i;
+	 unsigned int unit;
+
+	 srat = (acpi_srat_t *)acpi_find_table("SRAT");
+	 if (srat == 0) {
+		 return;
+	 }
+
+	 ptr = (char *)srat + sizeof(acpi_srat_t);
+	 end = (char *)srat + srat->header.length;
+
+	 while (ptr + 2 <= end && ptr[1] != 0) {
+		 if (ptr[0] == SRAT_MEMORY_AFFINITY) {
+			 numa_add_memory((srat_memory_affinity_t *)ptr);
+		 }else if (ptr[0] == SRAT_PROCESSOR_AFFINITY) {
+			 cpu = (srat_processor_affinity_t *)ptr;
+			 if (cpu->flags & SRAT_ENABLED) {
+				 node = numa_domain_node(cpu->domain_low |
+						 (cpu->domain_high[0] << 8) |
+						 (cpu->domain_high[1] << 16) |
+						 (cpu->domain_high[2] << 24));
+				 if (node >= 0) {
+					 numa_apic_node[cpu->apic_id] = node + 1;
+				 }
+			 }
+		 }
+		 ptr += (unsigned char)ptr[1];
+	 }
+
+	 /* Contar las unidades de cada nodo */
+	 for (i=0; i<numa_node_count; i++) {
+		 if (numa_nodes[i].start_unit > numa_nodes[i].end_unit) {
+			 /* Nodo sin memoria (solo procesadores) */
+			 numa_nodes[i].start_unit = 0;
+			 numa_nodes[i].end_unit = 0;
+		 }
+	 }
+	 for (i=0; i<numa_range_count; i++) {
+		 for (unit = numa_ranges[i].start_unit;
+				 unit < numa_ranges[i].end_unit; unit++) {
+			 numa_nodes[numa_ranges[i].node].total_units++;
+			 if (bitmap_test_unit(&memory_allocator, unit)) {
+				 numa_nodes[numa_ranges[i].node].free_units++;
+			 }
+		 }
+	 }
+
+	 numa_build_fallback();
+
+	 /* Nodo del BSP. Los AP lo obtienen al arrancar */
+	 numa_cpu_online();
+
+	 for (i=0; i<numa_node_count; i++) {
+		 printf("NUMA node %d: domain %d units %d free %d\n", i,
+				 numa_nodes[i].domain, numa_nodes[i].total_units,
+				 numa_nodes[i].free_units);
+	 }
+ }
+
+/**
+ * @brief Registra un rango de memoria usado durante el arranque.
+ * @param start Direccin de inicio del rango
+ * @param length Tamao del rango en bytes
+ * @param type Tipo de rango (BOOT_RANGE_*)
+ @verbatim
+  El inicio se redondea hacia abajo y el final hacia arriba a lmites de
+  MEMORY_UNIT_SIZE, de forma que todas las unidades que contienen parte del
+  rango queden protegidas.
+ @endverbatim*/
+static void __init add_boot_range(unsigned int start, unsigned int length,
+		int type) {
+	 boot_range_t * range;
+
+	 if (length == 0 || boot_range_count == MAX_BOOT_RANGES) {
+		 return;
+	 }
+
+	 range = &boot_ranges[boot_range_count++];
+	 range->start = round_down_to_memory_unit(start);
+	 range->end = round_up_to_memory_unit(start + length);
+	 range->type = type;
+ }
+
+/**
+ * @brief Registra la memoria que ocupa una cadena de caracteres de GRUB.
+ * @param str Cadena terminada en nulo
+ */
+static void __init add_boot_string(char * str) {
+	 unsigned int length;
+
+	 if (str == 0) {
+		 return;
+	 }
+
+	 for (length = 0; str[length] != 0; length++);
+
+	 add_boot_range((unsigned int)str, length + 1, BOOT_RANGE_MULTIBOOT);
+ }
+
+/**
+ * @brief Marca como ocupadas las unidades de los rangos de arranque que se
+ * encuentran dentro del rango de memory_allocator.
+ @verbatim
+  Se invoca desde setup_memory(), luego de marcar la regin de memoria
+  disponible como libre y antes de la primera asignacin.
+ @endverbatim*/
+static void __init reserve_boot_ranges(void) {
+	 int i;
+	 unsigned int unit;
+	 unsigned int end;
+
+	 for (i=0; i<boot_range_count; i++) {
+		 unit = boot_ranges[i].start / MEMORY_UNIT_SIZE;
+		 end = boot_ranges[i].end / MEMORY_UNIT_SIZE;
+		 for (; unit < end; unit++) {
+			 if (bitmap_unit_in_range(&memory_allocator, unit) &&
+					 bitmap_clear_unit(&memory_allocator, unit)) {
+				 atomic_add(&memory_allocator.free_units, -1);
+			 }
+		 }
+	 }
+ }
+
+/**
+ * @brief Permite verificar si una unidad pertenece a un rango de arranque
+ * que an no ha sido liberado.
+ * @param unit Unidad de memory_bitmap
+ * @return 1 si la unidad pertenece a un rango en uso, 0 en caso contrario.
+ */
+static int in_boot_range(unsigned int unit) {
+	 int i;
+
+	 for (i=0; i<boot_range_count; i++) {
+		 if (boot_ranges[i].type != 0 &&
+				 unit >= boot_ranges[i].start / MEMORY_UNIT_SIZE &&
+				 unit < boot_ranges[i].end / MEMORY_UNIT_SIZE) {
+			 return 1;
+		 }
+	 }
+	 return 0;
+ }
+
+/**
+ * @brief Devuelve al mapa de bits las unidades de los rangos de arranque de
+ * un tipo.
+ * @param type Tipo de rango (BOOT_RANGE_*)
+ * @return Nmero de unidades liberadas
+ @verbatim
+  Una unidad compartida con un rango de otro tipo que sigue en uso (por
+  ejemplo, una cadena de GRUB ubicada en la ltima unidad de un mdulo) no
+  se libera.
+ @endverbatim*/
+static unsigned int release_boot_ranges(int type) {
+	 int i;
+	 unsigned int unit;
+	 unsigned int end;
+	 unsigned int n;
+
+	 n = 0;
+	 for (i=0; i<boot_range_count; i++) {
+		 if (boot_ranges[i].type != type) {
+			 continue;
+		 }
+		 boot_ranges[i].type = 0;
+
+		 unit = boot_ranges[i].start / MEMORY_UNIT_SIZE;
+		 end = boot_ranges[i].end / MEMORY_UNIT_SIZE;
+		 for (; unit < end; unit++) {
+			 if (bitmap_unit_in_range(&memory_allocator, unit) &&
+					 !in_boot_range(unit)) {
+				 n += release_unit(unit);
+			 }
+		 }
+	 }
+	 return n;
+ }
+
+/**
+ * @brief Devuelve al mapa de bits la memoria de los modulos cargados por
+ * GRUB.
+ * @return Nmero de unidades liberadas
+ */
+unsigned int free_boot_modules(void) {
+	 return release_boot_ranges(BOOT_RANGE_MODULE);
+ }
+
+/**
+ * @brief Devuelve al mapa de bits la memoria de la seccin .init y de las
+ * estructuras de informacin multiboot.
+ * @return Nmero de unidades liberadas
+ @verbatim
+  La seccin .init se encuentra entre el cdigo y los datos del kernel, por
+  debajo del rango de memory_allocator: el rango se extiende hasta el inicio
+  de la seccin. Las unidades de .data y .bss permanecen en 0 dentro del
+  mapa de bits, por lo cual nunca se entregan, y free_allowed() rechaza su
+  liberacin.
+ @endverbatim*/
+unsigned int free_boot_memory(void) {
+	 unsigned int unit;
+	 unsigned int end;
+	 unsigned int n;
+
+	 if (memory_allocator.total_units == 0) {
+		 return 0;
+	 }
+
+	 n = release_boot_ranges(BOOT_RANGE_MULTIBOOT);
+
+	 unit = (unsigned int)init_start / MEMORY_UNIT_SIZE;
+	 end = (unsigned int)init_end / MEMORY_UNIT_SIZE;
+
+	 if (unit < memory_allocator.first_unit) {
+		 memory_allocator.total_units += memory_allocator.first_unit - unit;
+		 memory_allocator.first_unit = unit;
+	 }
+
+	 /* Permitir que las unidades de .init (y solo ellas) se liberen de
+	  * nuevo con free_unit() luego de ser asignadas */
+	 released_init_end = (unsigned int)init_end;
+
+	 for (; unit < end; unit++) {
+		 n += release_unit(unit);
+	 }
+
+	 return n;
  }
@@ -9,6 +9,7 @@
 
 #include <pm.h>
 #include <stdio.h>
+#include <init.h>
 
 /** @brief Tabla Global de Descriptores (GDT). Es un arreglo de descriptores
  * de segmento. Segn el manual de Intel, esta tabla debe estar alineada a un
@@ -175,7 +176,7 @@ void setup_gdt_descriptor(unsigned short selector , unsigned int base,
  * uno de los cuales contiene la informacin de los segmentos en memoria.
  * Esta rutina realiza los siguientes pasos:
  * */
-void setup_gdt(void) {
+void __init setup_gdt(void) {
 
 	int i;
 
@@ -0,0 +1,238 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion del controlador del puerto serial COM1
+ * y del puerto de depuracion 0xE9.
+ */
+
+#include <serial.h>
+#include <asm.h>
+#include <idt.h>
+#include <irq.h>
+#include <init.h>
+
+/** @brief Buffer circular de transmision */
+static char serial_buffer[SERIAL_BUFFER_SIZE];
+
+/** @brief Posicion en la cual se almacena el proximo caracter. Las
+ * posiciones no se reducen modulo SERIAL_BUFFER_SIZE: head - tail es el
+ * numero de caracteres en el buffer. */
+static unsigned int serial_head;
+
+/** @brief Posicion del proximo caracter a transmitir */
+static unsigned int serial_tail;
+
+/** @brief Vale 1 si la IRQ4 se encuentra habilitada para transmitir */
+static int serial_tx_active;
+
+/** @brief Vale 1 si setup_serial() encontro el UART */
+static int serial_present;
+
+/** @brief Protege el buffer y los registros del UART. Se toma con las
+ * interrupciones deshabilitadas. */
+static volatile unsigned int serial_lock;
+
+/**
+ * @brief Deshabilita las interrupciones y toma serial_lock.
+ * @return Valor de EFLAGS para serial_unlock()
+ */
+static __inline__ unsigned int serial_lock_acquire(void) {
+	unsigned int flags;
+
+	flags = irq_save();
+	while (atomic_cmpxchg(&serial_lock, 0, 1) != 0) {
+		cpu_relax();
+	}
+	return flags;
+}
+
+/**
+ * @brief Libera serial_lock y restaura las interrupciones.
+ * @param flags Valor retornado por serial_lock_acquire()
+ */
+static __inline__ void serial_lock_release(unsigned int flags) {
+	inline_assembly("" : : : "memory");
+	serial_lock = 0;
+	irq_restore(flags);
+}
+
+/**
+ * @brief Copia a la FIFO del UART hasta UART_FIFO_SIZE caracteres del
+ * buffer, si la FIFO se encuentra vacia. Se invoca con serial_lock tomado.
+ @verbatim
+  Si quedan caracteres en el buffer se habilita la interrupcion THRE, que
+  llega cuando la FIFO se vacia de nuevo. Si el buffer quedo vacio, la
+  interrupcion se deshabilita.
+ @endverbatim*/
+static void serial_fill_fifo(void) {
+	int i;
+
+	if (inb(COM1_PORT + UART_LSR) & UART_LSR_THRE) {
+		for (i=0; i<UART_FIFO_SIZE && serial_tail != serial_head; i++) {
+			outb(COM1_PORT + UART_DATA,
+					serial_buffer[serial_tail++ % SERIAL_BUFFER_SIZE]);
+		}
+	}
+
+	if (serial_tail != serial_head) {
+		if (!serial_tx_active) {
+			serial_tx_active = 1;
+			outb(COM1_PORT + UART_IER, UART_IER_THRI);
+		}
+	}else if (serial_tx_active) {
+		serial_tx_active = 0;
+		outb(COM1_PORT + UART_IER, 0);
+	}
+}
+
+/**
+ * @brief Vacia el buffer esperando activamente a que la FIFO se vacie. Se
+ * invoca con serial_lock tomado.
+ */
+static void serial_drain(void) {
+	while (serial_tail != serial_head) {
+		while (!(inb(COM1_PORT + UART_LSR) & UART_LSR_THRE)) {
+			cpu_relax();
+		}
+		serial_fill_fifo();
+	}
+}
+
+/**
+ * @brief Manejador de la IRQ4.
+ * @param state Estado del procesador
+ */
+static void serial_handler(interrupt_state * state) {
+	unsigned int flags;
+
+	flags = serial_lock_acquire();
+	/* Leer IIR reconoce la interrupcion THRE */
+	inb(COM1_PORT + UART_IIR);
+	serial_fill_fifo();
+	serial_lock_release(flags);
+}
+
+/**
+ * @brief Inicializa COM1 e instala el manejador de la IRQ4.
+ * @return 0 si el UART existe, -1 en caso contrario.
+ @verbatim
+  1. Se programa el divisor (UART_CLOCK / SERIAL_BAUD) y el formato 8N1.
+  2. Se habilitan las FIFO. Si IIR no reporta FIFO, el UART no es un
+     16550A y no se usa.
+  3. En modo loopback se envia un byte y se verifica que se recibe.
+  4. Se activan DTR, RTS y OUT2, y se instala el manejador de la IRQ4. La
+     interrupcion THRE solo se habilita cuando hay caracteres pendientes.
+ @endverbatim*/
+int __init setup_serial(void) {
+	unsigned int divisor;
+
+	divisor = UART_CLOCK / SERIAL_BAUD;
+
+	outb(COM1_PORT + UART_IER, 0);
+	outb(COM1_PORT + UART_LCR, UART_LCR_DLAB);
+	outb(COM1_PORT + UART_DATA, divisor & 0xFF);
+	outb(COM1_PORT + UART_IER, divisor >> 8);
+	outb(COM1_PORT + UART_LCR, UART_LCR_8N1);
+	outb(COM1_PORT + UART_FCR, UART_FCR_ENABLE);
+
+	if ((inb(COM1_PORT + UART_IIR) & UART_IIR_FIFO) != UART_IIR_FIFO) {
+		return -1;
+	}
+
+	outb(COM1_PORT + UART_MCR, UART_MCR_LOOPBACK);
+	outb(COM1_PORT + UART_DATA, 0xAE);
+	if (inb(COM1_PORT + UART_DATA) != 0xAE) {
+		return -1;
+	}
+
+	outb(COM1_PORT + UART_MCR, UART_MCR_NORMAL);
+
+	serial_head = 0;
+	serial_tail = 0;
+	serial_tx_active = 0;
+	install_irq_handler(COM1_IRQ, serial_handler);
+	serial_present = 1;
+
+	return 0;
+}
+
+/**
+ * @brief Envia una cadena por el puerto serial. Cada LF se envia como CR LF.
+ * @param s Cadena
+ * @param length Numero de caracteres
+ @verbatim
+  Si el buffer se llena, se vacia esperando a la FIFO. Si el llamador tenia
+  las interrupciones deshabilitadas y no es un manejador de IRQ (arranque,
+  excepciones), la cadena se transmite antes de retornar, dado que la IRQ4
+  podria no llegar nunca.
+ @endverbatim*/
+void serial_write(char * s, unsigned int length) {
+	unsigned int flags;
+	unsigned int i;
+
+	if (!serial_present) {
+		return;
+	}
+
+	flags = serial_lock_acquire();
+
+	for (i=0; i<length; i++) {
+		if (serial_head - serial_tail >= SERIAL_BUFFER_SIZE - 1) {
+			serial_drain();
+		}
+		if (s[i] == '\n') {
+			serial_buffer[serial_head++ % SERIAL_BUFFER_SIZE] = '\r';
+		}
+		serial_buffer[serial_head++ % SERIAL_BUFFER_SIZE] = s[i];
+	}
+
+	if (!(flags & EFLAGS_IF) && !in_interrupt()) {
+		serial_drain();
+	}else {
+		serial_fill_fifo();
+	}
+
+	serial_lock_release(flags);
+}
+
+/**
+ * @brief Espera a que se transmitan todos los caracteres del buffer, sin
+ * usar la IRQ4. Se puede invocar con las interrupciones deshabilitadas
+ * (por ejemplo, antes de detener el sistema).
+ */
+void serial_flush(void) {
+	unsigned int flags;
+
+	if (!serial_present) {
+		return;
+	}
+
+	flags = serial_lock_acquire();
+	serial_drain();
+	serial_lock_release(flags);
+}
+
+/**
+ * @brief Verifica si el puerto 0xE9 se encuentra disponible.
+ * @return 0 si existe, -1 en caso contrario.
+ @verbatim
+  QEMU y Bochs retornan 0xE9 al leer el puerto; en un equipo real el
+  puerto no existe y la lectura retorna 0xFF.
+ @endverbatim*/
+int __init setup_debugcon(void) {
+	return (inb(DEBUGCON_PORT) == DEBUGCON_PORT) ? 0 : -1;
+}
+
+/**
+ * @brief Escribe una cadena en el puerto 0xE9.
+ * @param s Cadena
+ * @param length Numero de caracteres
+ */
+void debugcon_write(char * s, unsigned int length) {
+	inline_assembly("rep outsb"
+			: "+S" (s), "+c" (length)
+			: "d" (DEBUGCON_PORT)
+			: "memory");
+}
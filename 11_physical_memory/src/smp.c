@@ -0,0 +1,573 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion del arranque de los procesadores de
+ * aplicacion (AP) en un sistema multiprocesador.
+ * @details
+ * Los procesadores se obtienen de la MADT de ACPI o, si esta no existe, de
+ * la tabla de configuracion de la especificacion MP. Cada AP se arranca con
+ * la secuencia INIT - STARTUP - STARTUP, ejecuta el codigo de trampoline.S y
+ * queda a la espera de trabajo enviado con smp_call().
+ */
+
+#include <smp.h>
+#include <apic.h>
+#include <acpi.h>
+#include <asm.h>
+#include <pm.h>
+#include <physmem.h>
+#include <percpu.h>
+#include <stdio.h>
+#include <init.h>
+#include <fpu.h>
+#include <clock.h>
+#include <idt.h>
+
+/** @brief Procesadores encontrados en la MADT o en la tabla MP. El
+ * procesador 0 es el BSP. */
+cpu_t cpus[MAX_CPUS];
+
+/** @brief Numero de procesadores encontrados */
+int cpu_count;
+
+/** @brief Numero de procesadores en ejecucion */
+volatile int online_cpus;
+
+/** @brief Direccion fisica del APIC local */
+unsigned int lapic_base = LAPIC_DEFAULT_BASE;
+
+/** @brief Tope de la pila del AP que se esta arrancando. Lo usa ap_start
+ * (trampoline.S). */
+char * ap_boot_stack;
+
+/** @brief Selector del bloque de datos del AP que se esta arrancando. Lo
+ * carga ap_start en GS (trampoline.S). */
+unsigned short ap_boot_selector;
+
+/** @brief Indice + 1 de cada procesador, por identificador de APIC local
+ * (0 = desconocido) */
+static unsigned char apic_cpu[256];
+
+/** @brief Rutina enviada a los procesadores con smp_call() */
+static volatile smp_function smp_call_function;
+
+/** @brief Argumento de smp_call_function */
+static void * volatile smp_call_arg;
+
+/** @brief Numero de procesadores que deben ejecutar smp_call_function */
+static volatile int smp_call_cpus;
+
+/** @brief Se incrementa con cada llamada a smp_call() */
+static volatile int smp_call_generation;
+
+/** @brief Numero de AP que no han terminado la llamada actual */
+static volatile int smp_call_pending;
+
+/** @brief Ciclos empleados por cada procesador en la prueba de rendimiento */
+static unsigned long long benchmark_cycles[MAX_CPUS];
+
+/** @brief Inicio del codigo de arranque de los AP (trampoline.S) */
+extern char trampoline_start[];
+
+/** @brief Fin del codigo de arranque de los AP (trampoline.S) */
+extern char trampoline_end[];
+
+/**
+ * @brief Calcula la suma de chequeo de un area de memoria.
+ * @param ptr Inicio del area
+ * @param length Tamano del area en bytes
+ * @return Suma de todos los bytes del area. Para una tabla valida es 0.
+ */
+static unsigned char __init smp_checksum(unsigned char * ptr, unsigned int length) {
+	unsigned char sum;
+
+	sum = 0;
+	while (length-- > 0) {
+		sum += *ptr++;
+	}
+	return sum;
+}
+
+/**
+ * @brief Compara una firma de 4 caracteres.
+ * @return 1 si son iguales, 0 en caso contrario.
+ */
+static int __init same_signature(char * a, char * b) {
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+/**
+ * @brief Agrega un procesador a la tabla cpus.
+ * @param apic_id Identificador del APIC local del procesador
+ */
+static void __init add_cpu(unsigned char apic_id) {
+	if (cpu_count == MAX_CPUS || apic_cpu[apic_id] != 0) {
+		return;
+	}
+	cpus[cpu_count].apic_id = apic_id;
+	cpus[cpu_count].online = 0;
+	cpus[cpu_count].stack = 0;
+	cpus[cpu_count].data = 0;
+	cpu_count++;
+	apic_cpu[apic_id] = cpu_count;
+}
+
+/**
+ * @brief Obtiene los procesadores de la MADT de ACPI.
+ * @return 0 si se encontro la MADT, -1 en caso contrario.
+ */
+static int __init smp_find_madt(void) {
+	acpi_madt_t * madt;
+	madt_entry_t * entry;
+	madt_local_apic_t * lapic;
+	char * end;
+
+	madt = (acpi_madt_t *)acpi_find_table("APIC");
+	if (madt == 0) {
+		return -1;
+	}
+
+	lapic_base = madt->local_apic_address;
+
+	entry = (madt_entry_t *)((char *)madt + sizeof(acpi_madt_t));
+	end = (char *)madt + madt->header.length;
+	while ((char *)entry < end && entry->length > 0) {
+		if (entry->type == MADT_LOCAL_APIC) {
+			lapic = (madt_local_apic_t *)entry;
+			if (lapic->flags & MADT_ENABLED) {
+				add_cpu(lapic->apic_id);
+			}
+		}
+		entry = (madt_entry_t *)((char *)entry + entry->length);
+	}
+	return 0;
+}
+
+/**
+ * @brief Busca la estructura MP Floating Pointer en un area de memoria. La
+ * estructura se encuentra en un limite de 16 bytes.
+ * @param start Direccion de inicio del area
+ * @param end Direccion final del area
+ * @return Apuntador a la estructura, 0 si no se encontro.
+ */
+static mp_floating_t * __init find_mp_floating(unsigned int start,
+		unsigned int end) {
+	mp_floating_t * mp;
+
+	for (; start < end; start += 16) {
+		mp = (mp_floating_t *)start;
+		if (same_signature(mp->signature, MP_FLOATING_SIGNATURE) &&
+				smp_checksum((unsigned char *)mp, mp->length * 16) == 0) {
+			return mp;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Obtiene los procesadores de la tabla de configuracion MP.
+ * @return 0 si se encontro la tabla, -1 en caso contrario.
+ @verbatim
+  La estructura MP Floating Pointer se busca en el primer KB del EBDA, en el
+  ultimo KB de la memoria base y en el area de la BIOS 0xF0000 - 0xFFFFF.
+ @endverbatim*/
+static int __init smp_find_mp(void) {
+	mp_floating_t * mp;
+	mp_config_t * config;
+	mp_processor_t * processor;
+	unsigned char * entry;
+	unsigned int ebda;
+	unsigned int i;
+
+	ebda = (unsigned int)(*(unsigned short *)EBDA_SEGMENT_LOCATION) << 4;
+
+	mp = 0;
+	if (ebda != 0) {
+		mp = find_mp_floating(ebda, ebda + 1024);
+	}
+	if (mp == 0) {
+		mp = find_mp_floating(0x9FC00, 0xA0000);
+	}
+	if (mp == 0) {
+		mp = find_mp_floating(0xF0000, 0x100000);
+	}
+	if (mp == 0 || mp->config_address == 0) {
+		return -1;
+	}
+
+	config = (mp_config_t *)mp->config_address;
+	if (!same_signature(config->signature, MP_CONFIG_SIGNATURE) ||
+			smp_checksum((unsigned char *)config, config->length) != 0) {
+		printf("Invalid MP configuration table at %x\n", config);
+		return -1;
+	}
+
+	lapic_base = config->local_apic_address;
+
+	/* Las entradas de procesador ocupan 20 bytes, las demas 8 bytes */
+	entry = (unsigned char *)config + sizeof(mp_config_t);
+	for (i=0; i<config->entry_count; i++) {
+		if (*entry == MP_ENTRY_PROCESSOR) {
+			processor = (mp_processor_t *)entry;
+			if (processor->flags & MP_PROCESSOR_ENABLED) {
+				add_cpu(processor->apic_id);
+			}
+			entry += sizeof(mp_processor_t);
+		}else {
+			entry += 8;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Envia un IPI a un procesador y espera a que sea entregado.
+ * @param apic_id Identificador del APIC local del destino
+ * @param command Valor de los bits 0..31 del ICR
+ */
+static void send_ipi(unsigned char apic_id, unsigned int command) {
+	lapic_write(LAPIC_ICR_HIGH, (unsigned int)apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, command);
+	while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+		cpu_relax();
+	}
+}
+
+/**
+ * @brief Manejador del IPI SMP_CALL_VECTOR. Solo despierta al AP detenido
+ * con hlt en ap_idle().
+ * @param state Estado del procesador
+ */
+static void smp_call_handler(interrupt_state * state) {
+	lapic_eoi();
+}
+
+/**
+ * @brief Espera trabajo enviado con smp_call(). Los AP ejecutan esta rutina
+ * luego de arrancar.
+ * @param cpu Indice del procesador
+ * @param seen Valor de smp_call_generation leido antes de marcar el
+ * procesador como en ejecucion
+ @verbatim
+  Mientras no exista trabajo el procesador se detiene con hlt. sti solo
+  habilita las interrupciones despues de la siguiente instruccion, por lo
+  cual un IPI enviado entre la verificacion de smp_call_generation y hlt
+  queda pendiente y despierta al procesador.
+ @endverbatim*/
+static void ap_idle(int cpu, int seen) {
+	for (;;) {
+		inline_assembly("cli");
+		while (smp_call_generation == seen) {
+			inline_assembly("sti\n\thlt\n\tcli");
+		}
+		inline_assembly("sti");
+		seen = smp_call_generation;
+		if (cpu < smp_call_cpus) {
+			smp_call_function(cpu, smp_call_arg);
+			atomic_add(&smp_call_pending, -1);
+		}
+	}
+}
+
+/**
+ * @brief Punto de entrada en C de los AP. Recibe el control de ap_start
+ * (trampoline.S) con la GDT y la IDT del kernel cargadas y la pila asignada
+ * por el BSP.
+ */
+void ap_main(void) {
+	int cpu;
+	int seen;
+
+	/* GS ya contiene el selector del bloque de datos del procesador */
+	cpu = this_cpu_read(cpu);
+
+	/* Habilitar SSE antes de que el procesador ejecute memcpy() */
+	setup_fpu();
+
+	/* Habilitar el APIC local */
+	lapic_enable();
+
+	/* Nodo NUMA del procesador, para current_numa_node() */
+	numa_cpu_online();
+
+	/* Leer la generacion antes de marcar el procesador como en ejecucion:
+	 * un smp_call() que cuente con este procesador incrementa la
+	 * generacion despues, y no se pierde */
+	seen = smp_call_generation;
+
+	cpus[cpu].online = 1;
+	atomic_add(&online_cpus, 1);
+
+	ap_idle(cpu, seen);
+}
+
+/**
+ * @brief Arranca un procesador de aplicacion.
+ * @param cpu Indice del procesador dentro de cpus
+ * @return 0 si el procesador arranco, -1 en caso contrario.
+ @verbatim
+  1. Se asignan la pila y el bloque de datos del procesador.
+  2. Se envia un IPI INIT y se esperan 10 ms.
+  3. Se envia un IPI STARTUP con el vector TRAMPOLINE_LOCATION / 4096. Si el
+     procesador no arranca en 200 us, se envia un segundo IPI STARTUP.
+  4. Se espera hasta 100 ms a que el procesador se marque como en ejecucion.
+ @endverbatim*/
+static int __init start_ap(int cpu) {
+	char * stack;
+	percpu_t * data;
+	unsigned short selector;
+	int i;
+
+	stack = allocate_unit_region(AP_STACK_SIZE);
+	data = (percpu_t *)allocate_unit_region(sizeof(percpu_t));
+	if (stack == 0 || data == 0) {
+		printf("Not enough memory for the stack of CPU %d\n", cpu);
+		return -1;
+	}
+
+	selector = setup_percpu(cpu, data);
+	if (selector == 0) {
+		free_region(stack, AP_STACK_SIZE);
+		free_region((char *)data, sizeof(percpu_t));
+		return -1;
+	}
+
+	cpus[cpu].stack = stack;
+	cpus[cpu].data = data;
+	ap_boot_stack = stack + AP_STACK_SIZE;
+	ap_boot_selector = selector;
+
+	send_ipi(cpus[cpu].apic_id, ICR_INIT);
+	udelay(10000);
+
+	for (i=0; i<2 && !cpus[cpu].online; i++) {
+		send_ipi(cpus[cpu].apic_id,
+				ICR_STARTUP | (TRAMPOLINE_LOCATION / MEMORY_UNIT_SIZE));
+		udelay(200);
+	}
+
+	for (i=0; i<1000 && !cpus[cpu].online; i++) {
+		udelay(100);
+	}
+
+	if (!cpus[cpu].online) {
+		printf("CPU %d (APIC %d) did not start\n", cpu, cpus[cpu].apic_id);
+		free_region(stack, AP_STACK_SIZE);
+		free_gdt_descriptor(get_gdt_descriptor(selector));
+		free_region((char *)data, sizeof(percpu_t));
+		cpus[cpu].stack = 0;
+		cpus[cpu].data = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Busca los procesadores del sistema y arranca los procesadores de
+ * aplicacion.
+ * @return Numero de procesadores en ejecucion.
+ @verbatim
+  Se debe invocar despues de setup_memory() y setup_acpi(). El BSP es
+  siempre el procesador 0. Las caches de unidades por procesador (ver
+  physmem.c) se activan cuando existe mas de un procesador en ejecucion.
+ @endverbatim*/
+int __init setup_smp(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int length;
+	int i;
+
+	/* El BSP es el procesador 0 */
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	add_cpu(ebx >> 24);
+	cpus[0].online = 1;
+	cpus[0].data = &boot_percpu;
+	online_cpus = 1;
+
+	if (smp_find_madt() != 0 && smp_find_mp() != 0) {
+		return online_cpus;
+	}
+
+	if (cpu_count == 1) {
+		return online_cpus;
+	}
+
+	/* Habilitar el APIC local del BSP */
+	lapic_enable();
+
+	/* Manejador del IPI con el cual smp_call() despierta a los AP */
+	install_interrupt_handler(SMP_CALL_VECTOR, smp_call_handler);
+
+	/* Copiar el codigo de arranque de los AP en memoria baja */
+	length = trampoline_end - trampoline_start;
+	for (i=0; i<length; i++) {
+		((char *)TRAMPOLINE_LOCATION)[i] = trampoline_start[i];
+	}
+
+	/* Arrancar los AP uno por uno, ya que comparten ap_boot_stack */
+	for (i=1; i<cpu_count; i++) {
+		start_ap(i);
+	}
+
+	printf("%d of %d CPUs online\n", online_cpus, cpu_count);
+	return online_cpus;
+}
+
+/**
+ * @brief Permite obtener el indice del procesador actual.
+ * @return Indice del procesador dentro de cpus, 0 si solo existe el BSP.
+ */
+int current_cpu(void) {
+	return this_cpu_read(cpu);
+}
+
+/**
+ * @brief Ejecuta una rutina en todos los procesadores en ejecucion, y espera
+ * a que todos terminen.
+ * @param function Rutina a ejecutar
+ * @param arg Argumento de la rutina
+ * @param cpus_to_use Numero de procesadores que ejecutan la rutina (el BSP y
+ * los AP con indice menor que cpus_to_use)
+ @verbatim
+  Solo se debe invocar desde el BSP. Los AP esperan detenidos en ap_idle():
+  luego de publicar la rutina e incrementar smp_call_generation, se les
+  envia un IPI SMP_CALL_VECTOR para despertarlos.
+ @endverbatim*/
+void smp_call(smp_function function, void * arg, int cpus_to_use) {
+	int i;
+	int pending;
+
+	if (cpus_to_use > cpu_count) {
+		cpus_to_use = cpu_count;
+	}
+
+	pending = 0;
+	for (i=1; i<cpus_to_use; i++) {
+		if (cpus[i].online) {
+			pending++;
+		}
+	}
+
+	smp_call_function = function;
+	smp_call_arg = arg;
+	smp_call_cpus = cpus_to_use;
+	smp_call_pending = pending;
+	atomic_add(&smp_call_generation, 1);
+
+	for (i=1; i<cpus_to_use; i++) {
+		if (cpus[i].online) {
+			send_ipi(cpus[i].apic_id, ICR_FIXED | SMP_CALL_VECTOR);
+		}
+	}
+
+	function(0, arg);
+
+	while (smp_call_pending > 0) {
+		cpu_relax();
+	}
+}
+
+/** @brief Numero de unidades que asigna cada procesador antes de liberarlas
+ * en la prueba de rendimiento */
+#define BENCHMARK_BATCH 8
+
+/**
+ * @brief Rutina que ejecuta cada procesador en la prueba de rendimiento:
+ * asigna BENCHMARK_BATCH unidades y luego las libera, iterations veces.
+ * @param cpu Indice del procesador
+ * @param arg Apuntador al numero de iteraciones
+ */
+static void allocation_worker(int cpu, void * arg) {
+	char * units[BENCHMARK_BATCH];
+	unsigned int iterations;
+	unsigned long long start;
+	unsigned int i;
+	int j;
+
+	iterations = *(unsigned int *)arg;
+
+	start = rdtsc();
+	for (i=0; i<iterations; i++) {
+		for (j=0; j<BENCHMARK_BATCH; j++) {
+			units[j] = allocate_unit();
+		}
+		for (j=0; j<BENCHMARK_BATCH; j++) {
+			if (units[j] != 0) {
+				free_unit(units[j]);
+			}
+		}
+	}
+	benchmark_cycles[cpu] = rdtsc() - start;
+}
+
+/**
+ * @brief Ejecuta la prueba de rendimiento en un numero de procesadores.
+ * @param iterations Iteraciones por procesador
+ * @param cpus_to_use Numero de procesadores
+ * @return Pares asignacion / liberacion por cada 2^20 ciclos, sumando todos
+ * los procesadores.
+ */
+static unsigned int __init run_benchmark(unsigned int iterations, int cpus_to_use) {
+	unsigned long long max_cycles;
+	unsigned int mcycles;
+	unsigned int pairs;
+	int i;
+
+	for (i=0; i<MAX_CPUS; i++) {
+		benchmark_cycles[i] = 0;
+	}
+
+	smp_call(allocation_worker, &iterations, cpus_to_use);
+
+	/* El tiempo total es el del procesador que mas tardo */
+	max_cycles = 0;
+	pairs = 0;
+	for (i=0; i<cpus_to_use && i<cpu_count; i++) {
+		if (benchmark_cycles[i] == 0) {
+			continue;
+		}
+		if (benchmark_cycles[i] > max_cycles) {
+			max_cycles = benchmark_cycles[i];
+		}
+		pairs += iterations * BENCHMARK_BATCH;
+	}
+
+	/* Evitar divisiones de 64 bits */
+	mcycles = (unsigned int)(max_cycles >> 20);
+	if (mcycles == 0) {
+		mcycles = 1;
+	}
+	return pairs / mcycles;
+}
+
+/**
+ * @brief Mide el rendimiento de allocate_unit() y free_unit() con uno y con
+ * todos los procesadores.
+ * @param iterations Numero de ciclos de asignacion y liberacion que realiza
+ * cada procesador
+ @verbatim
+  Con un escalamiento lineal, el rendimiento con N procesadores es N veces
+  el rendimiento con un procesador (speedup = N.00).
+ @endverbatim*/
+void __init smp_allocation_benchmark(unsigned int iterations) {
+	unsigned int single;
+	unsigned int all;
+	unsigned int speedup;
+
+	if (online_cpus < 2) {
+		return;
+	}
+
+	single = run_benchmark(iterations, 1);
+	all = run_benchmark(iterations, cpu_count);
+
+	if (single == 0) {
+		single = 1;
+	}
+	speedup = (all * 100) / single;
+
+	printf("allocate/free pairs per Mcycle: 1 CPU %u, %d CPUs %u "
+			"(speedup %u.%u%u)\n", single, online_cpus, all,
+			speedup / 100, (speedup / 10) % 10, speedup % 10);
+}
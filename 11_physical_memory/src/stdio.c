@@ -8,6 +8,11 @@
  */
 
 #include <stdio.h>
+#include <fbcon.h>
+#include <stdarg.h>
+#include <string.h>
+#include <serial.h>
+#include <clock.h>
 
 /** @brief Apuntador al inicio de la memoria de video.
  * @details
@@ -30,6 +35,40 @@
  */
 unsigned short * videoptr = (unsigned short *) VIDEO_ADDR;
 
+/** @brief Inicio de la memoria de video de modo texto */
+unsigned short * video_memory = (unsigned short *) VIDEO_ADDR;
+
+/** @brief Copia en memoria RAM de las celdas de la pantalla.
+ * @details
+ * Las rutinas de este archivo escriben solo en esta copia y marcan las
+ * celdas modificadas en dirty_first / dirty_last. flush_screen() copia a la
+ * memoria de video (o dibuja en el framebuffer) solo los rangos
+ * modificados, una vez al final de putchar(), puts() o printf(). */
+unsigned short screen_cells[MAX_SCREEN_LINES * MAX_SCREEN_COLUMNS];
+
+/** @brief Primera columna modificada de cada linea de screen_cells */
+short dirty_first[MAX_SCREEN_LINES];
+
+/** @brief Ultima columna modificada de cada linea de screen_cells (menor
+ * que dirty_first si la linea no tiene cambios) */
+short dirty_last[MAX_SCREEN_LINES];
+
+/** @brief Vale 1 si la consola grafica tiene un desplazamiento que aun no
+ * se ha dibujado */
+static int fb_scroll_pending = 0;
+
+/** @brief Instante (clock_ns()) del ultimo redibujo de la consola grafica
+ * por desplazamiento */
+static unsigned long long fb_last_redraw = 0;
+
+/** @brief Celda de video_memory que se muestra en la esquina superior
+ * izquierda de la pantalla.
+ * @details
+ * En modo texto la pantalla se desplaza moviendo la direccion de inicio del
+ * controlador CRT dentro de los 32 KB de memoria de video, en lugar de
+ * copiar las celdas (ver scroll()). */
+unsigned int screen_origin = 0;
+
 /** @brief Byte que almacena los atributos de texto */
 char text_attributes = COLOR(LIGHTGRAY, BLACK);
 
@@ -45,6 +84,13 @@ int current_line = 0;
 /** @brief Variable que controla la columna actual en la pantalla */
 int current_column = 0;
 
+/** @brief Ultima posicion escrita en el cursor de hardware (-1 = ninguna) */
+int cursor_offset = -1;
+
+/** @brief Salidas en las cuales putchar(), puts() y printf() escriben
+ * (combinacion de CONSOLE_*) */
+unsigned int console_sinks = CONSOLE_SCREEN;
+
 /**
  * @brief Funcin privada para subir una lnea si se ha llegado al final
  * de la pantalla
@@ -56,171 +102,224 @@ void scroll(void);
  * */
 void update_cursor(void);
 
+/**
+ * @brief Funcin privada que establece la celda de la memoria de video que
+ * el controlador CRT muestra en la esquina superior izquierda.
+ * @param offset Celda dentro de la memoria de video
+ */
+void set_start_address(unsigned int offset);
+
+/**
+ * @brief Funcin privada que escribe un caracter en las celdas de la
+ * pantalla, sin actualizar el cursor.
+ * @param c caracter ascii a imprimir
+ */
+void write_char(char c);
+
+/**
+ * @brief Funcin privada que escribe una cadena en las celdas de la
+ * pantalla, sin actualizar el cursor.
+ * @param s Cadena terminada en nulo
+ */
+void write_string(char * s);
+
 /**
  * @brief Funcin para imprimir un caracter
  *
- * Esta rutina imprime directamente en la memoria de video. Valida
- * caracteres especiales, como fin de lnea, tabulador y backspace.
+ * Esta rutina escribe en la copia de la pantalla y luego la actualiza.
+ * Valida caracteres especiales, como fin de lnea, tabulador y backspace.
  * @param c caracter ascii a imprimir
  */
 void putchar(char c) {
-
-	int is_printable;
-
-	unsigned int offset;
-	unsigned short * tmp;
-	char linea[80];
-
-	/* El caracter es imprimible? */
-	if (c >= ' ') {
-		is_printable = 1;
-	}else {
-		is_printable = 0;
-	}
-
-	if (c == BACKSPACE) { /* Retroceder el apuntador de la memoria de video */
-		if (current_column != 0) { //Ultima columna?
-			current_column--;
-		}else {
-			if (current_line > 0) {
-				current_column = SCREEN_COLUMNS - 1;
-				current_line--;
-			}
-		}
-	}else if (c == TAB) { /* Mover TABSIZE caracteres */
-		current_column = (current_column + TABSIZE) & ~(TABSIZE-1);
-	}else if (c ==LF) { /* Avanzar a la siguiente linea */
-		current_column = 0;
-		current_line++;
-	}else if(c == CR) {
-		current_column = 0;
-	}
-
-	if (is_printable) { /* Caracter imprimible?*/
-		/* Verificar que no se haya llegado al final de la pantalla */
-		if (current_column == SCREEN_COLUMNS) {
-			current_column = 0;
-			current_line ++;
-			if (current_line == SCREEN_LINES) {
-				scroll();
-			}
-		}
-	    /* Escribir el caracter en la memoria de video*/
-		videoptr = (unsigned short *)VIDEO_ADDR + ((current_line * SCREEN_COLUMNS) +
-									current_column);
-		current_column++;
-		*videoptr = (text_attributes << 8 | c);
-	 }
-	update_cursor();
+	console_write(&c, 1);
 }
 
 /**
  * @brief Funcin para imprimir una cadena de caracteres.
  *
  * Esta rutina valida caracteres especiales, como fin de lnea, tabulador y
- * backspace.
+ * backspace. La pantalla y el cursor se actualizan una sola vez, al final
+ * de la cadena.
  * @param s Cadena terminada en nulo que se desea imprimir
  */
 void puts(char * s ) {
+	unsigned int length;
 
-	char * aux;
-	char c;
-	int is_printable;
-	unsigned int offset;
+	if (s == 0) {
+		return;
+	}
+	for (length = 0; s[length] != '\0'; length++);
+	console_write(s, length);
+}
+
+/**
+ * @brief Escribe una cadena en cada una de las salidas de console_sinks.
+ * @param s Cadena
+ * @param length Numero de caracteres de la cadena
+ @verbatim
+  La pantalla se actualiza una sola vez, al final de la cadena. Con la
+  consola grafica, si la cadena desplazo la pantalla y el ultimo redibujo
+  ocurrio hace menos de FB_REDRAW_INTERVAL_NS, la pantalla no se dibuja:
+  la siguiente escritura o el ciclo de espera del kernel la dibujan. El
+  puerto serial solo copia la cadena en su buffer de transmision, por lo
+  cual printf() no espera a que los caracteres salgan por el puerto.
+ @endverbatim*/
+void console_write(char * s, unsigned int length) {
+	unsigned int i;
+
+	if (console_sinks & CONSOLE_SCREEN) {
+		for (i=0; i<length; i++) {
+			write_char(s[i]);
+		}
+		if (!fb_scroll_pending || tsc_khz == 0 ||
+				clock_ns() - fb_last_redraw >= FB_REDRAW_INTERVAL_NS) {
+			flush_screen();
+		}
+	}
+	if (console_sinks & CONSOLE_SERIAL) {
+		serial_write(s, length);
+	}
+	if (console_sinks & CONSOLE_DEBUGCON) {
+		debugcon_write(s, length);
+	}
+}
 
+/**
+ * @brief Funcin para limpiar la pantalla
+*/
+void cls(void) {
 
-	aux = s;
+	/* Mostrar de nuevo la pantalla desde el inicio de la memoria de video */
+	screen_origin = 0;
+	if (!fb_console_active) {
+		set_start_address(0);
+	}
 
-	if (aux == 0) {return;}
+	/* Llenar las celdas con espacios con los atributos actuales */
+	memsetw(screen_cells, (text_attributes << 8) | SPACE,
+			screen_lines * screen_columns);
 
-	while ((c = *aux++) != '\0'){
+	invalidate_screen();
 
-		/* El caracter es imprimible? */
-			if (c >= ' ') {
-				is_printable = 1;
-			}else {
-				is_printable = 0;
-			}
+	/* Restablecer el apuntador al inicio de la pantalla */
+	videoptr = screen_cells;
+	current_line = 0;
+	current_column = 0;
+	flush_screen();
+}
 
-			if (c == BACKSPACE) { /* Retroceder el apuntador de la memoria de video */
-				if (current_column != 0) { //Ultima columna?
-					current_column--;
-				}else {
-					if (current_line > 0) {
-						current_column = SCREEN_COLUMNS - 1;
-						current_line--;
-					}
-				}
-			}else if (c == TAB) { /* Mover TABSIZE caracteres */
-				current_column = (current_column + TABSIZE) & ~(TABSIZE-1);
-			}else if (c ==LF) { /* Avanzar a la siguiente linea */
-				current_column = 0;
-				current_line++;
-			}else if(c == CR) {
-				current_column = 0;
-			}
+/**
+ * @brief Marca todas las celdas de la pantalla como modificadas.
+ */
+void invalidate_screen(void) {
+	int i;
 
-			if (is_printable) { /* Caracter imprimible?*/
-				/* Verificar que no se haya llegado al final de la pantalla */
-				if (current_column == SCREEN_COLUMNS) {
-					current_column = 0;
-					current_line ++;
-					if (current_line == SCREEN_LINES) {
-						scroll();
-					}
-				}
-				/* Escribir el caracter en la memoria de video*/
-				videoptr = (unsigned short *)VIDEO_ADDR +
-							((current_line * SCREEN_COLUMNS) +
-											current_column);
-				current_column++;
-				*videoptr = (text_attributes << 8 | c);
-			 }
+	for (i=0; i<screen_lines; i++) {
+		dirty_first[i] = 0;
+		dirty_last[i] = screen_columns - 1;
 	}
-	update_cursor();
 }
 
 /**
- * @brief Funcin para limpiar la pantalla
-*/
-void cls(void) {
-	int i;
-	int count;
-	int remainder;
-	unsigned short * word_ptr;
+ * @brief Copia a la memoria de video (o dibuja en el framebuffer) las
+ * celdas modificadas y actualiza el cursor.
+ @verbatim
+  Cada linea modificada se copia con un solo recorrido sobre su rango de
+  columnas modificadas. Las lineas sin cambios no se tocan.
+ @endverbatim*/
+void flush_screen(void) {
+	unsigned short * src;
+	unsigned short * dst;
+	int line;
 
-	/* Asumir que eraser_ptr es multiplo de sizeof (unsigned int) */
-	unsigned int * eraser_ptr = (unsigned int * )VIDEO_ADDR;
+	/* Mover el cursor antes de copiar, para que la consola grafica dibuje
+	 * el cursor junto con las celdas */
+	update_cursor();
 
-	unsigned int eraser = 0;
+	if (fb_scroll_pending) {
+		fb_scroll_pending = 0;
+		fb_last_redraw = clock_ns();
+	}
 
-	word_ptr = (unsigned short*)&eraser;
-	for(i=0; i<sizeof(unsigned int) / sizeof(unsigned short); i++) {
-		*word_ptr++ = (text_attributes << 8) | SPACE;
+	for (line = 0; line < screen_lines; line++) {
+		if (dirty_first[line] > dirty_last[line]) {
+			continue;
+		}
+		if (fb_console_active) {
+			fb_render(line, dirty_first[line], dirty_last[line]);
+		}else {
+			src = screen_cells + line * screen_columns + dirty_first[line];
+			dst = video_memory + screen_origin + line * screen_columns
+					+ dirty_first[line];
+			memcpy(dst, src,
+					(dirty_last[line] - dirty_first[line] + 1) * 2);
+		}
+		dirty_first[line] = MAX_SCREEN_COLUMNS;
+		dirty_last[line] = -1;
 	}
+}
 
-	count = (SCREEN_LINES * SCREEN_COLUMNS) / (sizeof(unsigned int) / 2);
-	remainder = (SCREEN_LINES * SCREEN_COLUMNS) % (sizeof(unsigned int) / 2);
+/* Rutinas privadas de stdio.c */
 
-	for (i=0;i<count;i++) {
-		*eraser_ptr++ = eraser;
+/**
+ * @brief Funcin privada que escribe un caracter en las celdas de la
+ * pantalla, sin actualizar el cursor.
+ * @param c caracter ascii a imprimir
+ */
+void write_char(char c) {
+	if (c == BACKSPACE) { /* Retroceder el apuntador de la memoria de video */
+		if (current_column != 0) { //Ultima columna?
+			current_column--;
+		}else {
+			if (current_line > 0) {
+				current_column = screen_columns - 1;
+				current_line--;
+			}
+		}
+	}else if (c == TAB) { /* Mover TABSIZE caracteres */
+		current_column = (current_column + TABSIZE) & ~(TABSIZE-1);
+	}else if (c ==LF) { /* Avanzar a la siguiente linea */
+		current_column = 0;
+		current_line++;
+	}else if(c == CR) {
+		current_column = 0;
 	}
 
-	if (remainder > 0) {
-		word_ptr = (unsigned short*)eraser_ptr;
-		for (i=0; i<remainder; i++) {
-			*word_ptr++ = (text_attributes << 8) | SPACE;
-		}
+	if (c < ' ') { /* Caracter no imprimible */
+		return;
 	}
 
-	/* Restablecer el apuntador al inicio de la memoria de video*/
-	videoptr = (unsigned short *) VIDEO_ADDR;
-	current_line = 0;
-	current_column = 0;
-	update_cursor();
+	/* Verificar que no se haya llegado al final de la linea o de la
+	 * pantalla */
+	if (current_column >= screen_columns) {
+		current_column = 0;
+		current_line ++;
+	}
+	if (current_line >= screen_lines) {
+		scroll();
+	}
+
+	/* Escribir el caracter en la copia de la pantalla */
+	videoptr = screen_cells + ((current_line * screen_columns) +
+								current_column);
+	*videoptr = (text_attributes << 8 | (unsigned char)c);
+	mark_dirty(current_line, current_column);
+	current_column++;
 }
 
-/* Rutinas privadas de stdio.c */
+/**
+ * @brief Funcin privada que escribe una cadena en las celdas de la
+ * pantalla, sin actualizar el cursor.
+ * @param s Cadena terminada en nulo
+ */
+void write_string(char * s) {
+	if (s == 0) {
+		return;
+	}
+	while (*s != '\0') {
+		write_char(*s++);
+	}
+}
 
 /**
  * @brief Funcin privada que permite actualizar el cursor en la pantalla.
@@ -244,16 +343,30 @@ void update_cursor(void) {
 	 */
 
 	//Scroll: La segunda linea se convierte en la primera, etc.
-	if (current_line >= SCREEN_LINES) {
+	if (current_line >= screen_lines) {
 		scroll();
 	}
 
 	line = current_line;
 	column = current_column;
 
+	/* Con la consola grafica, el cursor se dibuja junto con las celdas
+	 * modificadas */
+	if (fb_console_active) {
+		fb_set_cursor(line, column);
+		return;
+	}
+
 	/* El registro CRT recibe el desplazamiento en bytes desde el inicio
 	 * de la memoria de video */
-	tmp = (line * SCREEN_COLUMNS) + column;
+	tmp = screen_origin + (line * screen_columns) + column;
+
+	/* Las escrituras a los puertos son lentas: no repetirlas si el cursor
+	 * no se ha movido */
+	if (tmp == cursor_offset) {
+		return;
+	}
+	cursor_offset = tmp;
 
 	/*
 	 * 0x3D4 = Registro de indice del CRT. 0x0F = Cursor Location Low: 8 bits
@@ -272,87 +385,464 @@ void update_cursor(void) {
 	outb(0x3D5, tmp>> 8);
 }
 
+/**
+ * @brief Funcin privada que establece la celda de la memoria de video que
+ * el controlador CRT muestra en la esquina superior izquierda.
+ * @param offset Celda dentro de la memoria de video
+ */
+void set_start_address(unsigned int offset) {
+	/* 0x0C = Start Address High, 0x0D = Start Address Low */
+	outb(0x3D4, 0x0C);
+	outb(0x3D5, offset >> 8);
+	outb(0x3D4, 0x0D);
+	outb(0x3D5, offset);
+}
+
 /**
  * @brief Funcin privada para subir una lnea si se ha llegado al final
  * de la pantalla
+ @verbatim
+  La copia de la pantalla (screen_cells) siempre se desplaza en memoria
+  RAM, junto con los rangos de columnas modificadas de cada linea. La
+  ultima linea se borra y se marca como modificada.
+
+  En modo texto la memoria de video (32 KB) tiene espacio para cerca de 200
+  lineas de 80 columnas. Mientras la linea siguiente a la pantalla quepa en
+  la memoria, basta con avanzar screen_origin en una linea y cambiar la
+  direccion de inicio del CRT: las lineas que ya se habian copiado quedan
+  en su nueva posicion sin copiar celdas en la memoria de video.
+
+       VIDEO_ADDR
+       +----------------+
+       |                |
+       +----------------+ <-- screen_origin (antes)
+       | linea 0        | <-- screen_origin (despues)
+       | ...            |
+       | linea 24       |
+       +----------------+ <-- nueva linea (se copia en flush_screen())
+       |                |
+       +----------------+ VIDEO_ADDR + VIDEO_MEMORY_SIZE
+
+  Cuando la linea siguiente ya no cabe, screen_origin vuelve a 0 y toda la
+  pantalla se marca como modificada. Esto ocurre una vez por cada recorrido
+  completo de la memoria de video.
+
+  Con la consola grafica toda la pantalla se vuelve a dibujar, a lo sumo
+  una vez cada FB_REDRAW_INTERVAL_NS (ver console_write()).
+ @endverbatim
  */
 void scroll(void) {
-	int i;
 	unsigned short * tmp_video;
-	/*Apuntar a la segunda linea */
-	tmp_video = (unsigned short *)VIDEO_ADDR + (SCREEN_COLUMNS);
-	//Copiar SCREEN_LINES - 1 lineas de SCREEN_COLUMNS caracteres
-	for (i=0; i<(SCREEN_LINES - 1) * SCREEN_COLUMNS; i++) {
-			*(tmp_video-SCREEN_COLUMNS) = *tmp_video;
-			tmp_video++;
-	}
+	unsigned int screen_size;
+
+	screen_size = screen_lines * screen_columns;
+
+	/* Desplazar la copia de la pantalla y sus rangos modificados */
+	memmove(screen_cells, screen_cells + screen_columns,
+			(screen_size - screen_columns) * 2);
+	memmove(dirty_first, dirty_first + 1,
+			(screen_lines - 1) * sizeof(dirty_first[0]));
+	memmove(dirty_last, dirty_last + 1,
+			(screen_lines - 1) * sizeof(dirty_last[0]));
 
 	/* Y luego borrar la ultima linea */
-	tmp_video = (unsigned short *)VIDEO_ADDR + ((SCREEN_LINES - 1) *
-					SCREEN_COLUMNS);
-	for (i=0; i< SCREEN_COLUMNS; i++) {
-			*(tmp_video) = (text_attributes << 8 | SPACE);
-			tmp_video++;
+	tmp_video = screen_cells + screen_size - screen_columns;
+	memsetw(tmp_video, text_attributes << 8 | SPACE, screen_columns);
+	tmp_video += screen_columns;
+	dirty_first[screen_lines - 1] = 0;
+	dirty_last[screen_lines - 1] = screen_columns - 1;
+
+	if (fb_console_active) {
+		invalidate_screen();
+		fb_scroll_pending = 1;
+	}else if (screen_origin + screen_size + screen_columns <= VIDEO_CELLS) {
+		/* Desplazar la pantalla por hardware */
+		screen_origin += screen_columns;
+		set_start_address(screen_origin);
+	}else {
+		/* Volver al inicio de la memoria de video */
+		screen_origin = 0;
+		set_start_address(0);
+		invalidate_screen();
 	}
-	videoptr = (unsigned short *)VIDEO_ADDR + ((SCREEN_LINES - 1) *
-						SCREEN_COLUMNS);
-	current_line = SCREEN_LINES - 1;
+
+	videoptr = tmp_video - screen_columns;
+	current_line = screen_lines - 1;
 	current_column = 0;
 }
 
 
+/** @brief Digitos en minusculas para las bases 2, 8 y 16 */
+static const char lower_digits[] = "0123456789abcdef";
+
+/** @brief Digitos en mayusculas para la base 16 (%X) */
+static const char upper_digits[] = "0123456789ABCDEF";
+
+/** @brief Pares de digitos decimales de 00 a 99: un numero se convierte a
+ * base 10 con una division entre 100 por cada dos digitos. */
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/**
+ * @brief Funcin privada que convierte un numero a texto, escribiendo los
+ * digitos hacia atras a partir de end (no requiere invertir la cadena).
+ * @param end Posicion siguiente al ultimo digito
+ * @param value Numero a convertir
+ * @param base Base (2, 8, 10 o 16)
+ * @param digits Tabla de digitos para las bases 2, 8 y 16
+ * @return Apuntador al primer digito
+ */
+static char * format_number(char * end, unsigned long long value,
+		unsigned int base, const char * digits) {
+	unsigned int n;
+	unsigned int q;
+	unsigned int shift;
+	int i;
+
+	if (base != 10) {
+		shift = (base == 16) ? 4 : (base == 8) ? 3 : 1;
+		do {
+			*--end = digits[(unsigned int)value & (base - 1)];
+			value >>= shift;
+		} while (value != 0);
+		return end;
+	}
+
+	/* Mientras el numero no quepa en 32 bits, convertir bloques de 9
+	 * digitos */
+	while ((value >> 32) != 0) {
+		n = divide64(&value, 1000000000);
+		for (i=0; i<4; i++) {
+			q = n / 100;
+			end -= 2;
+			end[0] = digit_pairs[(n - q * 100) * 2];
+			end[1] = digit_pairs[(n - q * 100) * 2 + 1];
+			n = q;
+		}
+		*--end = '0' + n;
+	}
+
+	/* Dos digitos por cada division */
+	n = (unsigned int)value;
+	while (n >= 100) {
+		q = n / 100;
+		end -= 2;
+		end[0] = digit_pairs[(n - q * 100) * 2];
+		end[1] = digit_pairs[(n - q * 100) * 2 + 1];
+		n = q;
+	}
+	if (n >= 10) {
+		end -= 2;
+		end[0] = digit_pairs[n * 2];
+		end[1] = digit_pairs[n * 2 + 1];
+	}else {
+		*--end = '0' + n;
+	}
+	return end;
+}
+
 /**
  * @brief  Esa funcion implementa en forma basica el comportamiento de
  * 'printf' en C.
- * @param format Formato de la cadena de salida
+ * @param format Formato de la cadena de salida (ver vsnprintf())
  * @param ...  Lista de referencias a memoria de las variables a imprimir
- *
+ @verbatim
+  La cadena completa se construye con vsnprintf() en un buffer local (hasta
+  PRINTF_BUFFER_SIZE - 1 caracteres) y luego se escribe en la pantalla con
+  una sola invocacion a puts().
+ @endverbatim
 */
 void printf(char * format,...) {
-        char ** arg;
-        char c;
-        char buf[255];
-        char *p;
-        int i;
-
-        //Posicionar arg en la direccin de format
-        arg = (char **)&format;
-
-        /* Avanzar arg para que apunte al siguiente parametro */
-        arg++;
-
-        while ((c = *format++) != '\0') {
-                //Buscar el indicador de formato '%'
-                if (c != '%') { //Imprimir el caracter
-                        putchar(c);
-                        continue; //Pasar a la siguiente iteracion
-                }
-                //c = '%', el siguiente caracter indica el tipo de datos
-                c = *format++;
-                if (c == 'd') { //Entero con signo
-                    itoa (*((int *) arg++), buf, 10);
-                    puts(buf);
-                }else if (c == 'u') { //Entero sin signo
-                    utoa (*((int *) arg++), buf, 10);
-                    puts(buf);
-                }else if(c == 'x') { //hex
-                        itoa (*((int *) arg++), buf, 16);
-                        puts(buf);
-                }else if(c == 'b') { //binario
-                        itoa (*((int *) arg++), buf, 2);
-                        puts(buf);
-                }else if(c == 'o') { //octal
-                    itoa (*((int *) arg++), buf, 8);
-                    puts(buf);
-                } else if(c == 's') { //String
-                        p = *arg++;
-                        if (p == 0 || *p == '\0') {
-                                puts("(null)");
-                        }else {
-                                puts(p);
-                        }
-                }else { //En caso contrario, mostrar la referencia
-                        putchar( *((int *) arg++));
-                }
-        }
+	char buf[PRINTF_BUFFER_SIZE];
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if (length >= sizeof(buf)) {
+		length = sizeof(buf) - 1;
+	}
+	console_write(buf, length);
+}
+
+/**
+ * @brief Construye una cadena con formato en un buffer.
+ * @param buf Buffer de salida
+ * @param size Tamano del buffer. La cadena siempre termina en nulo (si
+ * size > 0), y se trunca si no cabe.
+ * @param format Formato de la cadena (ver vsnprintf())
+ * @param ... Argumentos
+ * @return Numero de caracteres que tendria la cadena completa, sin el nulo.
+ */
+int snprintf(char * buf, unsigned int size, char * format, ...) {
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(buf, size, format, args);
+	va_end(args);
+
+	return length;
+}
+
+/**
+ * @brief Construye una cadena con formato en un buffer, a partir de una
+ * lista de argumentos variables.
+ * @param buf Buffer de salida
+ * @param size Tamano del buffer
+ * @param format Formato de la cadena
+ * @param args Argumentos
+ * @return Numero de caracteres que tendria la cadena completa, sin el nulo.
+ @verbatim
+  Formato: %[flags][ancho][.precision][longitud]conversion
+  flags:      - (alinear a la izquierda), 0 (rellenar con ceros),
+              + (signo siempre), espacio, # (prefijo 0x / 0)
+  ancho:      numero o * (tomado de los argumentos)
+  precision:  numero minimo de digitos, o maximo de caracteres para %s
+  longitud:   h, hh, l (32 bits), ll (64 bits)
+  conversion: d i u x X o b p c s %
+ @endverbatim*/
+int vsnprintf(char * buf, unsigned int size, char * format, va_list args) {
+	char number[72];
+	char * end;
+	char * digits;
+	char * prefix;
+	char sign;
+	int left;
+	int zero;
+	int plus;
+	int space;
+	int alternate;
+	int width;
+	int precision;
+	int length_modifier;
+	int length;
+	int zeros;
+	int padding;
+	unsigned int base;
+	unsigned long long value;
+	long long signed_value;
+	unsigned int pos;
+	char c;
+
+	pos = 0;
+
+/* Agregar un caracter a la salida, si cabe */
+#define EMIT(ch) do { if (pos + 1 < size) { buf[pos] = (ch); } pos++; } while (0)
+
+	for (; (c = *format) != '\0'; format++) {
+		if (c != '%') {
+			EMIT(c);
+			continue;
+		}
+
+		/* Flags */
+		left = zero = plus = space = alternate = 0;
+		for (;;) {
+			c = *++format;
+			if (c == '-') {
+				left = 1;
+			}else if (c == '0') {
+				zero = 1;
+			}else if (c == '+') {
+				plus = 1;
+			}else if (c == ' ') {
+				space = 1;
+			}else if (c == '#') {
+				alternate = 1;
+			}else {
+				break;
+			}
+		}
+
+		/* Ancho */
+		width = 0;
+		if (c == '*') {
+			width = va_arg(args, int);
+			if (width < 0) {
+				left = 1;
+				width = -width;
+			}
+			c = *++format;
+		}else {
+			while (c >= '0' && c <= '9') {
+				width = width * 10 + (c - '0');
+				c = *++format;
+			}
+		}
+
+		/* Precision */
+		precision = -1;
+		if (c == '.') {
+			precision = 0;
+			c = *++format;
+			if (c == '*') {
+				precision = va_arg(args, int);
+				c = *++format;
+			}else {
+				while (c >= '0' && c <= '9') {
+					precision = precision * 10 + (c - '0');
+					c = *++format;
+				}
+			}
+		}
+
+		/* Longitud: solo importa ll (64 bits) */
+		length_modifier = 0;
+		while (c == 'h' || c == 'l') {
+			if (c == 'l') {
+				length_modifier++;
+			}
+			c = *++format;
+		}
+
+		base = 10;
+		digits = (char *)lower_digits;
+		prefix = "";
+		sign = 0;
+
+		switch (c) {
+		case 'd':
+		case 'i':
+			if (length_modifier >= 2) {
+				signed_value = va_arg(args, long long);
+			}else {
+				signed_value = va_arg(args, int);
+			}
+			if (signed_value < 0) {
+				sign = '-';
+				value = -(unsigned long long)signed_value;
+			}else {
+				sign = plus ? '+' : (space ? ' ' : 0);
+				value = signed_value;
+			}
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'b':
+		case 'p':
+			if (c == 'p') {
+				value = (unsigned int)va_arg(args, void *);
+				alternate = 1;
+			}else if (length_modifier >= 2) {
+				value = va_arg(args, unsigned long long);
+			}else {
+				value = va_arg(args, unsigned int);
+			}
+			if (c == 'x' || c == 'X' || c == 'p') {
+				base = 16;
+				if (c == 'X') {
+					digits = (char *)upper_digits;
+				}
+				if (alternate && value != 0) {
+					prefix = (c == 'X') ? "0X" : "0x";
+				}
+			}else if (c == 'o') {
+				base = 8;
+				if (alternate) {
+					prefix = "0";
+				}
+			}else if (c == 'b') {
+				base = 2;
+			}
+			break;
+		case 'c':
+			number[0] = (char)va_arg(args, int);
+			end = number;
+			length = 1;
+			goto emit_string;
+		case 's':
+			end = va_arg(args, char *);
+			if (end == 0) {
+				end = "(null)";
+			}
+			for (length = 0; end[length] != '\0' &&
+					(precision < 0 || length < precision); length++);
+			goto emit_string;
+		case '%':
+			EMIT('%');
+			continue;
+		default:
+			/* Conversion desconocida: copiarla tal cual */
+			EMIT('%');
+			if (c == '\0') {
+				format--;
+			}else {
+				EMIT(c);
+			}
+			continue;
+		}
+
+		/* Numero: [espacios][signo][prefijo][ceros][digitos][espacios] */
+		if (precision == 0 && value == 0) {
+			end = number + sizeof(number);
+		}else {
+			end = format_number(number + sizeof(number), value, base, digits);
+		}
+		length = (number + sizeof(number)) - end;
+
+		zeros = (precision > length) ? precision - length : 0;
+		padding = width - length - zeros - (sign != 0);
+		for (digits = prefix; *digits != '\0'; digits++) {
+			padding--;
+		}
+		if (zero && !left && precision < 0 && padding > 0) {
+			zeros += padding;
+			padding = 0;
+		}
+
+		for (; !left && padding > 0; padding--) {
+			EMIT(' ');
+		}
+		if (sign) {
+			EMIT(sign);
+		}
+		for (; *prefix != '\0'; prefix++) {
+			EMIT(*prefix);
+		}
+		for (; zeros > 0; zeros--) {
+			EMIT('0');
+		}
+		for (; end < number + sizeof(number); end++) {
+			EMIT(*end);
+		}
+		for (; padding > 0; padding--) {
+			EMIT(' ');
+		}
+		continue;
+
+emit_string:
+		/* Cadena o caracter: [espacios][cadena][espacios] */
+		padding = width - length;
+		for (; !left && padding > 0; padding--) {
+			EMIT(' ');
+		}
+		for (; length > 0; length--) {
+			EMIT(*end++);
+		}
+		for (; padding > 0; padding--) {
+			EMIT(' ');
+		}
+	}
+
+#undef EMIT
+
+	if (size > 0) {
+		buf[(pos < size) ? pos : size - 1] = '\0';
+	}
+
+	return pos;
 }
@@ -0,0 +1,461 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de las rutinas para copiar, llenar y
+ * comparar bloques de memoria.
+ */
+
+#include <string.h>
+#include <asm.h>
+#include <fpu.h>
+#include <stdio.h>
+#include <physmem.h>
+#include <init.h>
+
+/** @brief Capacidades detectadas por setup_string() */
+unsigned int string_features = 0;
+
+/**
+ * @brief Detecta las capacidades del procesador que usan las rutinas de
+ * este archivo.
+ */
+void setup_string(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	string_features = 0;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (edx & CPUID_EDX_SSE2) {
+		string_features |= STRING_SSE2;
+		if (read_cr4() & CR4_OSFXSR) {
+			string_features |= STRING_XMM;
+		}
+	}
+}
+
+/**
+ * @brief Inicia una seccion que usa los registros XMM (ver fpu_begin()).
+ * @return Diferente de cero si se pueden usar
+ */
+static __inline__ int xmm_begin(void) {
+	return (string_features & STRING_XMM) && fpu_begin();
+}
+
+/**
+ * @brief Copia hacia adelante con rep movsd. El destino se alinea primero
+ * a 4 bytes; los bytes restantes se copian con rep movsb.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ */
+static void copy_rep(char * dst, const char * src, unsigned int n) {
+	unsigned int d0, d1, d2;
+
+	while (n > 0 && ((unsigned int)dst & 3) != 0) {
+		*dst++ = *src++;
+		n--;
+	}
+
+	inline_assembly("movl %%ecx, %%edx\n\t"
+			"shrl $2, %%ecx\n\t"
+			"rep movsl\n\t"
+			"movl %%edx, %%ecx\n\t"
+			"andl $3, %%ecx\n\t"
+			"rep movsb"
+			: "=&D" (d0), "=&S" (d1), "=&c" (d2)
+			: "0" (dst), "1" (src), "2" (n)
+			: "edx", "memory");
+}
+
+/**
+ * @brief Copia hacia adelante con registros XMM, 64 bytes por iteracion.
+ * Las lecturas no requieren alineacion; las escrituras se alinean a 16
+ * bytes. Con nontemporal = 1 se usa movntdq en lugar de movdqa.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ * @param nontemporal 1 si las escrituras no deben pasar por la cache
+ */
+static void __xmm copy_xmm(char * dst, const char * src, unsigned int n,
+		int nontemporal) {
+	unsigned int lead;
+	unsigned int blocks;
+
+	lead = (-(unsigned int)dst) & 15;
+	copy_rep(dst, src, lead);
+	dst += lead;
+	src += lead;
+	n -= lead;
+
+	blocks = n / 64;
+	if (blocks > 0) {
+		if (nontemporal) {
+			inline_assembly("1:\n\t"
+					"movdqu (%1), %%xmm0\n\t"
+					"movdqu 16(%1), %%xmm1\n\t"
+					"movdqu 32(%1), %%xmm2\n\t"
+					"movdqu 48(%1), %%xmm3\n\t"
+					"movntdq %%xmm0, (%0)\n\t"
+					"movntdq %%xmm1, 16(%0)\n\t"
+					"movntdq %%xmm2, 32(%0)\n\t"
+					"movntdq %%xmm3, 48(%0)\n\t"
+					"addl $64, %0\n\t"
+					"addl $64, %1\n\t"
+					"decl %2\n\t"
+					"jnz 1b\n\t"
+					"sfence"
+					: "+r" (dst), "+r" (src), "+r" (blocks)
+					: : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+		}else {
+			inline_assembly("1:\n\t"
+					"movdqu (%1), %%xmm0\n\t"
+					"movdqu 16(%1), %%xmm1\n\t"
+					"movdqu 32(%1), %%xmm2\n\t"
+					"movdqu 48(%1), %%xmm3\n\t"
+					"movdqa %%xmm0, (%0)\n\t"
+					"movdqa %%xmm1, 16(%0)\n\t"
+					"movdqa %%xmm2, 32(%0)\n\t"
+					"movdqa %%xmm3, 48(%0)\n\t"
+					"addl $64, %0\n\t"
+					"addl $64, %1\n\t"
+					"decl %2\n\t"
+					"jnz 1b"
+					: "+r" (dst), "+r" (src), "+r" (blocks)
+					: : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+		}
+	}
+
+	copy_rep(dst, src, n & 63);
+}
+
+/**
+ * @brief Copia hacia adelante con movnti (escrituras non-temporal desde
+ * registros de proposito general), 16 bytes por iteracion. No usa los
+ * registros XMM, por lo cual solo requiere SSE2.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ */
+static void copy_movnti(char * dst, const char * src, unsigned int n) {
+	unsigned int lead;
+	unsigned int blocks;
+
+	lead = (-(unsigned int)dst) & 3;
+	copy_rep(dst, src, lead);
+	dst += lead;
+	src += lead;
+	n -= lead;
+
+	blocks = n / 16;
+	if (blocks > 0) {
+		inline_assembly("1:\n\t"
+				"movl (%1), %%eax\n\t"
+				"movl 4(%1), %%edx\n\t"
+				"movnti %%eax, (%0)\n\t"
+				"movnti %%edx, 4(%0)\n\t"
+				"movl 8(%1), %%eax\n\t"
+				"movl 12(%1), %%edx\n\t"
+				"movnti %%eax, 8(%0)\n\t"
+				"movnti %%edx, 12(%0)\n\t"
+				"addl $16, %0\n\t"
+				"addl $16, %1\n\t"
+				"decl %2\n\t"
+				"jnz 1b\n\t"
+				"sfence"
+				: "+r" (dst), "+r" (src), "+r" (blocks)
+				: : "eax", "edx", "memory", "cc");
+	}
+
+	copy_rep(dst, src, n & 15);
+}
+
+/**
+ * @brief Copia un bloque de memoria. Los bloques no se deben traslapar.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ * @return dst
+ @verbatim
+  La copia siempre se realiza hacia adelante, por lo cual memmove() tambien
+  la usa cuando el destino se encuentra antes del origen.
+ @endverbatim*/
+void * memcpy(void * dst, const void * src, unsigned int n) {
+	if (n >= STRING_NONTEMPORAL_THRESHOLD && (string_features & STRING_SSE2)) {
+		if (xmm_begin()) {
+			copy_xmm(dst, src, n, 1);
+			fpu_end();
+		}else {
+			copy_movnti(dst, src, n);
+		}
+	}else if (n >= STRING_SSE_THRESHOLD && xmm_begin()) {
+		copy_xmm(dst, src, n, 0);
+		fpu_end();
+	}else {
+		copy_rep(dst, src, n);
+	}
+	return dst;
+}
+
+/**
+ * @brief Copia un bloque de memoria. Los bloques se pueden traslapar.
+ * @param dst Destino
+ * @param src Origen
+ * @param n Numero de bytes
+ * @return dst
+ @verbatim
+  Si el destino se encuentra despues del origen y los bloques se traslapan,
+  la copia se realiza hacia atras (DF = 1): primero los bytes que no
+  completan una palabra al final del bloque, y luego palabras de 4 bytes.
+ @endverbatim*/
+void * memmove(void * dst, const void * src, unsigned int n) {
+	unsigned int d0, d1, d2;
+
+	if ((char *)dst <= (char *)src || (char *)dst >= (char *)src + n) {
+		return memcpy(dst, src, n);
+	}
+
+	inline_assembly("std\n\t"
+			"movl %%ecx, %%edx\n\t"
+			"andl $3, %%ecx\n\t"
+			"rep movsb\n\t"
+			"movl %%edx, %%ecx\n\t"
+			"shrl $2, %%ecx\n\t"
+			"subl $3, %%esi\n\t"
+			"subl $3, %%edi\n\t"
+			"rep movsl\n\t"
+			"cld"
+			: "=&D" (d0), "=&S" (d1), "=&c" (d2)
+			: "0" ((char *)dst + n - 1), "1" ((char *)src + n - 1), "2" (n)
+			: "edx", "memory");
+
+	return dst;
+}
+
+/**
+ * @brief Llena un bloque con rep stosd. El destino se alinea primero a 4
+ * bytes. Los bytes de pattern se escriben en orden (el menos significativo
+ * primero), por lo cual sirve para valores de 16 bits.
+ * @param dst Destino
+ * @param pattern Valor de 32 bits con el que se llenan las palabras
+ * @param n Numero de bytes
+ */
+static void fill_rep(char * dst, unsigned int pattern, unsigned int n) {
+	unsigned int d0, d1;
+
+	while (n > 0 && ((unsigned int)dst & 3) != 0) {
+		*dst++ = pattern;
+		pattern = (pattern >> 8) | (pattern << 24);
+		n--;
+	}
+
+	inline_assembly("rep stosl"
+			: "=&D" (d0), "=&c" (d1)
+			: "0" (dst), "1" (n / 4), "a" (pattern)
+			: "memory");
+
+	dst += n & ~3;
+	for (n &= 3; n > 0; n--) {
+		*dst++ = pattern;
+		pattern >>= 8;
+	}
+}
+
+/**
+ * @brief Llena un bloque con movnti, 16 bytes por iteracion.
+ * @param dst Destino
+ * @param pattern Valor de 32 bits con el que se llenan las palabras
+ * @param n Numero de bytes
+ */
+static void fill_movnti(char * dst, unsigned int pattern, unsigned int n) {
+	unsigned int lead;
+	unsigned int blocks;
+
+	lead = (-(unsigned int)dst) & 3;
+	fill_rep(dst, pattern, lead);
+	dst += lead;
+	n -= lead;
+	pattern = (pattern >> (8 * lead)) | (pattern << (8 * ((4 - lead) & 3)));
+
+	blocks = n / 16;
+	if (blocks > 0) {
+		inline_assembly("1:\n\t"
+				"movnti %2, (%0)\n\t"
+				"movnti %2, 4(%0)\n\t"
+				"movnti %2, 8(%0)\n\t"
+				"movnti %2, 12(%0)\n\t"
+				"addl $16, %0\n\t"
+				"decl %1\n\t"
+				"jnz 1b\n\t"
+				"sfence"
+				: "+r" (dst), "+r" (blocks)
+				: "r" (pattern)
+				: "memory", "cc");
+	}
+
+	fill_rep(dst, pattern, n & 15);
+}
+
+/**
+ * @brief Llena un bloque de memoria con un valor.
+ * @param dst Destino
+ * @param c Valor (se usan los 8 bits menos significativos)
+ * @param n Numero de bytes
+ * @return dst
+ */
+void * memset(void * dst, int c, unsigned int n) {
+	unsigned int pattern;
+
+	pattern = (unsigned char)c * 0x01010101;
+
+	if (n >= STRING_NONTEMPORAL_THRESHOLD && (string_features & STRING_SSE2)) {
+		fill_movnti(dst, pattern, n);
+	}else {
+		fill_rep(dst, pattern, n);
+	}
+	return dst;
+}
+
+/**
+ * @brief Llena un bloque de memoria con un valor de 16 bits.
+ * @param dst Destino (alineado a 2 bytes)
+ * @param value Valor
+ * @param count Numero de valores de 16 bits
+ * @return dst
+ */
+void * memsetw(void * dst, unsigned short value, unsigned int count) {
+	unsigned short * p;
+	unsigned int pattern;
+
+	p = dst;
+	if (count > 0 && ((unsigned int)p & 2) != 0) {
+		*p++ = value;
+		count--;
+	}
+
+	pattern = ((unsigned int)value << 16) | value;
+	fill_rep((char *)p, pattern, count * 2);
+
+	return dst;
+}
+
+/**
+ * @brief Compara dos bloques de memoria.
+ * @param a Primer bloque
+ * @param b Segundo bloque
+ * @param n Numero de bytes
+ * @return 0 si los bloques son iguales, un valor negativo o positivo segun
+ * el primer byte diferente.
+ @verbatim
+  Se comparan palabras de 4 bytes hasta encontrar una diferente, y luego se
+  busca el byte diferente dentro de ella.
+ @endverbatim*/
+int memcmp(const void * a, const void * b, unsigned int n) {
+	const unsigned char * p;
+	const unsigned char * q;
+
+	p = a;
+	q = b;
+
+	while (n >= 4 && *(const unsigned int *)p == *(const unsigned int *)q) {
+		p += 4;
+		q += 4;
+		n -= 4;
+	}
+
+	for (; n > 0; n--, p++, q++) {
+		if (*p != *q) {
+			return *p - *q;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Copia byte por byte, para comparar en string_benchmark().
+ */
+static void copy_bytes(char * dst, const char * src, unsigned int n) {
+	while (n-- > 0) {
+		*dst++ = *src++;
+	}
+}
+
+/**
+ * @brief Mide el ancho de banda de cada implementacion de memcpy y memset
+ * (ciclos por KB) con bloques de varios tamanos.
+ @verbatim
+  Se usan dos regiones de 1 MB de la memoria del kernel. Cada medicion se
+  repite hasta copiar 4 MB, y se reporta el promedio en ciclos del TSC por
+  cada KB copiado. Un '-' indica que el procesador no soporta el camino.
+ @endverbatim*/
+void __init string_benchmark(void) {
+	static const unsigned int sizes[] = {4096, 65536, 0x100000};
+	char * src;
+	char * dst;
+	unsigned long long start;
+	unsigned int cycles[6];
+	unsigned int size;
+	unsigned int rounds;
+	unsigned int r;
+	int i;
+	int m;
+
+	src = allocate_unit_region(0x100000);
+	dst = allocate_unit_region(0x100000);
+	if (src == 0 || dst == 0) {
+		printf("String benchmark: not enough memory\n");
+		free_region(src, 0x100000);
+		free_region(dst, 0x100000);
+		return;
+	}
+
+	memset(src, 0x5A, 0x100000);
+
+	printf("Cycles/KB     bytes  rep movsd  xmm     movnti  movntdq  rep stosd\n");
+	for (i=0; i<sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size = sizes[i];
+		rounds = 0x400000 / size;
+
+		for (m=0; m<6; m++) {
+			cycles[m] = 0;
+			if ((m == 2 || m == 4) && !(string_features & STRING_XMM)) {
+				continue;
+			}
+			if (m == 3 && !(string_features & STRING_SSE2)) {
+				continue;
+			}
+			if ((m == 2 || m == 4) && !fpu_begin()) {
+				continue;
+			}
+			start = rdtsc();
+			for (r=0; r<rounds; r++) {
+				switch (m) {
+				case 0: copy_bytes(dst, src, size); break;
+				case 1: copy_rep(dst, src, size); break;
+				case 2: copy_xmm(dst, src, size, 0); break;
+				case 3: copy_movnti(dst, src, size); break;
+				case 4: copy_xmm(dst, src, size, 1); break;
+				case 5: fill_rep(dst, 0, size); break;
+				}
+			}
+			cycles[m] = (unsigned int)((rdtsc() - start) >> 12);
+			if (m == 2 || m == 4) {
+				fpu_end();
+			}
+		}
+
+		printf("%4u KB ", size / 1024);
+		for (m=0; m<6; m++) {
+			if (cycles[m] == 0) {
+				printf(" %9s", "-");
+			}else {
+				printf(" %9u", cycles[m]);
+			}
+		}
+		printf("\n");
+	}
+
+	free_region(src, 0x100000);
+	free_region(dst, 0x100000);
+}
@@ -0,0 +1,486 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ * @brief Contiene la implementacion de los temporizadores del kernel.
+ */
+
+#include <timer.h>
+#include <clock.h>
+#include <idt.h>
+#include <irq.h>
+#include <apic.h>
+#include <physmem.h>
+#include <stdio.h>
+#include <init.h>
+
+/** @brief Dispositivo que genera las interrupciones (TIMER_DEVICE_*) */
+int timer_device = 0;
+
+/** @brief Frecuencia del temporizador del APIC local en kHz, luego del
+ * divisor */
+static unsigned int lapic_timer_khz;
+
+/** @brief Casillas de la rueda */
+static timer_t * timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+/** @brief Siguiente pulso que se debe procesar. Todos los pulsos anteriores
+ * ya se procesaron. */
+static unsigned long long timer_base;
+
+/** @brief Instante (en ns) para el cual se programo el hardware, TIMER_NONE
+ * si no se programo */
+static unsigned long long timer_armed;
+
+/** @brief Maximo intervalo en ns que acepta el hardware */
+static unsigned long long timer_max_delta;
+
+/** @brief Protege la rueda. Se toma con las interrupciones deshabilitadas. */
+static volatile unsigned int timer_lock;
+
+/**
+ * @brief Deshabilita las interrupciones y toma timer_lock.
+ * @return Valor de EFLAGS para timer_lock_release()
+ */
+static __inline__ unsigned int timer_lock_acquire(void) {
+	unsigned int flags;
+
+	flags = irq_save();
+	while (atomic_cmpxchg(&timer_lock, 0, 1) != 0) {
+		cpu_relax();
+	}
+	return flags;
+}
+
+/**
+ * @brief Libera timer_lock y restaura las interrupciones.
+ * @param flags Valor retornado por timer_lock_acquire()
+ */
+static __inline__ void timer_lock_release(unsigned int flags) {
+	inline_assembly("" : : : "memory");
+	timer_lock = 0;
+	irq_restore(flags);
+}
+
+/**
+ * @brief Quita un temporizador de la lista en la que se encuentra.
+ * @param t Temporizador pendiente
+ */
+static __inline__ void timer_unlink(timer_t * t) {
+	*t->pprev = t->next;
+	if (t->next != 0) {
+		t->next->pprev = t->pprev;
+	}
+	t->pprev = 0;
+}
+
+/**
+ * @brief Inserta un temporizador al inicio de una lista.
+ * @param head Cabeza de la lista
+ * @param t Temporizador
+ */
+static __inline__ void timer_link(timer_t ** head, timer_t * t) {
+	t->next = *head;
+	if (t->next != 0) {
+		t->next->pprev = &t->next;
+	}
+	*head = t;
+	t->pprev = head;
+}
+
+/**
+ * @brief Inserta un temporizador en la casilla que corresponde a su
+ * vencimiento. Se invoca con timer_lock tomado.
+ * @param t Temporizador
+ @verbatim
+  El nivel es el menor tal que el vencimiento este a menos de 64^(nivel+1)
+  pulsos de timer_base, y la casilla son los bits del vencimiento que
+  corresponden a ese nivel. Un temporizador que ya vencio queda en la
+  casilla de timer_base.
+ @endverbatim*/
+static void wheel_insert(timer_t * t) {
+	unsigned long long expires;
+	unsigned long long delta;
+	unsigned int slot;
+	int level;
+
+	expires = t->expires;
+	if (expires < timer_base) {
+		expires = timer_base;
+	}
+	delta = expires - timer_base;
+
+	level = 0;
+	while (level < TIMER_LEVELS - 1
+			&& delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))) {
+		level++;
+	}
+	if (delta >= (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS))) {
+		expires = timer_base + (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+	}
+
+	slot = (unsigned int)(expires >> (TIMER_SLOT_BITS * level))
+			& TIMER_SLOT_MASK;
+	timer_link(&timer_wheel[level][slot], t);
+}
+
+/**
+ * @brief Calcula el siguiente pulso en el cual hay trabajo: una casilla del
+ * nivel 0 con temporizadores, o una casilla de un nivel superior que se
+ * debe redistribuir. Se invoca con timer_lock tomado.
+ * @return Pulso, TIMER_NONE si la rueda esta vacia.
+ */
+static unsigned long long timer_next_tick(void) {
+	unsigned long long next;
+	unsigned long long tick;
+	unsigned long long position;
+	unsigned int shift;
+	unsigned int current;
+	unsigned int d;
+	int level;
+
+	next = TIMER_NONE;
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		shift = TIMER_SLOT_BITS * level;
+		position = timer_base >> shift;
+		current = (unsigned int)position & TIMER_SLOT_MASK;
+
+		/* La casilla actual de un nivel superior ya se redistribuyo,
+		 * excepto si timer_base es justo el pulso en el cual se debe
+		 * redistribuir */
+		d = 0;
+		if (level > 0 && (timer_base & ((1ULL << shift) - 1)) != 0) {
+			d = 1;
+		}
+		for (; d <= TIMER_SLOTS; d++) {
+			if (timer_wheel[level][(current + d) & TIMER_SLOT_MASK] != 0) {
+				break;
+			}
+		}
+		if (d > TIMER_SLOTS || (level == 0 && d == TIMER_SLOTS)) {
+			continue;
+		}
+
+		tick = (position + d) << shift;
+		if (level == 0) {
+			tick = timer_base + d;
+		}
+		if (tick < next) {
+			next = tick;
+		}
+	}
+
+	return next;
+}
+
+/**
+ * @brief Redistribuye los temporizadores de una casilla en los niveles
+ * inferiores. Se invoca con timer_lock tomado.
+ * @param level Nivel
+ * @param slot Casilla
+ */
+static void wheel_cascade(int level, unsigned int slot) {
+	timer_t * t;
+
+	while ((t = timer_wheel[level][slot]) != 0) {
+		timer_unlink(t);
+		wheel_insert(t);
+	}
+}
+
+/**
+ * @brief Programa el hardware para el vencimiento mas cercano. Se invoca con
+ * timer_lock tomado.
+ @verbatim
+  El temporizador del APIC local solo se puede programar desde el BSP: si
+  otro procesador agrega un temporizador, este se atiende en la siguiente
+  interrupcion del BSP.
+ @endverbatim*/
+static void timer_program(void) {
+	unsigned long long next;
+	unsigned long long now;
+	unsigned long long delta;
+	unsigned int count;
+
+	next = timer_next_tick();
+	if (next == TIMER_NONE) {
+		/* Ambos dispositivos se detienen luego de una interrupcion */
+		timer_armed = TIMER_NONE;
+		return;
+	}
+	if (timer_device == TIMER_DEVICE_LAPIC && this_cpu_read(cpu) != 0) {
+		return;
+	}
+
+	next <<= TIMER_TICK_SHIFT;
+	now = clock_ns();
+	delta = TIMER_MIN_DELTA;
+	if (next > now + TIMER_MIN_DELTA) {
+		delta = next - now;
+	}
+	if (delta > timer_max_delta) {
+		delta = timer_max_delta;
+	}
+	timer_armed = now + delta;
+
+	if (timer_device == TIMER_DEVICE_LAPIC) {
+		delta *= lapic_timer_khz;
+		divide64(&delta, 1000000);
+		count = (unsigned int)delta;
+		if (count == 0) {
+			count = 1;
+		}
+		lapic_write(LAPIC_TIMER_INITIAL, count);
+	}else {
+		delta *= PIT_FREQUENCY;
+		divide64(&delta, 1000000000);
+		count = (unsigned int)delta;
+		if (count == 0) {
+			count = 1;
+		}
+		outb(PIT_COMMAND, PIT_CHANNEL0_ONESHOT);
+		outb(PIT_CHANNEL0, count & 0xFF);
+		outb(PIT_CHANNEL0, count >> 8);
+	}
+}
+
+/**
+ * @brief Ejecuta los temporizadores vencidos y programa el hardware para el
+ * siguiente vencimiento.
+ @verbatim
+  Los pulsos sin trabajo se saltan con timer_next_tick(). En cada pulso:
+  - Si la casilla del nivel 0 es la 0, se redistribuye la casilla actual
+    del nivel 1 (y si esta es la 0, la del nivel 2, etc).
+  - La casilla del nivel 0 se pasa a una lista local, y sus temporizadores
+    se ejecutan sin timer_lock: la rutina puede volver a agregar su
+    temporizador, y otro procesador puede cancelar los que siguen en la
+    lista local.
+ @endverbatim*/
+static void run_timers(void) {
+	unsigned long long now;
+	unsigned long long next;
+	unsigned int flags;
+	unsigned int slot;
+	timer_t * expired;
+	timer_t * t;
+	int level;
+
+	now = clock_ns() >> TIMER_TICK_SHIFT;
+
+	flags = timer_lock_acquire();
+	while (timer_base <= now) {
+		next = timer_next_tick();
+		if (next > now) {
+			timer_base = now + 1;
+			break;
+		}
+		timer_base = next;
+
+		slot = (unsigned int)timer_base & TIMER_SLOT_MASK;
+		for (level = 1; level < TIMER_LEVELS; level++) {
+			if (((timer_base >> (TIMER_SLOT_BITS * (level - 1)))
+					& TIMER_SLOT_MASK) != 0) {
+				break;
+			}
+			wheel_cascade(level, (unsigned int)(timer_base
+					>> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK);
+		}
+		timer_base++;
+
+		expired = 0;
+		if (timer_wheel[0][slot] != 0) {
+			expired = timer_wheel[0][slot];
+			expired->pprev = &expired;
+			timer_wheel[0][slot] = 0;
+		}
+		while ((t = expired) != 0) {
+			timer_unlink(t);
+			timer_lock_release(flags);
+			t->function(t, t->arg);
+			flags = timer_lock_acquire();
+		}
+	}
+	timer_program();
+	timer_lock_release(flags);
+}
+
+/**
+ * @brief Manejador de la IRQ0 (canal 0 del PIT).
+ * @param state Estado del procesador
+ */
+static void pit_timer_handler(interrupt_state * state) {
+	run_timers();
+}
+
+/**
+ * @brief Manejador de la interrupcion del temporizador del APIC local. No
+ * pasa por irq_dispatcher(), por lo cual envia el EOI y marca que se
+ * encuentra dentro de un manejador de IRQ.
+ * @param state Estado del procesador
+ */
+static void lapic_timer_handler(interrupt_state * state) {
+	lapic_eoi();
+	this_cpu_add(irq_nesting, 1);
+	run_timers();
+	this_cpu_add(irq_nesting, -1);
+}
+
+/**
+ * @brief Calibra el temporizador del APIC local del BSP contra el TSC.
+ * @return 0 si el temporizador funciona, -1 en caso contrario.
+ */
+static int __init setup_lapic_timer(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int elapsed;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_EDX_APIC)) {
+		return -1;
+	}
+
+	/* El APIC local del BSP puede estar deshabilitado si las IRQ se
+	 * entregan por los PIC y existe un solo procesador */
+	lapic_enable();
+
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | TIMER_LAPIC_VECTOR);
+	lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+	udelay(10000);
+	elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+	lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+	lapic_timer_khz = elapsed / 10;
+	if (lapic_timer_khz == 0) {
+		return -1;
+	}
+
+	/* Modo one shot (bits 17-18 en 0), sin mascara */
+	install_interrupt_handler(TIMER_LAPIC_VECTOR, lapic_timer_handler);
+	lapic_write(LAPIC_LVT_TIMER, TIMER_LAPIC_VECTOR);
+	return 0;
+}
+
+int __init setup_timers(void) {
+	unsigned long long max;
+
+	if (tsc_khz == 0) {
+		printf("Timers require a calibrated TSC\n");
+		return -1;
+	}
+
+	/* Detener la interrupcion periodica: en modo 0 el contador no inicia
+	 * hasta que se escriba la cuenta */
+	outb(PIT_COMMAND, PIT_CHANNEL0_ONESHOT);
+
+	timer_base = clock_ns() >> TIMER_TICK_SHIFT;
+	timer_armed = TIMER_NONE;
+
+	if (setup_lapic_timer() == 0) {
+		timer_device = TIMER_DEVICE_LAPIC;
+		max = 0xFFFFFFFFULL * 1000000;
+		divide64(&max, lapic_timer_khz);
+		printf("Timers: local APIC, %u kHz\n", lapic_timer_khz);
+	}else {
+		timer_device = TIMER_DEVICE_PIT;
+		install_irq_handler(0, pit_timer_handler);
+		max = 0xFFFFULL * 1000000000;
+		divide64(&max, PIT_FREQUENCY);
+		printf("Timers: PIT one shot\n");
+	}
+	timer_max_delta = max;
+
+	return 0;
+}
+
+void timer_init(timer_t * t, timer_function function, void * arg) {
+	t->next = 0;
+	t->pprev = 0;
+	t->expires = 0;
+	t->function = function;
+	t->arg = arg;
+}
+
+void timer_start(timer_t * t, unsigned int us) {
+	unsigned long long expires;
+	unsigned int flags;
+
+	/* Redondear hacia arriba, para que el temporizador no venza antes */
+	expires = clock_ns() + (unsigned long long)us * 1000
+			+ (1 << TIMER_TICK_SHIFT) - 1;
+	expires >>= TIMER_TICK_SHIFT;
+
+	flags = timer_lock_acquire();
+	if (timer_pending(t)) {
+		timer_unlink(t);
+	}
+	t->expires = expires;
+	wheel_insert(t);
+	if (timer_device != 0 && (expires << TIMER_TICK_SHIFT) < timer_armed) {
+		timer_program();
+	}
+	timer_lock_release(flags);
+}
+
+int timer_cancel(timer_t * t) {
+	unsigned int flags;
+	int pending;
+
+	/* El hardware no se reprograma: si este era el vencimiento mas cercano,
+	 * la siguiente interrupcion no encuentra trabajo y lo reprograma */
+	flags = timer_lock_acquire();
+	pending = timer_pending(t);
+	if (pending) {
+		timer_unlink(t);
+	}
+	timer_lock_release(flags);
+
+	return pending;
+}
+
+/**
+ * @brief Rutina de los temporizadores de timer_benchmark(). No se invoca.
+ * @param t Temporizador
+ * @param arg Parametro
+ */
+static void timer_benchmark_function(timer_t * t, void * arg) {
+}
+
+void __init timer_benchmark(unsigned int count) {
+	timer_t * timers;
+	unsigned long long start;
+	unsigned int insert;
+	unsigned int cancel;
+	unsigned int seed;
+	unsigned int i;
+
+	timers = (timer_t *)allocate_unit_region(count * sizeof(timer_t));
+	if (timers == 0) {
+		printf("Timer benchmark: not enough memory\n");
+		return;
+	}
+
+	/* Vencimientos pseudoaleatorios entre 1 ms y ~35 minutos, para ocupar
+	 * todos los niveles */
+	seed = 12345;
+	start = rdtsc();
+	for (i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		timer_init(&timers[i], timer_benchmark_function, 0);
+		timer_start(&timers[i], 1000 + (seed >> 1) % (1U << (i % 32)));
+	}
+	insert = (unsigned int)(rdtsc() - start);
+
+	start = rdtsc();
+	for (i = 0; i < count; i++) {
+		if (!timer_cancel(&timers[i])) {
+			printf("Timer benchmark: timer %u was not pending!\n", i);
+		}
+	}
+	cancel = (unsigned int)(rdtsc() - start);
+
+	printf("Timers: %u pending, %u cycles per insert, %u per cancel\n",
+			count, insert / count, cancel / count);
+
+	free_region((char *)timers, count * sizeof(timer_t));
+}